@@ -42,6 +42,7 @@
 #include <list>
 
 #include "../../lib/jtaghal/jtaghal.h"
+#include "../../lib/jtaghal/ProtobufHelpers.h"
 //#include <svnversion.h>
 
 #include <signal.h>
@@ -51,6 +52,7 @@ using namespace std;
 void ShowUsage();
 void ShowVersion();
 void PrintDeviceInfo(TestableDevice* pdev);
+void ProfileChainDiscovery(const string& server, unsigned short port);
 
 #ifndef _WIN32
 void sig_handler(int sig);
@@ -347,6 +349,10 @@ int main(int argc, char* argv[])
 				iface.GetName().c_str(), iface.GetSerial().c_str(), iface.GetUserID().c_str(), iface.GetFrequency()/1E6);
 		}
 
+		//Have the daemon rediscover the chain and tell us where the time went
+		if(profile_init_time)
+			ProfileChainDiscovery(server, port);
+
 		//Initialize the chain
 		LogVerbose("Initializing chain...\n");
 		double start = GetTime();
@@ -610,6 +616,74 @@ void PrintDeviceInfo(TestableDevice* pdev)
 	pdev->PrintInfo();
 }
 
+/**
+	@brief Asks the daemon to rediscover the scan chain and prints how long each phase of discovery took
+
+	NetworkedJtagInterface doesn't pass the breakdown on, so this uses a connection of its own.
+
+	@param server	Hostname of the daemon
+	@param port		Port number of the daemon
+
+	\ingroup jtagclient
+ */
+void ProfileChainDiscovery(const string& server, unsigned short port)
+{
+	Socket sock(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+	if(!sock.Connect(server, port))
+	{
+		throw JtagExceptionWrapper(
+			"Failed to connect to daemon for profiling",
+			"");
+	}
+
+	//Exchange hellos. No compression or fast framing, we only send two messages.
+	JtaghalPacket packet;
+	if(!RecvMessage(sock, packet, JtaghalPacket::kHello))
+	{
+		throw JtagExceptionWrapper(
+			"Failed to get serverhello",
+			"");
+	}
+	auto h = packet.mutable_hello();
+	h->set_magic("JTAGHAL");
+	h->set_version(1);
+	h->set_transport(Hello::TRANSPORT_JTAG);
+	h->set_codecs(0);
+	h->set_fastframing(false);
+	h->clear_token();
+	if(!SendMessage(sock, packet))
+	{
+		throw JtagExceptionWrapper(
+			"Failed to send clienthello",
+			"");
+	}
+
+	//A cached chain has no phases to report, so force a rescan
+	packet.Clear();
+	packet.mutable_chaininforequest()->set_rescan(true);
+	if(!SendMessage(sock, packet))
+	{
+		throw JtagExceptionWrapper(
+			"Failed to send chain info request",
+			"");
+	}
+	if(!RecvMessage(sock, packet, JtaghalPacket::kChainInfoReply))
+	{
+		throw JtagExceptionWrapper(
+			"Failed to get chain info reply",
+			"");
+	}
+
+	auto& ci = packet.chaininforeply();
+	LogDebug("    Daemon discovered %d devices:\n", ci.devices_size());
+	for(auto& p : ci.phases())
+		LogDebug("        %-20s %.3f ms\n", p.name().c_str(), p.seconds() * 1000);
+
+	packet.Clear();
+	packet.mutable_disconnectrequest();
+	SendMessage(sock, packet);
+}
+
 /**
 	@brief Prints program usage
 
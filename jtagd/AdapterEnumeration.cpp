@@ -0,0 +1,439 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Adapter enumeration and serial number lookup
+ */
+#include "jtagd.h"
+#include <algorithm>
+#include <dirent.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Enumeration
+
+/**
+	@brief Opens every Digilent interface to read its serial number etc.
+
+	Opening an interface is slow (each one is a USB round trip or several through the Adept runtime) but they're opened
+	one at a time, since DigilentJtagInterface makes no promises about being constructed from several threads at once.
+ */
+AdapterList EnumerateDigilentAdapters()
+{
+	AdapterList list;
+	#ifdef HAVE_DJTG
+		list.m_count = DigilentJtagInterface::GetInterfaceCount();
+		for(int i=0; i<list.m_count; i++)
+		{
+			AdapterInfo info;
+			info.m_index = i;
+			try
+			{
+				DigilentJtagInterface iface(i);
+				info.m_name = iface.GetName();
+				info.m_serial = iface.GetSerial();
+				info.m_userid = iface.GetUserID();
+				info.m_freq = iface.GetFrequency();
+				info.m_ok = true;
+			}
+			catch(const JtagException&)
+			{
+				//just write off this adapter - maybe someone else is using it!
+			}
+			list.m_adapters.push_back(info);
+		}
+	#endif
+	return list;
+}
+
+/**
+	@brief Gets info about every MPSSE-capable FTDI interface.
+
+	These are all queries against the D2XX device list rather than opens, so they're cheap and done in order.
+ */
+AdapterList EnumerateFTDIAdapters()
+{
+	AdapterList list;
+	#ifdef HAVE_FTD2XX
+		list.m_count = FTDIJtagInterface::GetInterfaceCount();
+		for(int i=0; i<list.m_count; i++)
+		{
+			AdapterInfo info;
+			info.m_index = i;
+			try
+			{
+				if(!FTDIJtagInterface::IsMPSSECapable(i))
+					continue;
+				info.m_name = FTDIJtagInterface::GetDescription(i);
+				info.m_serial = FTDIJtagInterface::GetSerialNumber(i);
+				info.m_userid = info.m_serial;
+				info.m_freq = FTDIJtagInterface::GetDefaultFrequency(i);
+				info.m_ok = true;
+			}
+			catch(const JtagException&)
+			{
+			}
+			list.m_adapters.push_back(info);
+		}
+	#endif
+	return list;
+}
+
+/**
+	@brief Gets info about every Glasgow interface
+ */
+AdapterList EnumerateGlasgowAdapters()
+{
+	AdapterList list;
+	#ifdef HAVE_LIBUSB
+		list.m_count = GlasgowSWDInterface::GetInterfaceCount();
+		for(int i=0; i<list.m_count; i++)
+		{
+			AdapterInfo info;
+			info.m_index = i;
+			try
+			{
+				info.m_name = GlasgowSWDInterface::GetDescription(i);
+				info.m_serial = GlasgowSWDInterface::GetSerialNumber(i);
+				info.m_userid = info.m_serial;
+				info.m_ok = true;
+			}
+			catch(const JtagException&)
+			{
+			}
+			list.m_adapters.push_back(info);
+		}
+	#endif
+	return list;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Serial number to index cache
+
+/**
+	@brief USB IDs of the adapters we support, so unrelated devices coming and going don't invalidate the cache
+ */
+static const struct
+{
+	int vid;
+
+	///@brief Product ID, or -1 for any product from this vendor
+	int pid;
+} g_adapterUsbIDs[] =
+{
+	{ 0x1443, -1 },		//Digilent
+	{ 0x0403, -1 },		//FTDI (including Digilent's FTDI based adapters)
+	{ 0x20b7, 0x9db1 }	//Glasgow
+};
+
+/**
+	@brief Reads a hex number (e.g. idVendor) from a sysfs attribute
+
+	@return The value, or -1 if it couldn't be read
+ */
+static int ReadSysfsHex(const string& path)
+{
+	FILE* fp = fopen(path.c_str(), "r");
+	if(!fp)
+		return -1;
+	int value = -1;
+	if(1 != fscanf(fp, "%x", &value))
+		value = -1;
+	fclose(fp);
+	return value;
+}
+
+/**
+	@brief Calls a function for every USB device in sysfs that has a device number
+
+	@param visit	Called with the sysfs path of each device and its ID (node name and device number, e.g. "1-4.2:17",
+					which changes if the device is unplugged or re-enumerated). Returns false to stop the scan.
+
+	@return False if sysfs isn't available (not Linux)
+ */
+static bool ForEachUsbDevice(const function<bool(const string& path, const string& id)>& visit)
+{
+	const char* base = "/sys/bus/usb/devices";
+	DIR* d = opendir(base);
+	if(!d)
+		return false;
+
+	dirent* ent;
+	while( (ent = readdir(d)) != NULL)
+	{
+		string name = ent->d_name;
+		if(name[0] == '.')
+			continue;
+
+		//Interfaces and hubs' ports don't have device numbers
+		string path = string(base) + "/" + name;
+		FILE* fp = fopen((path + "/devnum").c_str(), "r");
+		if(!fp)
+			continue;
+		int devnum = 0;
+		bool ok = (1 == fscanf(fp, "%d", &devnum));
+		fclose(fp);
+		if(!ok)
+			continue;
+
+		if(!visit(path, name + ":" + to_string(devnum)))
+			break;
+	}
+	closedir(d);
+	return true;
+}
+
+/**
+	@brief Gets a string that changes whenever a supported adapter is plugged, unplugged, or re-enumerated.
+
+	On Linux this is built from the device number of every supported adapter in sysfs (device numbers are never reused
+	until the counter wraps, so a replug always changes it). Elsewhere we have no cheap way to tell, so return an empty
+	string and callers should not trust any cached topology-dependent data.
+ */
+string GetUsbTopologyFingerprint()
+{
+	vector<string> nodes;
+	bool ok = ForEachUsbDevice([&](const string& path, const string& id)
+	{
+		//Skip anything that isn't one of our adapters
+		int vid = ReadSysfsHex(path + "/idVendor");
+		int pid = ReadSysfsHex(path + "/idProduct");
+		for(auto& usbid : g_adapterUsbIDs)
+		{
+			if( (usbid.vid == vid) && ( (usbid.pid == -1) || (usbid.pid == pid) ) )
+			{
+				nodes.push_back(id);
+				break;
+			}
+		}
+		return true;
+	});
+	if(!ok)
+		return "";
+
+	sort(nodes.begin(), nodes.end());
+	Sha256 hash;
+	for(auto& n : nodes)
+	{
+		hash.Update(reinterpret_cast<const uint8_t*>(n.c_str()), n.length());
+		hash.Update(reinterpret_cast<const uint8_t*>(";"), 1);
+	}
+	return Sha256::ToHex(hash.Final());
+}
+
+/**
+	@brief Finds the USB device with a given serial number.
+
+	@param serial	Serial number as reported by the device
+
+	@return The device's sysfs node name and device number (e.g. "1-4.2:17"), which changes if the device is unplugged
+			or re-enumerated, or an empty string if there's no such device or we can't tell (not Linux, or the adapter
+			API reports a serial number that isn't the USB one).
+ */
+string FindUsbDevice(const string& serial)
+{
+	string found;
+	ForEachUsbDevice([&](const string& path, const string& id)
+	{
+		FILE* fp = fopen((path + "/serial").c_str(), "r");
+		if(!fp)
+			return true;
+		char line[256] = {0};
+		bool match = fgets(line, sizeof(line), fp) && (string(line).substr(0, strcspn(line, "\r\n")) == serial);
+		fclose(fp);
+		if(!match)
+			return true;
+
+		found = id;
+		return false;
+	});
+	return found;
+}
+
+/**
+	@brief Looks up an adapter index by serial number in the cache.
+
+	The cache is ignored entirely if the USB topology changed since it was written.
+
+	@param path		Path to the cache file
+	@param api		API name (e.g. "digilent")
+	@param serial	Serial number to look up
+	@param index	Index of the interface
+
+	@return True if found
+ */
+bool LookupCachedAdapterIndex(const string& path, const string& api, const string& serial, int& index)
+{
+	string topology = GetUsbTopologyFingerprint();
+	if(topology.empty())
+		return false;
+
+	FILE* fp = fopen(path.c_str(), "r");
+	if(!fp)
+		return false;
+
+	//First line is the topology fingerprint, then one "api serial index" per line
+	char line[512];
+	bool found = false;
+	bool valid = false;
+	while(fgets(line, sizeof(line), fp))
+	{
+		char sapi[64];
+		char sserial[256];
+		int n;
+		if(!valid)
+		{
+			if( (1 == sscanf(line, "topology %255s", sserial)) && (topology == sserial) )
+				valid = true;
+			else
+				break;
+		}
+		else if( (3 == sscanf(line, "%63s %255s %d", sapi, sserial, &n)) && (api == sapi) && (serial == sserial) )
+		{
+			index = n;
+			found = true;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return found;
+}
+
+/**
+	@brief Saves the serial number to index mapping for all adapters on one API.
+
+	Entries for other APIs are kept if the topology hasn't changed since they were written. The file is only rewritten
+	if its contents would change, since this runs on every --list.
+ */
+void SaveAdapterIndexCache(const string& path, const string& api, const vector<AdapterInfo>& adapters)
+{
+	string topology = GetUsbTopologyFingerprint();
+	if(topology.empty())
+		return;
+
+	//Read the old cache, keeping entries for other APIs if it's still valid
+	string before;
+	vector<string> lines;
+	FILE* fp = fopen(path.c_str(), "r");
+	if(fp)
+	{
+		char line[512];
+		bool first = true;
+		bool valid = false;
+		while(fgets(line, sizeof(line), fp))
+		{
+			before += line;
+
+			char sapi[64];
+			if(first)
+			{
+				char stopo[256];
+				valid = (1 == sscanf(line, "topology %255s", stopo)) && (topology == stopo);
+				first = false;
+			}
+			else if( valid && (1 == sscanf(line, "%63s", sapi)) && (api != sapi) )
+				lines.push_back(line);
+		}
+		fclose(fp);
+	}
+
+	string after = "topology " + topology + "\n";
+	for(auto& l : lines)
+		after += l;
+	for(auto& a : adapters)
+	{
+		if(a.m_ok)
+			after += api + " " + a.m_serial + " " + to_string(a.m_index) + "\n";
+	}
+	if(after == before)
+		return;
+
+	fp = fopen(path.c_str(), "w");
+	if(!fp)
+		return;
+	fputs(after.c_str(), fp);
+	fclose(fp);
+}
+
+#ifdef HAVE_DJTG
+
+/**
+	@brief Opens the Digilent interface with a given serial number.
+
+	If the cache says where the adapter is and nothing has been plugged in since, only that adapter is opened.
+	Otherwise every interface is probed and the cache is rebuilt.
+
+	@param serial		Serial number of the adapter to open
+	@param cachepath	Path to the adapter index cache
+	@param freq			TCK frequency to request, in Hz, or 0 for the driver default
+
+	@return The interface, or NULL if no adapter with that serial number was found
+ */
+DigilentJtagInterface* OpenDigilentInterface(const string& serial, const string& cachepath, int freq)
+{
+	//TCK can only be chosen when the adapter is opened
+	auto openindex = [freq](int index)
+	{
+		if(freq)
+			return new DigilentJtagInterface(index, freq);
+		return new DigilentJtagInterface(index);
+	};
+
+	int index;
+	if(LookupCachedAdapterIndex(cachepath, "digilent", serial, index))
+	{
+		try
+		{
+			auto iface = openindex(index);
+			if(iface->GetSerial() == serial)
+				return iface;
+			delete iface;
+		}
+		catch(const JtagException&)
+		{
+		}
+		LogVerbose("Cached index for adapter \"%s\" is stale, rescanning\n", serial.c_str());
+	}
+
+	auto list = EnumerateDigilentAdapters();
+	SaveAdapterIndexCache(cachepath, "digilent", list.m_adapters);
+	for(auto& a : list.m_adapters)
+	{
+		if(a.m_ok && (a.m_serial == serial))
+			return openindex(a.m_index);
+	}
+
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Adapter enumeration and serial number lookup
+ */
+
+#ifndef AdapterEnumeration_h
+#define AdapterEnumeration_h
+
+#include <string>
+#include <vector>
+
+/**
+	@brief Information about one adapter found during enumeration
+ */
+class AdapterInfo
+{
+public:
+	AdapterInfo()
+		: m_index(0)
+		, m_ok(false)
+		, m_freq(0)
+	{}
+
+	///@brief Index of the interface within its API
+	int m_index;
+
+	///@brief False if we couldn't get any information (adapter in use, etc)
+	bool m_ok;
+
+	std::string m_name;
+	std::string m_serial;
+	std::string m_userid;
+
+	///@brief Default clock frequency, or 0 if unknown
+	int m_freq;
+};
+
+/**
+	@brief Results of enumerating one API
+ */
+class AdapterList
+{
+public:
+	AdapterList()
+		: m_count(0)
+	{}
+
+	///@brief Number of interfaces the API reported (including ones not listed in m_adapters)
+	int m_count;
+
+	std::vector<AdapterInfo> m_adapters;
+};
+
+AdapterList EnumerateDigilentAdapters();
+AdapterList EnumerateFTDIAdapters();
+AdapterList EnumerateGlasgowAdapters();
+
+std::string GetUsbTopologyFingerprint();
+std::string FindUsbDevice(const std::string& serial);
+bool LookupCachedAdapterIndex(const std::string& path, const std::string& api, const std::string& serial, int& index);
+void SaveAdapterIndexCache(const std::string& path, const std::string& api, const std::vector<AdapterInfo>& adapters);
+
+#ifdef HAVE_DJTG
+DigilentJtagInterface* OpenDigilentInterface(const std::string& serial, const std::string& cachepath, int freq = 0);
+#endif
+
+#endif
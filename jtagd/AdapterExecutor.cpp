@@ -0,0 +1,149 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of AdapterExecutor
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+AdapterExecutor::AdapterExecutor(size_t maxDepth)
+	: m_maxDepth(maxDepth)
+	, m_busy(false)
+	, m_terminating(false)
+	, m_wakeTime(0)
+{
+}
+
+AdapterExecutor::~AdapterExecutor()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_terminating = true;
+	}
+	m_jobReady.notify_all();
+	if(m_worker.joinable())
+		m_worker.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Job control
+
+/**
+	@brief Queues a job for execution, blocking if the queue is full
+
+	The worker is started by the first job, so sessions that never pipeline anything don't cost a thread.
+ */
+void AdapterExecutor::Submit(Job job)
+{
+	unique_lock<mutex> lock(m_mutex);
+	if(!m_worker.joinable())
+		m_worker = thread(&AdapterExecutor::WorkerThread, this);
+	m_jobDone.wait(lock, [&]{ return m_jobs.size() < m_maxDepth; });
+
+	//Don't bother running anything else if a previous job already failed
+	if(m_error)
+		return;
+
+	if(m_jobs.empty() && !m_busy)
+		m_wakeTime = GetTime();
+	m_jobs.push_back(move(job));
+	m_jobReady.notify_one();
+}
+
+/**
+	@brief Blocks until all queued jobs have completed.
+
+	If any job failed since the last Sync(), rethrows its exception.
+ */
+void AdapterExecutor::Sync()
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_jobDone.wait(lock, [&]{ return m_jobs.empty() && !m_busy; });
+
+	if(m_error)
+	{
+		auto err = m_error;
+		m_error = nullptr;
+		rethrow_exception(err);
+	}
+}
+
+void AdapterExecutor::WorkerThread()
+{
+	g_realtime.ApplyThread(RealtimeScheduler::ROLE_ADAPTER);
+
+	unique_lock<mutex> lock(m_mutex);
+	while(true)
+	{
+		m_jobReady.wait(lock, [&]{ return m_terminating || !m_jobs.empty(); });
+		if(m_terminating)
+			break;
+
+		if(m_wakeTime != 0)
+		{
+			g_realtime.RecordWakeup(GetTime() - m_wakeTime);
+			m_wakeTime = 0;
+		}
+
+		Job job = move(m_jobs.front());
+		m_jobs.pop_front();
+		m_busy = true;
+
+		//Run the job without holding the lock so the session thread can keep queueing
+		lock.unlock();
+		exception_ptr err;
+		try
+		{
+			job();
+		}
+		catch(...)
+		{
+			err = current_exception();
+		}
+		lock.lock();
+
+		//Flush anything queued after a failure, it would run against an unknown chain state
+		if(err)
+		{
+			if(!m_error)
+				m_error = err;
+			m_jobs.clear();
+		}
+
+		m_busy = false;
+		m_jobDone.notify_all();
+	}
+}
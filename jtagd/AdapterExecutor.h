@@ -0,0 +1,101 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of AdapterExecutor
+ */
+
+#ifndef AdapterExecutor_h
+#define AdapterExecutor_h
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+	@brief Runs adapter operations on a dedicated thread so that network and USB transfers can overlap
+
+	Jobs are executed strictly in submission order. The queue is bounded: Submit() blocks once m_maxDepth jobs are
+	pending, which pushes back on the client through TCP flow control and keeps daemon memory usage bounded no matter
+	how much data the client streams at us.
+
+	If a job throws, the exception is held until the next call to Sync() and all jobs queued after it are discarded.
+
+	The worker thread is only started when the first job is submitted. It runs in the adapter role of g_realtime, and
+	reports how long it takes to wake up for a new job.
+ */
+class AdapterExecutor
+{
+public:
+	AdapterExecutor(size_t maxDepth = 4);
+	virtual ~AdapterExecutor();
+
+	typedef std::function<void()> Job;
+
+	void Submit(Job job);
+	void Sync();
+
+protected:
+	void WorkerThread();
+
+	///@brief Maximum number of jobs allowed in the queue before Submit() blocks
+	size_t m_maxDepth;
+
+	///@brief Jobs waiting to run
+	std::deque<Job> m_jobs;
+
+	///@brief True if the worker is currently running a job
+	bool m_busy;
+
+	///@brief True if the worker should exit
+	bool m_terminating;
+
+	///@brief When the idle worker was woken up for a new job, or 0 if it isn't waking up
+	double m_wakeTime;
+
+	///@brief The first exception thrown by a job since the last Sync()
+	std::exception_ptr m_error;
+
+	std::mutex m_mutex;
+
+	///@brief Signaled when a job is added to the queue (or we're shutting down)
+	std::condition_variable m_jobReady;
+
+	///@brief Signaled when a job completes
+	std::condition_variable m_jobDone;
+
+	std::thread m_worker;
+};
+
+#endif
@@ -0,0 +1,434 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of AdapterMonitor
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+constexpr double AdapterMonitor::POLL_INTERVAL;
+constexpr double AdapterMonitor::RETRY_INTERVAL;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+AdapterMonitor::AdapterMonitor()
+	: m_stop(false)
+	, m_errorReported(false)
+	, m_iface(NULL)
+	, m_generation(0)
+	, m_hotplug(false)
+	, m_users(0)
+	, m_idleSince(0)
+	, m_idleTimeout(0)
+	, m_opens(0)
+	, m_session(-1)
+{
+	m_cold.m_count = 0;
+	m_cold.m_total = 0;
+	m_cold.m_max = 0;
+	m_warm = m_cold;
+}
+
+AdapterMonitor::~AdapterMonitor()
+{
+	Stop();
+}
+
+/**
+	@brief Takes ownership of the adapter and starts watching it
+
+	@param iface	The adapter, already set up, or NULL to open it when the first session needs it
+	@param open		Opens the adapter
+	@param hotplug	True to watch for the adapter going away and reopen it (USB adapters only)
+ */
+void AdapterMonitor::Start(TestInterface* iface, OpenFunction open, bool hotplug)
+{
+	m_open = open;
+	m_hotplug = hotplug;
+	m_idleSince = GetTime();
+	if(iface)
+		Opened(iface);
+
+	if(m_hotplug || (m_idleTimeout > 0) )
+	{
+		m_session = g_arbiter.AddSession();
+		m_thread = thread(&AdapterMonitor::MonitorThread, this);
+	}
+}
+
+/**
+	@brief Remembers what we need to know about a newly opened adapter. Call with the mutex held (or before the thread
+	is started).
+ */
+void AdapterMonitor::Opened(TestInterface* iface)
+{
+	m_iface = iface;
+	m_serial = iface->GetSerial();
+	m_opens ++;
+	g_stats.SetInterface(iface);
+
+	if(!m_hotplug)
+		return;
+	m_usbNode = FindUsbDevice(m_serial);
+	if(m_usbNode.empty())
+		LogVerbose("Adapter \"%s\" not found in sysfs, only checking it after errors\n", m_serial.c_str());
+	else
+		LogVerbose("Watching adapter \"%s\" at USB node %s\n", m_serial.c_str(), m_usbNode.c_str());
+}
+
+/**
+	@brief Stops watching the adapter (and gives up trying to reopen it, if we were)
+ */
+void AdapterMonitor::Stop()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+
+	if(m_thread.joinable())
+		m_thread.join();
+
+	if(m_session >= 0)
+	{
+		g_arbiter.RemoveSession(m_session);
+		m_session = -1;
+	}
+}
+
+/**
+	@brief Stops watching the adapter and closes it, along with any interfaces it replaced
+ */
+void AdapterMonitor::Close()
+{
+	Stop();
+
+	delete m_iface;
+	m_iface = NULL;
+	for(auto i : m_retired)
+		delete i;
+	m_retired.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sessions
+
+/**
+	@brief Registers a session that's about to use the adapter, opening it first if it isn't open
+
+	@param generation	Set to the current generation (see GetInterface())
+	@param cold			Set to true if the adapter had to be opened for this session
+
+	@return The adapter, or NULL if it couldn't be opened. RemoveSession() must be called either way.
+ */
+TestInterface* AdapterMonitor::AddSession(unsigned int& generation, bool& cold)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_users ++;
+
+	cold = (m_iface == NULL);
+	if(cold)
+	{
+		double start = GetTime();
+		TestInterface* iface = NULL;
+		try
+		{
+			iface = m_open(false);
+		}
+		catch(const JtagException& ex)
+		{
+			LogError("%s\n", ex.GetDescription().c_str());
+		}
+		if(!iface)
+			return NULL;
+
+		Opened(iface);
+		m_generation ++;
+		LogVerbose("Opened adapter in %.2f ms\n", (GetTime() - start) * 1000);
+
+		//We don't know what happened to the chain while the adapter was closed.
+		//Nobody else can be using it yet, so there's no need to own it for this.
+		g_arbiter.InvalidateDeviceStates();
+	}
+
+	generation = m_generation;
+	return m_iface;
+}
+
+/**
+	@brief Unregisters a session added with AddSession()
+ */
+void AdapterMonitor::RemoveSession()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_users --;
+	if(m_users == 0)
+		m_idleSince = GetTime();
+}
+
+/**
+	@brief Records how long a session took from connecting to having its first request handled
+
+	@param cold		True if the adapter had to be opened for the session
+	@param seconds	The time taken
+ */
+void AdapterMonitor::RecordFirstOp(bool cold, double seconds)
+{
+	lock_guard<mutex> lock(m_mutex);
+	auto& s = cold ? m_cold : m_warm;
+	s.m_count ++;
+	s.m_total += seconds;
+	s.m_max = max(s.m_max, seconds);
+}
+
+AdapterMonitor::StartupStats AdapterMonitor::GetStartupStats(bool cold)
+{
+	lock_guard<mutex> lock(m_mutex);
+	return cold ? m_cold : m_warm;
+}
+
+size_t AdapterMonitor::GetOpenCount()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_opens;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Accessors
+
+///@brief Gets the current adapter, or NULL if it isn't open
+TestInterface* AdapterMonitor::GetInterface()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_iface;
+}
+
+/**
+	@brief Gets the current adapter, and the generation it belongs to
+
+	The interface only changes while the monitor owns the adapter, so a session that owns it can compare
+	GetGeneration() with what it got here to tell whether it needs to switch.
+ */
+TestInterface* AdapterMonitor::GetInterface(unsigned int& generation)
+{
+	lock_guard<mutex> lock(m_mutex);
+	generation = m_generation;
+	return m_iface;
+}
+
+/**
+	@brief Tells the monitor that a session got an error, so it should check the adapter now
+ */
+void AdapterMonitor::ReportError()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_errorReported = true;
+	}
+	m_wake.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Monitoring
+
+void AdapterMonitor::MonitorThread()
+{
+	unique_lock<mutex> lock(m_mutex);
+	while(!m_stop)
+	{
+		m_wake.wait_for(lock, chrono::duration<double>(POLL_INTERVAL), [&] { return m_stop || m_errorReported; });
+		if(m_stop)
+			break;
+		bool suspect = m_errorReported;
+		m_errorReported = false;
+		bool open = (m_iface != NULL);
+		string node = m_usbNode;
+		lock.unlock();
+
+		CloseIfIdle();
+
+		//A missing or re-enumerated device means our handle is dead, no need to ask it.
+		//Otherwise an error could just as well be a bad request from the client, so check.
+		if(m_hotplug && open)
+		{
+			bool lost = !node.empty() && (FindUsbDevice(m_serial) != node);
+			if(lost || suspect)
+			{
+				g_arbiter.Acquire(m_session);
+				if(lost || !Probe())
+					Reconnect();
+				g_arbiter.Release(m_session);
+			}
+		}
+
+		lock.lock();
+	}
+}
+
+/**
+	@brief Closes the adapter if nobody has used it for the idle timeout
+ */
+void AdapterMonitor::CloseIfIdle()
+{
+	vector<TestInterface*> closing;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		if( (m_idleTimeout <= 0) || !m_iface || m_users || (GetTime() - m_idleSince < m_idleTimeout) )
+			return;
+
+		//With no sessions left nobody can be holding an old interface either
+		closing.swap(m_retired);
+		closing.push_back(m_iface);
+		m_iface = NULL;
+	}
+
+	LogNotice("Closing adapter \"%s\" after %g s idle\n", m_serial.c_str(), m_idleTimeout);
+	for(auto i : closing)
+		delete i;
+}
+
+/**
+	@brief Checks whether the adapter still responds. Only call while owning the adapter.
+
+	The last session left the TAP in Run-Test/Idle, so one more clock there doesn't disturb anything.
+ */
+bool AdapterMonitor::Probe()
+{
+	try
+	{
+		auto jface = dynamic_cast<JtagInterface*>(m_iface);
+		auto sface = dynamic_cast<SWDInterface*>(m_iface);
+		if(jface)
+		{
+			jface->SendDummyClocks(1);
+			jface->Commit();
+		}
+		else if(sface)
+			sface->ReadWord(0, false);
+		return true;
+	}
+	catch(const JtagException& ex)
+	{
+		LogVerbose("Adapter check failed: %s\n", ex.GetDescription().c_str());
+		return false;
+	}
+}
+
+/**
+	@brief Waits for the adapter to come back, and sets it up the way it was. Only call while owning the adapter.
+
+	@return True if reconnected, false if we were stopped first
+ */
+bool AdapterMonitor::Reconnect()
+{
+	LogWarning("Lost adapter \"%s\", waiting for it to come back\n", m_serial.c_str());
+	double start = GetTime();
+
+	//The GPIO state clients last set is still cached in the old interface, even though the adapter is gone
+	vector< pair<bool, bool> > gpio;
+	auto oldg = dynamic_cast<GPIOInterface*>(m_iface);
+	if(oldg)
+	{
+		for(int i=0; i<oldg->GetGpioCount(); i++)
+			gpio.push_back(make_pair(oldg->GetGpioDirection(i), oldg->GetGpioValueCached(i)));
+	}
+
+	TestInterface* iface = NULL;
+	while(true)
+	{
+		try
+		{
+			iface = m_open(true);
+		}
+		catch(const JtagException&)
+		{
+			iface = NULL;
+		}
+
+		if(iface)
+		{
+			try
+			{
+				//Reset the chain, since we don't know what the TAP saw meanwhile
+				auto jface = dynamic_cast<JtagInterface*>(iface);
+				if(jface)
+				{
+					jface->TestLogicReset();
+					jface->ResetToIdle();
+					jface->Commit();
+				}
+
+				//Replay GPIO directions and values in one update
+				auto gface = dynamic_cast<GPIOInterface*>(iface);
+				if(gface && (static_cast<size_t>(gface->GetGpioCount()) == gpio.size()) )
+				{
+					for(size_t i=0; i<gpio.size(); i++)
+					{
+						gface->SetGpioDirectionDeferred(i, gpio[i].first);
+						gface->SetGpioValueDeferred(i, gpio[i].second);
+					}
+					gface->WriteGpioState();
+				}
+				break;
+			}
+			catch(const JtagException& ex)
+			{
+				LogWarning("Reopened adapter \"%s\" but couldn't set it up: %s\n",
+					m_serial.c_str(), ex.GetDescription().c_str());
+				delete iface;
+				iface = NULL;
+			}
+		}
+
+		unique_lock<mutex> lock(m_mutex);
+		if(m_wake.wait_for(lock, chrono::duration<double>(RETRY_INTERVAL), [&] { return m_stop; }))
+			return false;
+	}
+
+	string node = FindUsbDevice(m_serial);
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_retired.push_back(m_iface);
+		m_iface = iface;
+		m_usbNode = node;
+		m_generation ++;
+	}
+
+	//Everything is back to its reset instruction
+	g_arbiter.ResetDeviceStates();
+
+	LogNotice("Reconnected to adapter \"%s\" after %.2f s\n", m_serial.c_str(), GetTime() - start);
+	return true;
+}
@@ -0,0 +1,173 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of AdapterMonitor
+ */
+
+#ifndef AdapterMonitor_h
+#define AdapterMonitor_h
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+	@brief Owns the adapter: opens it when it's first needed, closes it when idle, and reopens it if it goes away
+	(USB reset, probe unplugged and plugged back in)
+
+	Sessions register with AddSession(), which opens the adapter if it isn't open yet. In lazy mode it isn't opened at
+	startup, so a daemon that nobody connects to never touches USB. With an idle timeout the adapter is closed again
+	once no session has been registered for that long. The time from a client connecting to its first request being
+	handled is kept separately for sessions that had to open the adapter (cold) and those that didn't (warm).
+
+	A background thread watches the adapter's USB device node once every POLL_INTERVAL. Re-enumeration gives the device
+	a new device number, so a change means our handle is dead. A session that gets an adapter error also wakes the
+	thread, which then checks with a harmless operation (one TCK in Run-Test/Idle for JTAG, or a DP IDCODE read for
+	SWD) whether the adapter is still there. That covers adapters we can't find in sysfs.
+
+	Once the adapter is lost the thread takes it from g_arbiter, so sessions queue up as usual, and tries to open the
+	same serial number again every RETRY_INTERVAL. When that works the last GPIO directions and values are
+	replayed, the chain is reset, and the adapter is handed back. Queued sessions notice the new generation
+	number when they next get the adapter, switch over to the new interface, and carry on. The session that was using
+	the adapter when it went away fails as before. The chain cache is kept, since ChainCache validates it against a
+	fresh IDCODE scan before handing it out anyway.
+
+	Old interfaces are kept until no sessions are left (or Close()), since session threads may still hold pointers to
+	them and some drivers block when closing a handle to a device that has gone.
+ */
+class AdapterMonitor
+{
+public:
+	AdapterMonitor();
+	virtual ~AdapterMonitor();
+
+	///@brief Opens the adapter and sets it up. Returns NULL (or throws) if it's not there.
+	typedef std::function<TestInterface*(bool quiet)> OpenFunction;
+
+	void Start(TestInterface* iface, OpenFunction open, bool hotplug);
+	void Stop();
+	void Close();
+
+	///@brief Sets how long the adapter can go unused before it's closed, in seconds (0 to keep it open)
+	void SetIdleTimeout(double seconds)
+	{ m_idleTimeout = seconds; }
+
+	TestInterface* AddSession(unsigned int& generation, bool& cold);
+	void RemoveSession();
+
+	TestInterface* GetInterface();
+	TestInterface* GetInterface(unsigned int& generation);
+
+	///@brief Number of times the adapter has been reopened, which is bumped every time the interface changes
+	unsigned int GetGeneration()
+	{ return m_generation; }
+
+	void ReportError();
+
+	///@brief Time from connecting to the first request being handled, for one kind of session
+	struct StartupStats
+	{
+		size_t m_count;
+		double m_total;
+		double m_max;
+
+		double GetMean() const
+		{ return m_count ? m_total / m_count : 0; }
+	};
+
+	void RecordFirstOp(bool cold, double seconds);
+	StartupStats GetStartupStats(bool cold);
+
+	size_t GetOpenCount();
+
+	///@brief How often to check the adapter's USB device node, in seconds
+	static constexpr double POLL_INTERVAL = 1;
+
+	///@brief How often to try opening a lost adapter, in seconds
+	static constexpr double RETRY_INTERVAL = 0.25;
+
+protected:
+	void MonitorThread();
+	void Opened(TestInterface* iface);
+	void CloseIfIdle();
+	bool Probe();
+	bool Reconnect();
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_stop;
+
+	///@brief True if a session saw an adapter error since the last check
+	bool m_errorReported;
+
+	///@brief The adapter, or NULL if it isn't open
+	TestInterface* m_iface;
+	std::atomic<unsigned int> m_generation;
+	OpenFunction m_open;
+
+	///@brief True to watch for the adapter going away and reopen it
+	bool m_hotplug;
+
+	///@brief Sessions using the adapter
+	size_t m_users;
+
+	///@brief When the last session went away
+	double m_idleSince;
+
+	double m_idleTimeout;
+
+	///@brief Number of times the adapter has been opened (not counting reconnects)
+	size_t m_opens;
+
+	StartupStats m_cold;
+	StartupStats m_warm;
+
+	///@brief Serial number of the adapter, to find it again on reconnect
+	std::string m_serial;
+
+	///@brief USB node of the adapter (see FindUsbDevice()), or empty if we can't find it
+	std::string m_usbNode;
+
+	///@brief Interfaces that have been replaced
+	std::vector<TestInterface*> m_retired;
+
+	///@brief Our arbiter session, for holding the adapter while it's checked or reopened
+	int m_session;
+
+	std::thread m_thread;
+};
+
+#endif
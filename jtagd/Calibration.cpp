@@ -0,0 +1,345 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief TCK frequency calibration
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+///@brief Number of bits in each test pattern
+static const size_t CAL_PATTERN_BITS = 4096;
+
+///@brief Number of patterns that have to pass at a given frequency before we call it good
+static const int CAL_TRIALS = 16;
+
+///@brief Longest chain (in devices) we expect to see in BYPASS, and longest total IR length
+static const size_t CAL_MAX_DEVICES = 1024;
+static const size_t CAL_MAX_IR_BITS = 4096;
+
+///@brief Number of bits of IDCODE data to compare
+static const size_t CAL_IDCODE_BITS = 32 * 64;
+
+static bool GetBit(const vector<uint8_t>& buf, size_t i)
+{
+	return (buf[i/8] >> (i%8)) & 1;
+}
+
+/**
+	@brief Fills a buffer with pseudorandom data (xorshift32, so patterns are reproducible for a given seed)
+ */
+static void FillPattern(vector<uint8_t>& buf, uint32_t seed)
+{
+	uint32_t x = seed ? seed : 1;
+	for(auto& b : buf)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		b = x;
+	}
+}
+
+/**
+	@brief Puts every device in the chain into BYPASS
+ */
+static void EnterBypass(JtagInterface* iface)
+{
+	vector<uint8_t> ones(CAL_MAX_IR_BITS / 8, 0xff);
+	iface->TestLogicReset();
+	iface->EnterShiftIR();
+	iface->ShiftData(true, &ones[0], NULL, CAL_MAX_IR_BITS);
+	iface->LeaveExit1IR();
+}
+
+/**
+	@brief Shifts a pattern through the BYPASS registers of the whole chain
+
+	@return The read data, which should be the pattern delayed by one bit per device
+ */
+static vector<uint8_t> ShiftBypass(JtagInterface* iface, const vector<uint8_t>& pattern)
+{
+	vector<uint8_t> rx(pattern.size());
+	iface->EnterShiftDR();
+	iface->ShiftData(true, &pattern[0], &rx[0], pattern.size() * 8);
+	iface->LeaveExit1DR();
+	return rx;
+}
+
+/**
+	@brief Reads the DR selected after reset (IDCODE or BYPASS) for every device in the chain
+ */
+static vector<uint8_t> ReadIdcodes(JtagInterface* iface)
+{
+	vector<uint8_t> ones(CAL_IDCODE_BITS / 8, 0xff);
+	vector<uint8_t> rx(ones.size());
+	iface->TestLogicReset();
+	iface->EnterShiftDR();
+	iface->ShiftData(true, &ones[0], &rx[0], CAL_IDCODE_BITS);
+	iface->LeaveExit1DR();
+	return rx;
+}
+
+/**
+	@brief Checks if the chain works reliably at the current frequency
+
+	@param iface		The interface to test
+	@param delay		Number of devices in the chain (BYPASS delay in bits)
+	@param idcodes		IDCODE scan results at a known good frequency
+ */
+static bool TestFrequency(JtagInterface* iface, size_t delay, const vector<uint8_t>& idcodes)
+{
+	//IDCODEs must read back identically
+	if(ReadIdcodes(iface) != idcodes)
+		return false;
+
+	//Random patterns must come out of BYPASS intact
+	EnterBypass(iface);
+	vector<uint8_t> pattern((CAL_PATTERN_BITS + CAL_MAX_DEVICES) / 8);
+	for(int trial=0; trial<CAL_TRIALS; trial++)
+	{
+		FillPattern(pattern, trial * 0x9e3779b9);
+		auto rx = ShiftBypass(iface, pattern);
+		for(size_t i=0; i<CAL_PATTERN_BITS; i++)
+		{
+			if(GetBit(rx, i + delay) != GetBit(pattern, i))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+	@brief Opens the adapter at a given frequency and checks if the chain works reliably
+
+	@param open			Opens the adapter at a requested frequency
+	@param target		Frequency to request, in Hz
+	@param delay		Number of devices in the chain (BYPASS delay in bits)
+	@param idcodes		IDCODE scan results at a known good frequency
+	@param actual		The frequency the adapter actually gave us
+
+	@return True if the chain passed
+ */
+static bool TryFrequency(
+	const CalibrationOpener& open,
+	int target,
+	size_t delay,
+	const vector<uint8_t>& idcodes,
+	int& actual)
+{
+	unique_ptr<JtagInterface> iface(open(target));
+	if(!iface)
+	{
+		throw JtagExceptionWrapper(
+			"Couldn't reopen the adapter",
+			"");
+	}
+
+	actual = iface->GetFrequency();
+	bool ok = TestFrequency(iface.get(), delay, idcodes);
+	iface->TestLogicReset();
+	iface->Commit();
+	return ok;
+}
+
+/**
+	@brief Finds the highest TCK frequency the chain works reliably at
+
+	The clock can only be chosen when an adapter is opened, so the adapter is closed and reopened for every frequency
+	tried. Starts at the minimum frequency (which must work, it's used to capture reference data), then steps up until
+	something fails and bisects between the last good and first bad frequency. The result is backed off by a safety
+	margin and verified once more.
+
+	@param open			Opens the adapter at a requested frequency, or returns NULL if it can't
+	@param minfreq		Lowest frequency to test, in Hz
+	@param maxfreq		Highest frequency to test, in Hz
+	@param margin		Fraction to back off from the highest passing frequency (e.g. 0.2 = 20%)
+
+	@return The calibrated frequency, or 0 if the chain doesn't work even at minfreq
+ */
+int CalibrateFrequency(const CalibrationOpener& open, int minfreq, int maxfreq, float margin)
+{
+	LogNotice("Calibrating TCK frequency (%.2f - %.2f MHz)...\n", minfreq / 1E6, maxfreq / 1E6);
+	LogIndenter li;
+
+	//Get reference data at the slowest speed, and figure out how many devices are in the chain from the BYPASS delay
+	vector<uint8_t> idcodes;
+	size_t delay = 0;
+	int good;
+	{
+		unique_ptr<JtagInterface> iface(open(minfreq));
+		if(!iface)
+		{
+			LogError("Couldn't open the adapter\n");
+			return 0;
+		}
+		good = iface->GetFrequency();
+		idcodes = ReadIdcodes(iface.get());
+
+		EnterBypass(iface.get());
+		vector<uint8_t> pattern((CAL_PATTERN_BITS + CAL_MAX_DEVICES) / 8);
+		FillPattern(pattern, 1);
+		auto rx = ShiftBypass(iface.get(), pattern);
+		for(; delay<CAL_MAX_DEVICES; delay++)
+		{
+			bool match = true;
+			for(size_t i=0; i<CAL_PATTERN_BITS && match; i++)
+				match = (GetBit(rx, i + delay) == GetBit(pattern, i));
+			if(match)
+				break;
+		}
+		if(delay == CAL_MAX_DEVICES)
+		{
+			LogError("Chain doesn't pass BYPASS data even at %.2f MHz, check connections\n", good / 1E6);
+			return 0;
+		}
+		LogVerbose("Chain has %zu devices\n", delay);
+
+		if(!TestFrequency(iface.get(), delay, idcodes))
+		{
+			LogError("Chain is unreliable even at %.2f MHz, check connections\n", good / 1E6);
+			return 0;
+		}
+	}
+
+	//Step up until something breaks.
+	//Use the frequency the adapter actually gave us, since most only support a few discrete dividers.
+	int bad = 0;
+	int actual;
+	for(int target = minfreq * 1.25; target <= maxfreq; target *= 1.25)
+	{
+		bool ok = TryFrequency(open, target, delay, idcodes, actual);
+		if(actual <= good)
+			continue;
+
+		LogVerbose("%.2f MHz: %s\n", actual / 1E6, ok ? "pass" : "FAIL");
+		if(!ok)
+		{
+			bad = actual;
+			break;
+		}
+		good = actual;
+	}
+
+	//Narrow down the boundary
+	for(int i=0; (i<4) && (bad != 0); i++)
+	{
+		bool ok = TryFrequency(open, (good + bad) / 2, delay, idcodes, actual);
+		if( (actual <= good) || (actual >= bad) )
+			break;
+
+		LogVerbose("%.2f MHz: %s\n", actual / 1E6, ok ? "pass" : "FAIL");
+		if(ok)
+			good = actual;
+		else
+			bad = actual;
+	}
+
+	//Back off, and make sure the frequency we'll be using still works
+	int result;
+	bool ok = TryFrequency(open, good * (1 - margin), delay, idcodes, result);
+	if(result > good)
+		ok = TryFrequency(open, good, delay, idcodes, result);
+	if(!ok)
+	{
+		LogError("Chain failed verification at %.2f MHz after calibration\n", result / 1E6);
+		return 0;
+	}
+
+	LogNotice("Highest passing frequency %.2f MHz, using %.2f MHz\n", good / 1E6, result / 1E6);
+	return result;
+}
+
+/**
+	@brief Looks up the calibrated frequency for an adapter
+
+	@param path		Path to the calibration file
+	@param serial	Serial number of the adapter
+	@param freq		Calibrated frequency, in Hz
+
+	@return True if found
+ */
+bool LoadCalibration(const string& path, const string& serial, int& freq)
+{
+	FILE* fp = fopen(path.c_str(), "r");
+	if(!fp)
+		return false;
+
+	//One "serial frequency" pair per line
+	char line[256];
+	bool found = false;
+	while(fgets(line, sizeof(line), fp))
+	{
+		char sserial[200];
+		int f;
+		if(2 != sscanf(line, "%199s %d", sserial, &f))
+			continue;
+		if(serial == sserial)
+		{
+			freq = f;
+			found = true;
+		}
+	}
+	fclose(fp);
+
+	return found;
+}
+
+/**
+	@brief Saves the calibrated frequency for an adapter, replacing any previous result for the same serial number
+ */
+bool SaveCalibration(const string& path, const string& serial, int freq)
+{
+	//Keep results for all other adapters
+	vector<string> lines;
+	FILE* fp = fopen(path.c_str(), "r");
+	if(fp)
+	{
+		char line[256];
+		while(fgets(line, sizeof(line), fp))
+		{
+			char sserial[200];
+			if( (1 == sscanf(line, "%199s", sserial)) && (serial != sserial) )
+				lines.push_back(line);
+		}
+		fclose(fp);
+	}
+
+	fp = fopen(path.c_str(), "w");
+	if(!fp)
+		return false;
+	for(auto& l : lines)
+		fputs(l.c_str(), fp);
+	fprintf(fp, "%s %d\n", serial.c_str(), freq);
+	return (0 == fclose(fp));
+}
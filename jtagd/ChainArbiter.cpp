@@ -0,0 +1,268 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of ChainArbiter
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+ChainArbiter::ChainArbiter()
+	: m_nextID(0)
+	, m_nextTicket(0)
+	, m_grants(0)
+	, m_owner(-1)
+	, m_grantTime(0)
+	, m_vclock(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sessions
+
+/**
+	@brief Registers a new session
+
+	@return ID of the session
+ */
+int ChainArbiter::AddSession()
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	int id = m_nextID ++;
+	auto& s = m_sessions[id];
+	s.m_weight = DEFAULT_WEIGHT;
+	s.m_vtime = m_vclock;
+	s.m_waiting = false;
+	s.m_ticket = 0;
+	s.m_first = 0;
+	s.m_count = 0;
+	s.m_grants = 0;
+	s.m_maxWait = 0;
+	return id;
+}
+
+/**
+	@brief Removes a session, giving up the adapter and any reservation it holds
+ */
+void ChainArbiter::RemoveSession(int id)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	auto& s = m_sessions[id];
+	LogVerbose("Session %d: adapter granted %zu times, worst wait %.2f ms\n", id, s.m_grants, s.m_maxWait * 1000);
+
+	m_sessions.erase(id);
+	if(m_owner == id)
+		m_owner = -1;
+	m_released.notify_all();
+}
+
+/**
+	@brief Sets a session's share of the adapter relative to other sessions
+ */
+void ChainArbiter::SetWeight(int id, unsigned int weight)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_sessions[id].m_weight = weight ? weight : DEFAULT_WEIGHT;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scheduling
+
+/**
+	@brief Blocks until the session owns the adapter. Returns immediately if it already does.
+ */
+void ChainArbiter::Acquire(int id)
+{
+	unique_lock<mutex> lock(m_mutex);
+	if(m_owner == id)
+		return;
+
+	auto& s = m_sessions[id];
+	s.m_vtime = max(s.m_vtime, m_vclock);
+	s.m_waiting = true;
+	s.m_ticket = m_nextTicket ++;
+
+	double start = GetTime();
+	m_released.wait(lock, [&]{ return (m_owner < 0) && IsNext(id); });
+
+	s.m_waiting = false;
+	s.m_grants ++;
+	m_grants ++;
+	m_owner = id;
+	m_grantTime = GetTime();
+	m_vclock = s.m_vtime;
+	s.m_maxWait = max(s.m_maxWait, m_grantTime - start);
+}
+
+/**
+	@brief Gives up the adapter and charges the session for the time it held it
+ */
+void ChainArbiter::Release(int id)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if(m_owner != id)
+		return;
+
+	auto& s = m_sessions[id];
+	s.m_vtime += (GetTime() - m_grantTime) / s.m_weight;
+	m_owner = -1;
+	m_released.notify_all();
+}
+
+/**
+	@brief Gets the number of times the adapter has been handed to anyone.
+
+	A session that remembers this when it gets the adapter can tell next time whether anyone else had it in between.
+ */
+uint64_t ChainArbiter::GetGrantCount()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_grants;
+}
+
+/**
+	@brief Checks if any session other than this one is waiting for the adapter
+ */
+bool ChainArbiter::HasWaiters(int id)
+{
+	lock_guard<mutex> lock(m_mutex);
+	for(auto& it : m_sessions)
+	{
+		if( (it.first != id) && it.second.m_waiting)
+			return true;
+	}
+	return false;
+}
+
+/**
+	@brief Checks if a session is first in line for the adapter: least virtual time, then first come first served
+ */
+bool ChainArbiter::IsNext(int id)
+{
+	auto& me = m_sessions[id];
+	for(auto& it : m_sessions)
+	{
+		auto& s = it.second;
+		if( (it.first == id) || !s.m_waiting)
+			continue;
+		if( (s.m_vtime < me.m_vtime) || ( (s.m_vtime == me.m_vtime) && (s.m_ticket < me.m_ticket) ) )
+			return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reservations
+
+/**
+	@brief Reserves a range of devices for a session, replacing any previous reservation
+
+	@param id			The session
+	@param first		Index of the first device (closest to TDO)
+	@param count		Number of devices, or 0 to give up the reservation
+	@param ndevices		Number of devices in the chain
+	@param error		Why the reservation failed
+
+	@return True on success
+ */
+bool ChainArbiter::Reserve(int id, size_t first, size_t count, size_t ndevices, string& error)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	if( (count != 0) && ( (first >= ndevices) || (count > ndevices - first) ) )
+	{
+		error = "Reserved devices are past the end of the chain";
+		return false;
+	}
+
+	for(auto& it : m_sessions)
+	{
+		auto& s = it.second;
+		if( (it.first == id) || (s.m_count == 0) || (count == 0) )
+			continue;
+		if( (first < s.m_first + s.m_count) && (s.m_first < first + count) )
+		{
+			error = "Device is already reserved by session " + to_string(it.first);
+			return false;
+		}
+	}
+
+	auto& s = m_sessions[id];
+	s.m_first = first;
+	s.m_count = count;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Device state
+
+/**
+	@brief Gets the IR state of every device, resizing the table if the chain changed
+ */
+vector<ChainArbiter::DeviceState>& ChainArbiter::GetDeviceStates(size_t ndevices)
+{
+	if(m_devices.size() != ndevices)
+	{
+		m_devices.resize(ndevices);
+		InvalidateDeviceStates();
+	}
+	return m_devices;
+}
+
+/**
+	@brief Called after a Test-Logic-Reset
+ */
+void ChainArbiter::ResetDeviceStates()
+{
+	for(auto& d : m_devices)
+	{
+		d.m_state = DeviceState::IR_RESET;
+		d.m_ir.clear();
+	}
+}
+
+/**
+	@brief Called after something touched the IRs without going through a session's reservation
+ */
+void ChainArbiter::InvalidateDeviceStates()
+{
+	for(auto& d : m_devices)
+	{
+		d.m_state = DeviceState::IR_UNKNOWN;
+		d.m_ir.clear();
+	}
+}
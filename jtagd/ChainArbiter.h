@@ -0,0 +1,146 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of ChainArbiter
+ */
+
+#ifndef ChainArbiter_h
+#define ChainArbiter_h
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+	@brief Shares one adapter between any number of client sessions
+
+	Sessions take turns owning the adapter, one request at a time. A session that leaves the TAP in the middle of a
+	scan keeps the adapter until the scan is finished, since nobody else can use the chain until then.
+
+	When more than one session is waiting, the adapter goes to the one with the least weighted adapter time used so far
+	(virtual time, as in weighted fair queueing). A session's virtual time advances by the time it held the adapter
+	divided by its weight, and a session that has been idle starts from the current virtual time rather than banking
+	credit. A bulk upload therefore gets its share of the adapter, and an interactive session never waits behind more
+	than one request from each other session.
+
+	Sessions can also reserve a contiguous range of devices on the chain. The arbiter keeps the reservations and tracks
+	what is in every device's IR, so SessionJtagInterface can keep other devices in BYPASS around a session's scans
+	and put back a session's instruction if someone else's scan changed it.
+
+	Reservations are advisory. They stop reserved sessions from stepping on each other, but a session without one still
+	sees and scans the whole chain, reserved devices included (chain discovery and whole-chain tools need that). Its IR
+	changes are put right before the owner's next DR scan, but anything it shifts into a reserved device's DR isn't.
+ */
+class ChainArbiter
+{
+public:
+	ChainArbiter();
+
+	int AddSession();
+	void RemoveSession(int id);
+	void SetWeight(int id, unsigned int weight);
+
+	void Acquire(int id);
+	void Release(int id);
+	bool HasWaiters(int id);
+	uint64_t GetGrantCount();
+
+	bool Reserve(int id, size_t first, size_t count, size_t ndevices, std::string& error);
+
+	///@brief What we know is in a device's instruction register
+	struct DeviceState
+	{
+		enum
+		{
+			IR_UNKNOWN,		//Someone scanned the IR without telling us
+			IR_RESET,		//Reset value (IDCODE, or BYPASS if the device has no IDCODE)
+			IR_SET			//m_ir
+		} m_state;
+
+		///@brief Instruction bits, LSB first
+		std::vector<bool> m_ir;
+	};
+
+	//Only call these while owning the adapter
+	std::vector<DeviceState>& GetDeviceStates(size_t ndevices);
+	void ResetDeviceStates();
+	void InvalidateDeviceStates();
+
+	///@brief Weight of sessions that haven't asked for anything else
+	static const unsigned int DEFAULT_WEIGHT = 1;
+
+protected:
+	bool IsNext(int id);
+
+	struct Session
+	{
+		unsigned int m_weight;
+		double m_vtime;
+
+		bool m_waiting;
+		uint64_t m_ticket;
+
+		//Reserved devices
+		size_t m_first;
+		size_t m_count;
+
+		//Statistics
+		size_t m_grants;
+		double m_maxWait;
+	};
+
+	std::mutex m_mutex;
+	std::condition_variable m_released;
+
+	std::map<int, Session> m_sessions;
+	int m_nextID;
+	uint64_t m_nextTicket;
+
+	///@brief Number of times the adapter has been granted to anyone
+	uint64_t m_grants;
+
+	///@brief Session currently owning the adapter, or -1 if nobody
+	int m_owner;
+
+	///@brief When the current owner got the adapter
+	double m_grantTime;
+
+	///@brief Virtual time of the most recent grant
+	double m_vclock;
+
+	std::vector<DeviceState> m_devices;
+};
+
+#endif
@@ -0,0 +1,442 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of ChainCache
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+static bool GetBit(const vector<uint8_t>& buf, size_t i)
+{
+	return (buf[i/8] >> (i%8)) & 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+ChainCache::ChainCache()
+	: m_valid(false)
+	, m_bulk(true)
+	, m_irGuess(MIN_IR_BITS)
+	, m_deviceGuess(MIN_DEVICES)
+	, m_hits(0)
+	, m_scans(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Accessors
+
+/**
+	@brief Selects bulk discovery (the default) or walking the chain one device at a time with the library
+ */
+void ChainCache::SetBulkDiscovery(bool bulk)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_bulk = bulk;
+}
+
+size_t ChainCache::GetHitCount()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_hits;
+}
+
+size_t ChainCache::GetScanCount()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_scans;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Chain discovery
+
+/**
+	@brief Gets the devices in the chain, walking it only if we don't have a valid cached copy
+
+	@param iface		The interface the chain is attached to
+	@param rescan		Ignore any cached result and walk the chain again
+	@param devices		Devices in the chain, closest to TDO first
+	@param phases		Time taken by each phase of discovery, if the chain was walked (empty on a cache hit)
+
+	@return True if the result came from the cache
+ */
+bool ChainCache::GetChain(JtagInterface* iface, bool rescan, vector<Device>& devices, vector<Phase>& phases)
+{
+	phases.clear();
+
+	lock_guard<mutex> lock(m_mutex);
+
+	bool hit = false;
+	if(m_valid && !rescan)
+	{
+		if(Validate(iface))
+			hit = true;
+		else
+			LogNotice("Scan chain changed since it was last walked, rescanning\n");
+	}
+
+	if(hit)
+		m_hits ++;
+	else
+		Scan(iface, phases);
+
+	devices = m_devices;
+	return hit;
+}
+
+/**
+	@brief Gets the cached chain without checking it against the hardware (and so without resetting the TAP)
+
+	@return False if there's nothing cached
+ */
+bool ChainCache::Peek(vector<Device>& devices)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if(!m_valid)
+		return false;
+	devices = m_devices;
+	return true;
+}
+
+/**
+	@brief Forgets the cached chain, so the next client to ask for it causes a full walk
+ */
+void ChainCache::Invalidate()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_valid = false;
+}
+
+/**
+	@brief Walks the chain and caches the result
+ */
+void ChainCache::Scan(JtagInterface* iface, vector<Phase>& phases)
+{
+	m_valid = false;
+	m_devices.clear();
+	m_scans ++;
+
+	if(!m_bulk || !BulkScan(iface, phases))
+		LibraryScan(iface, phases);
+
+	LogVerbose("Scan chain contains %zu devices\n", m_devices.size());
+	for(auto& p : phases)
+		LogDebug("    %-20s %.3f ms\n", p.m_name.c_str(), p.m_time * 1000);
+	m_valid = true;
+}
+
+/**
+	@brief Walks the chain one device at a time using the library
+ */
+void ChainCache::LibraryScan(JtagInterface* iface, vector<Phase>& phases)
+{
+	double start = GetTime();
+	m_devices.clear();
+
+	iface->InitializeChain(true);
+
+	for(size_t i=0; i<iface->GetDeviceCount(); i++)
+	{
+		Device dev;
+		dev.m_idcode = iface->GetIDCode(i);
+		dev.m_irlength = 0;
+
+		auto pdev = iface->GetJtagDevice(i);
+		if(pdev)
+			dev.m_irlength = pdev->GetIRLength();
+
+		m_devices.push_back(dev);
+	}
+
+	phases.push_back({"Chain walk", GetTime() - start});
+}
+
+/**
+	@brief Rounds up to a power of two, clamped to a range
+ */
+static size_t RoundWindow(size_t n, size_t lo, size_t hi)
+{
+	size_t w = lo;
+	while( (w < n) && (w < hi) )
+		w *= 2;
+	return w;
+}
+
+/**
+	@brief Shifts zeros and then ones through IR to find the total IR length and every device's IR capture value
+
+	Out comes the capture value of every IR, then our zeros, then our ones, so the total IR length is where the trailing
+	run of ones starts less the number of zeros. The ones go in last so every device ends up in BYPASS.
+
+	@param window		Number of zeros (and ones) to shift. Only works if the chain's total IR is shorter than this.
+	@param capture		IR capture bits, closest to TDO first
+
+	@return False if the scan couldn't be decoded
+ */
+static bool ScanIR(JtagInterface* iface, size_t window, vector<bool>& capture)
+{
+	vector<uint8_t> tx(2 * window / 8, 0x00);
+	memset(&tx[window / 8], 0xff, window / 8);
+	vector<uint8_t> rx(tx.size());
+	iface->TestLogicReset();
+	iface->EnterShiftIR();
+	iface->ShiftData(true, &tx[0], &rx[0], 2 * window);
+	iface->LeaveExit1IR();
+
+	size_t end = 2 * window;
+	while( (end > 0) && GetBit(rx, end - 1) )
+		end --;
+	if( (end == 2 * window) || (end < window) )
+		return false;
+	size_t irbits = end - window;
+	for(size_t i=irbits; i<end; i++)
+	{
+		if(GetBit(rx, i))
+			return false;
+	}
+
+	capture.resize(irbits);
+	for(size_t i=0; i<irbits; i++)
+		capture[i] = GetBit(rx, i);
+	return true;
+}
+
+/**
+	@brief Discovers the whole chain in three scans
+
+	The IR and BYPASS scans are sized from the last chain we saw (or a short chain, the first time) and doubled until
+	they fit, so a short chain costs a few hundred bits rather than the worst case.
+
+	@return False if the chain couldn't be decoded (too long, stuck TDO, ambiguous IR capture values)
+ */
+bool ChainCache::BulkScan(JtagInterface* iface, vector<Phase>& phases)
+{
+	double start = GetTime();
+
+	//A scan that's too short looks just like a garbled one, so keep doubling until we hit the limit
+	vector<bool> capture;
+	size_t window = m_irGuess;
+	while(!ScanIR(iface, window, capture))
+	{
+		if(window >= MAX_IR_BITS)
+		{
+			LogVerbose("Couldn't find the end of the IR chain, walking the chain instead\n");
+			return false;
+		}
+		window *= 2;
+	}
+	size_t irbits = capture.size();
+
+	double now = GetTime();
+	phases.push_back({"IR length scan", now - start});
+	start = now;
+
+	//Every device is in BYPASS now, which captures a zero. Shift ones through and count zeros before the first one.
+	size_t ndevices = 0;
+	window = m_deviceGuess;
+	vector<uint8_t> ones;
+	vector<uint8_t> rx;
+	while(true)
+	{
+		ones.assign(window / 8, 0xff);
+		rx.resize(ones.size());
+		iface->EnterShiftDR();
+		iface->ShiftData(true, &ones[0], &rx[0], window);
+		iface->LeaveExit1DR();
+
+		//Capture-DR zeroes every BYPASS register again, so a retry starts from scratch
+		ndevices = 0;
+		while( (ndevices < window) && !GetBit(rx, ndevices) )
+			ndevices ++;
+		if( (ndevices < window) || (window >= MAX_DEVICES) )
+			break;
+		window *= 2;
+	}
+	if( (ndevices == 0) || (ndevices == window) )
+	{
+		LogVerbose("Couldn't count devices in BYPASS, walking the chain instead\n");
+		return false;
+	}
+
+	//Start the next scan at about the right size
+	m_irGuess = RoundWindow(irbits + 1, MIN_IR_BITS, MAX_IR_BITS);
+	m_deviceGuess = RoundWindow(ndevices + 1, MIN_DEVICES, MAX_DEVICES);
+
+	now = GetTime();
+	phases.push_back({"Device count scan", now - start});
+	start = now;
+
+	//Read every IDCODE at once. Devices without an IDCODE register select BYPASS after reset and give us one zero bit.
+	size_t idbits = 32 * ndevices + 32;
+	ones.resize( (idbits + 7) / 8, 0xff);
+	rx.resize(ones.size());
+	iface->TestLogicReset();
+	iface->EnterShiftDR();
+	iface->ShiftData(true, &ones[0], &rx[0], idbits);
+	iface->LeaveExit1DR();
+	iface->TestLogicReset();
+
+	vector<uint32_t> idcodes;
+	size_t pos = 0;
+	for(size_t i=0; i<ndevices; i++)
+	{
+		if(!GetBit(rx, pos))
+		{
+			idcodes.push_back(0);
+			pos ++;
+			continue;
+		}
+
+		uint32_t idcode = 0;
+		for(size_t j=0; j<32; j++, pos++)
+			idcode |= static_cast<uint32_t>(GetBit(rx, pos)) << j;
+		idcodes.push_back(idcode);
+	}
+	for(size_t j=0; j<32; j++, pos++)
+	{
+		if(!GetBit(rx, pos))
+		{
+			LogVerbose("IDCODE scan doesn't match device count, walking the chain instead\n");
+			return false;
+		}
+	}
+
+	now = GetTime();
+	phases.push_back({"IDCODE scan", now - start});
+	start = now;
+
+	vector<uint32_t> irlengths;
+	if(!SplitIR(capture, ndevices, irlengths))
+	{
+		LogVerbose("IR capture values are ambiguous, walking the chain instead\n");
+		return false;
+	}
+
+	for(size_t i=0; i<ndevices; i++)
+	{
+		Device dev;
+		dev.m_idcode = idcodes[i];
+		dev.m_irlength = irlengths[i];
+		m_devices.push_back(dev);
+	}
+
+	phases.push_back({"Decode", GetTime() - start});
+	return true;
+}
+
+/**
+	@brief Splits the IR capture values of the whole chain into per-device IR lengths.
+
+	IEEE 1149.1 requires the two LSBs of every IR to capture 01, so each device starts at a 1 followed by a 0. The other
+	capture bits are device specific and may contain the same pattern, in which case there are several ways to place the
+	boundaries. We only accept the result if there's exactly one.
+
+	@param capture		IR capture bits, closest to TDO first
+	@param ndevices		Number of devices in the chain
+	@param lengths		IR length of each device
+
+	@return True if the split is unambiguous
+ */
+bool ChainCache::SplitIR(const vector<bool>& capture, size_t ndevices, vector<uint32_t>& lengths)
+{
+	//Find every position a device's IR could start at
+	vector<size_t> starts;
+	for(size_t i=0; i+1<capture.size(); i++)
+	{
+		if(capture[i] && !capture[i+1])
+			starts.push_back(i);
+	}
+	if(starts.empty() || (starts[0] != 0) )
+		return false;
+
+	//With one device everything belongs to it. Otherwise every candidate must be a real boundary.
+	//(Any ndevices-1 of the candidates after the first would make a legal split.)
+	if(ndevices == 1)
+		starts.resize(1);
+	else if(starts.size() != ndevices)
+		return false;
+
+	lengths.clear();
+	for(size_t i=0; i<ndevices; i++)
+	{
+		size_t next = (i+1 < ndevices) ? starts[i+1] : capture.size();
+		lengths.push_back(next - starts[i]);
+	}
+	return true;
+}
+
+/**
+	@brief Checks that the chain still reads back the cached IDCODEs after a Test-Logic-Reset.
+
+	After reset every device has either IDCODE (32 bits, LSB set) or BYPASS (one zero bit) selected, so shifting ones
+	through DR reads back the cached IDCODEs in order followed by the ones we shifted in. The extra 32 bits of ones at the
+	end make sure nothing was added to the far end of the chain.
+ */
+bool ChainCache::Validate(JtagInterface* iface)
+{
+	size_t nbits = 32;
+	for(auto& d : m_devices)
+		nbits += (d.m_idcode & 1) ? 32 : 1;
+	size_t nbytes = (nbits + 7) / 8;
+
+	vector<uint8_t> ones(nbytes, 0xff);
+	vector<uint8_t> rx(nbytes);
+	iface->TestLogicReset();
+	iface->EnterShiftDR();
+	iface->ShiftData(true, &ones[0], &rx[0], nbits);
+	iface->LeaveExit1DR();
+	iface->TestLogicReset();
+
+	size_t pos = 0;
+	auto getbits = [&](size_t n)
+	{
+		uint32_t v = 0;
+		for(size_t i=0; i<n; i++, pos++)
+			v |= static_cast<uint32_t>(GetBit(rx, pos)) << i;
+		return v;
+	};
+
+	for(auto& d : m_devices)
+	{
+		if(d.m_idcode & 1)
+		{
+			if(getbits(32) != d.m_idcode)
+				return false;
+		}
+		else if(getbits(1) != 0)
+			return false;
+	}
+
+	return (getbits(32) == 0xffffffff);
+}
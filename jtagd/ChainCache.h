@@ -0,0 +1,128 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of ChainCache
+ */
+
+#ifndef ChainCache_h
+#define ChainCache_h
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+	@brief Results of walking the scan chain, shared by every client session.
+
+	Clients used to walk the chain themselves on connect, which costs a number of network round trips per device.
+	The daemon walks the chain once (locally, so it's fast) and hands the result to each new client in a single reply.
+
+	Before a cached result is handed out it is checked against a fresh IDCODE scan taken straight after a Test-Logic-Reset.
+	That is one local scan and catches anything that changes what the chain looks like from reset (a board being
+	swapped, a device powered down, an FPGA reconfigured with a different user IDCODE). Clients can also force a rescan.
+
+	By default the chain is discovered in bulk: one IR scan gives the total IR length and every device's IR capture
+	value, one DR scan in BYPASS gives the device count, and one DR scan after reset gives every IDCODE. That's three
+	scans no matter how long the chain is, where walking it one device at a time gets slower with every device added.
+	The IR and BYPASS scans start short and are doubled until the chain fits, so short chains stay cheap.
+	If the IR capture values can't be split into per-device IRs unambiguously we fall back to the library's walk.
+
+	All public methods are thread safe.
+ */
+class ChainCache
+{
+public:
+	ChainCache();
+
+	///@brief One device in the chain
+	struct Device
+	{
+		///@brief IDCODE, or 0 if the device has no IDCODE register (BYPASS after reset)
+		uint32_t m_idcode;
+
+		///@brief IR length, or 0 if unknown
+		uint32_t m_irlength;
+	};
+
+	///@brief Time taken by one phase of chain discovery
+	struct Phase
+	{
+		std::string m_name;
+		double m_time;
+	};
+
+	bool GetChain(JtagInterface* iface, bool rescan, std::vector<Device>& devices, std::vector<Phase>& phases);
+	bool Peek(std::vector<Device>& devices);
+	void Invalidate();
+
+	void SetBulkDiscovery(bool bulk);
+
+	size_t GetHitCount();
+	size_t GetScanCount();
+
+	///@brief Largest chain bulk discovery can handle, in devices
+	static const size_t MAX_DEVICES = 4096;
+
+	///@brief Largest total IR length bulk discovery can handle, in bits
+	static const size_t MAX_IR_BITS = 65536;
+
+	///@brief Smallest scans bulk discovery starts with, in devices and IR bits
+	static const size_t MIN_DEVICES = 32;
+	static const size_t MIN_IR_BITS = 256;
+
+protected:
+	void Scan(JtagInterface* iface, std::vector<Phase>& phases);
+	void LibraryScan(JtagInterface* iface, std::vector<Phase>& phases);
+	bool BulkScan(JtagInterface* iface, std::vector<Phase>& phases);
+	bool Validate(JtagInterface* iface);
+
+	static bool SplitIR(const std::vector<bool>& capture, size_t ndevices, std::vector<uint32_t>& lengths);
+
+	std::mutex m_mutex;
+
+	bool m_valid;
+	std::vector<Device> m_devices;
+
+	///@brief True to use bulk discovery, false to always walk the chain with the library
+	bool m_bulk;
+
+	///@brief Sizes of the IR and BYPASS scans to start the next bulk discovery with
+	size_t m_irGuess;
+	size_t m_deviceGuess;
+
+	//Statistics
+	size_t m_hits;
+	size_t m_scans;
+};
+
+#endif
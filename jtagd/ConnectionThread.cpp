@@ -37,11 +37,67 @@
 
 using namespace std;
 
+typedef map<string, ImageCache::Image> ImageMap;
+
+static void GetScanWriteData(
+	const ScanRequest& req,
+	const ImageMap& images,
+	ImageCache::Image& image,
+	const uint8_t*& txdata,
+	size_t& txlen);
+static void DoScan(
+	JtagInterface* jface,
+	Socket& client,
+	PayloadCodec& codec,
+	const ScanRequest& req,
+	const uint8_t* txdata,
+	size_t txlen,
+	JtaghalPacket& reply,
+	SessionStats& stats);
+static void StreamScanChunk(
+	JtagInterface* jface,
+	Socket& client,
+	PayloadCodec& codec,
+	AdapterExecutor& executor,
+	const ImageMap& images,
+	ScanRequest* req,
+	shared_ptr<SessionStats> stats);
+static void DecompressScan(PayloadCodec& codec, ScanRequest* req);
+static void RunFastFrame(JtagInterface* jface, Socket& client, FastFrame& frame, SessionStats& stats);
+static bool SendMessage(Socket& client, const JtaghalPacket& msg, SessionStats& stats);
+static void FlushGpioWrites(TestInterface* iface, GPIOInterface* gface);
+static DapAccessor* GetDapAccessor(
+	SessionJtagInterface* jface,
+	SWDInterface* sface,
+	map<uint32_t, unique_ptr<DapAccessor> >& daps,
+	uint32_t device);
+
+///@brief Largest MEM-AP block read we'll do in one request, in words
+static const uint32_t MAX_MEM_BLOCK_WORDS = 4 * 1024 * 1024;
+
 /**
 	@brief Main function for handling connections using our native protocol
  */
-void ProcessConnection(TestInterface* iface, Socket& client)
+void ProcessConnection(Socket& client, const string& peer)
 {
+	double connected = GetTime();
+
+	//Open the adapter if nobody else has
+	unsigned int generation;
+	bool cold;
+	TestInterface* iface = g_monitor.AddSession(generation, cold);
+	if(!iface)
+	{
+		LogError("Adapter isn't available, dropping client\n");
+		g_monitor.RemoveSession();
+		return;
+	}
+
+	//Other sessions may be using the adapter, so we have to take turns
+	int session_id = g_arbiter.AddSession();
+	unique_ptr<SessionJtagInterface> session;
+	auto stats = g_stats.AddSession(session_id, peer);
+
 	try
 	{
 		//Set no-delay flag
@@ -52,14 +108,18 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 				"");
 		}
 
-		//Pre-cache casted versions of the interface
-		auto jface = dynamic_cast<JtagInterface*>(iface);
+		//Pre-cache casted versions of the interface.
+		//JTAG goes through the session's view of the chain, which handles sharing it with other sessions.
+		auto rawjface = dynamic_cast<JtagInterface*>(iface);
+		if(rawjface)
+			session.reset(new SessionJtagInterface(rawjface, g_arbiter, session_id));
+		SessionJtagInterface* jface = session.get();
 		auto sface = dynamic_cast<SWDInterface*>(iface);
 		auto gface = dynamic_cast<GPIOInterface*>(iface);
 
 		//Send the server-hello message
-		JtaghalPacket packet;
-		auto h = packet.mutable_hello();
+		JtaghalPacket hello;
+		auto h = hello.mutable_hello();
 		h->set_magic("JTAGHAL");
 		h->set_version(1);
 		if(jface)
@@ -72,7 +132,17 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 				"Unsupported transport",
 				"");
 		}
-		if(!SendMessage(client, packet))
+		h->set_codecs(PayloadCodec::GetSupportedCodecs());
+		h->set_fastframing(true);
+
+		//Token the client can use to resume this session later on
+		string token;
+		if(g_sessionCache.IsEnabled())
+		{
+			token = SessionCache::NewToken();
+			h->set_token(token);
+		}
+		if(!SendMessage(client, hello, *stats))
 		{
 			throw JtagExceptionWrapper(
 				"Failed to send serverhello",
@@ -80,13 +150,14 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 		}
 
 		//Get the client-hello message
-		if(!RecvMessage(client, packet, JtaghalPacket::kHello))
+		if(!RecvMessage(client, hello, JtaghalPacket::kHello))
 		{
 			throw JtagExceptionWrapper(
 				"Failed to get clienthello",
 				"");
 		}
-		auto ch = packet.hello();
+		stats->AddBytesIn(hello.ByteSizeLong() + 4);
+		auto ch = hello.hello();
 		if( (ch.magic() != "JTAGHAL") || (ch.version() != 1) )
 		{
 			throw JtagExceptionWrapper(
@@ -117,14 +188,163 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 				break;
 		}
 
+		//Use whatever compression we both support
+		PayloadCodec codec;
+		codec.SetAllowedCodecs(ch.codecs());
+
+		//Client may send hot ops as fast-path frames instead of protobuf
+		bool fastframing = ch.fastframing();
+		FastFrame fast;
+
+		//Adapter operations for chunked scans are run in the background so we can receive the next chunk while
+		//the current one is being shifted
+		AdapterExecutor executor;
+		bool streaming = false;
+
+		//Cached images this session has offered or uploaded.
+		//Holding a reference keeps them usable even if they're evicted from the cache mid-session.
+		ImageMap images;
+
+		//Image currently being uploaded
+		string upload_hash;
+		string upload_data;
+
+		//Scan programs uploaded by the client
+		map<uint32_t, ScanProgram> programs;
+
+		//True if there are GPIO writes staged with the adapter but not yet sent to it
+		bool gpio_pending = false;
+
+		//ARM debug port access, created on first use (keyed by chain position for JTAG-DPs)
+		map<uint32_t, unique_ptr<DapAccessor> > daps;
+
+		//If the adapter was reconnected while we were waiting for it, carry on with the new one.
+		//We only ever wait with the TAP idle, so there's nothing in flight to lose.
+		auto rebind = [&]()
+		{
+			if(g_monitor.GetGeneration() == generation)
+				return;
+			iface = g_monitor.GetInterface(generation);
+			rawjface = dynamic_cast<JtagInterface*>(iface);
+			if(session)
+				session->Rebind(rawjface);
+			sface = dynamic_cast<SWDInterface*>(iface);
+			gface = dynamic_cast<GPIOInterface*>(iface);
+			daps.clear();
+			LogNotice("Session %d resumed on reconnected adapter\n", session_id);
+		};
+
+		//Our share of the adapter
+		unsigned int weight = ChainArbiter::DEFAULT_WEIGHT;
+
+		//Requests and replies are built on an arena that's recycled every cycle, to keep malloc out of the loop
+		MessageArena messages;
+
+		//Client is picking up where an earlier session left off.
+		//Send back the chain layout too, so it doesn't need to ask.
+		if(!ch.token().empty())
+		{
+			JtaghalPacket resume;
+			auto rr = resume.mutable_resumereply();
+			SessionCache::State state;
+			vector<ChainCache::Device> devices;
+			string error;
+			if(!g_sessionCache.Take(ch.token(), state))
+				error = "Unknown or expired session token";
+			else if(jface)
+				jface->Restore(state.m_first, state.m_count, state.m_desired, devices, error);
+
+			rr->set_ok(error.empty());
+			if(rr->ok())
+			{
+				programs = move(state.m_programs);
+				images = move(state.m_images);
+				weight = state.m_weight;
+				g_arbiter.SetWeight(session_id, weight);
+
+				rr->set_has_chain(!devices.empty());
+				for(auto& d : devices)
+				{
+					auto cd = rr->add_devices();
+					cd->set_idcode(d.m_idcode);
+					cd->set_irlength(d.m_irlength);
+				}
+				LogVerbose("Session %d resumed an earlier session\n", session_id);
+			}
+			else
+				rr->set_error(error);
+
+			if(!SendMessage(client, resume, *stats))
+			{
+				throw JtagExceptionWrapper(
+					"Failed to send resume reply",
+					"");
+			}
+		}
+
 		//Sit around and wait for messages
-		while(RecvMessage(client, packet))
+		bool first_op = true;
+		while(true)
 		{
-			JtaghalPacket reply;
+			messages.Reset();
+			auto& packet = messages.GetRequest();
+			auto& reply = messages.GetReply();
+
+			//Fast-path frames leave the packet empty
+			bool is_fast = false;
+			if(fastframing && !FastFrame::PeekIsFast(client, is_fast))
+				break;
+			if(is_fast)
+			{
+				if(!fast.Recv(client))
+					break;
+				stats->AddBytesIn(8 + fast.GetDataSize());
+			}
+			else
+			{
+				if(!RecvMessage(client, packet))
+					break;
+				stats->AddBytesIn(packet.ByteSizeLong() + 4);
+			}
+			double start = GetTime();
+			g_arbiter.Acquire(session_id);
+			rebind();
+			stats->Attach(rawjface);
+
+			//Anything other than another chunk of a streamed scan has to wait for the stream to drain,
+			//so that replies go out in order and the chain is in a known state
+			bool is_chunk =
+				(packet.Payload_case() == JtaghalPacket::kScanRequest) &&
+				(packet.scanrequest().chunk() != ScanRequest::CHUNK_NONE);
+			if(!is_chunk)
+			{
+				if(streaming)
+				{
+					throw JtagExceptionWrapper(
+						"Got a new request in the middle of a chunked scan",
+						"");
+				}
+				executor.Sync();
+			}
+
+			//Deferred GPIO writes take effect before whatever the client asks for next, so they stay in order with
+			//scans without needing a round trip of their own. Consecutive writes are merged into one update.
+			if(gpio_pending && (packet.Payload_case() != JtaghalPacket::kGpioWriteRequest) )
+			{
+				FlushGpioWrites(iface, gface);
+				gpio_pending = false;
+			}
 
 			bool quit = false;
 			switch(packet.Payload_case())
 			{
+				case JtaghalPacket::PAYLOAD_NOT_SET:
+					if(is_fast)
+						RunFastFrame(jface, client, fast, *stats);
+					else
+						LogWarning("Got empty packet\n");
+					break;
+
 				case JtaghalPacket::kHello:
 					LogWarning("Got unexpected hello packet in the middle of a session\n");
 					break;
@@ -138,6 +358,7 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 				//Flushing the queue
 				case JtaghalPacket::kFlushRequest:
 					iface->Commit();
+					stats->AddCommit();
 					break;
 
 				//Read adapter info and send it to the client
@@ -167,7 +388,7 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 								LogError("Got invalid InfoRequest\n");
 						}
 
-						if(!SendMessage(client, reply))
+						if(!SendMessage(client, reply, *stats))
 						{
 							throw JtagExceptionWrapper(
 								"Failed to send info reply",
@@ -185,26 +406,34 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 						switch(packet.perfrequest().req())
 						{
 							case JtagPerformanceRequest::ShiftOps:
-								ir->set_num(jface->GetShiftOpCount());
+								ir->set_num(rawjface->GetShiftOpCount());
 								break;
 
 							case JtagPerformanceRequest::DataBits:
-								ir->set_num(jface->GetDataBitCount());
+								ir->set_num(rawjface->GetDataBitCount());
 								break;
 
 							case JtagPerformanceRequest::ModeBits:
-								ir->set_num(jface->GetModeBitCount());
+								ir->set_num(rawjface->GetModeBitCount());
 								break;
 
 							case JtagPerformanceRequest::DummyClocks:
-								ir->set_num(jface->GetDummyClockCount());
+								ir->set_num(rawjface->GetDummyClockCount());
+								break;
+
+							case JtagPerformanceRequest::ImageCacheHits:
+								ir->set_num(g_imageCache.GetHitCount());
+								break;
+
+							case JtagPerformanceRequest::ImageCacheMisses:
+								ir->set_num(g_imageCache.GetMissCount());
 								break;
 
 							default:
 								LogError("Got invalid PerfRequest\n");
 						}
 
-						if(!SendMessage(client, reply))
+						if(!SendMessage(client, reply, *stats))
 						{
 							throw JtagExceptionWrapper(
 								"Failed to send info reply",
@@ -222,7 +451,7 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 						auto ir = reply.mutable_inforeply();
 						ir->set_num(jface->IsSplitScanSupported());
 
-						if(!SendMessage(client, reply))
+						if(!SendMessage(client, reply, *stats))
 						{
 							throw JtagExceptionWrapper(
 								"Failed to send info reply",
@@ -277,71 +506,481 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 				case JtaghalPacket::kScanRequest:
 					if(jface)
 					{
-						auto req = packet.scanrequest();
-						size_t count = req.totallen();
-						size_t bytesize =  ceil(count / 8.0f);
+						auto req = packet.mutable_scanrequest();
+						auto chunktype = req->chunk();
+						switch(chunktype)
+						{
+							//Self-contained scan, run it right now
+							case ScanRequest::CHUNK_NONE:
+								{
+									ImageCache::Image image;
+									const uint8_t* txdata;
+									size_t txlen;
+									DecompressScan(codec, req);
+									GetScanWriteData(*req, images, image, txdata, txlen);
+									DoScan(jface, client, codec, *req, txdata, txlen, reply, *stats);
+								}
+								break;
 
-						//If we are going to have read data, allocate a buffer for it
-						uint8_t* rxdata = NULL;
-						if(req.readrequested())
-							rxdata = new uint8_t[bytesize];
+							case ScanRequest::CHUNK_BEGIN:
+								if(streaming)
+								{
+									throw JtagExceptionWrapper(
+										"Got start of chunked scan while another was in progress",
+										"");
+								}
+								streaming = true;
+								StreamScanChunk(jface, client, codec, executor, images, req, stats);
+								break;
 
-						//If no read or write data, just send dummy clocks
-						if(req.writedata().empty() && !req.readrequested())
-							jface->SendDummyClocks(count);
+							case ScanRequest::CHUNK_CONTINUE:
+							case ScanRequest::CHUNK_END:
+								if(!streaming)
+								{
+									throw JtagExceptionWrapper(
+										"Got scan chunk without a chunked scan in progress",
+										"");
+								}
+								StreamScanChunk(jface, client, codec, executor, images, req, stats);
 
-						//We're sending or receiving data. It's an actual shift operation.
-						else
+								//Wait for the whole scan to finish so any adapter errors are reported promptly
+								if(chunktype == ScanRequest::CHUNK_END)
+								{
+									streaming = false;
+									executor.Sync();
+								}
+								break;
+
+							default:
+								LogError("Got invalid ScanRequest chunk type\n");
+								break;
+						}
+					}
+					else
+						LogWarning("ScanRequest not supported - adapter isn't JTAG\n");
+					break;
+
+				//Client wants to know if we already have an image before uploading it
+				case JtaghalPacket::kImageOfferRequest:
+					{
+						auto& hash = packet.imageofferrequest().hash();
+						auto image = g_imageCache.Offer(hash);
+						if(image)
+							images[hash] = image;
+
+						reply.mutable_imageofferreply()->set_present(image != NULL);
+						if(!SendMessage(client, reply, *stats))
 						{
-							//Sanity check that the send data is big enough
-							if(req.writedata().size() < bytesize)
+							throw JtagExceptionWrapper(
+								"Failed to send image offer reply",
+								"");
+						}
+					}
+					break;
+
+				//Client is uploading an image after a cache miss
+				case JtaghalPacket::kImageUploadRequest:
+					{
+						auto req = packet.mutable_imageuploadrequest();
+
+						//New upload? Throw away anything half-received from a previous one
+						if(req->hash() != upload_hash)
+						{
+							upload_hash = req->hash();
+							upload_data.clear();
+						}
+
+						//Don't let a client make us buffer more than we'd be willing to cache.
+						//The upload is held in RAM until it's complete and hashed, and a session keeps it in RAM while
+						//using it, so the memory tier's limit is the one that applies (even if the disk tier is bigger).
+						if(upload_data.size() + req->data().size() > g_imageCache.GetMemoryLimit())
+						{
+							throw JtagExceptionWrapper(
+								"Uploaded image is larger than the image cache",
+								"");
+						}
+						upload_data += req->data();
+
+						if(req->last())
+						{
+							auto image = g_imageCache.Insert(upload_hash, move(upload_data));
+							if(image)
+								images[upload_hash] = image;
+							else
+							{
+								LogWarning("Uploaded image %s didn't match its hash, discarding\n",
+									Sha256::ToHex(upload_hash).c_str());
+							}
+							upload_hash.clear();
+							upload_data.clear();
+
+							reply.mutable_imageofferreply()->set_present(image != NULL);
+							if(!SendMessage(client, reply, *stats))
 							{
 								throw JtagExceptionWrapper(
-									"Not enough TX data for requested clock cycle count",
+									"Failed to send image upload reply",
 									"");
 							}
+						}
+					}
+					break;
+
+				//Client is uploading a scan program
+				case JtaghalPacket::kProgramLoadRequest:
+					{
+						auto& req = packet.programloadrequest();
+						auto pr = reply.mutable_programreply();
+						try
+						{
+							ScanProgram program;
+							program.Load(req.bytecode());
+							programs[req.id()] = program;
+							pr->set_ok(true);
+						}
+						catch(const JtagException& ex)
+						{
+							pr->set_ok(false);
+							pr->set_error(ex.GetDescription());
+						}
+
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send program reply",
+								"");
+						}
+					}
+					break;
+
+				//Run a previously uploaded scan program against a new set of parameters
+				case JtaghalPacket::kProgramRunRequest:
+					if(jface)
+					{
+						auto& req = packet.programrunrequest();
+						auto pr = reply.mutable_programreply();
+
+						auto it = programs.find(req.id());
+						if(it == programs.end())
+						{
+							pr->set_ok(false);
+							pr->set_error("No such program");
+						}
+						else
+						{
+							try
+							{
+								size_t failpc = 0;
+								pr->set_ok(it->second.Run(jface, req.params(), *pr->mutable_results(), failpc));
+								if(!pr->ok())
+								{
+									pr->set_error("Poll timed out");
+									pr->set_failpc(failpc);
+								}
+							}
+							catch(const JtagException& ex)
+							{
+								pr->set_ok(false);
+								pr->set_error(ex.GetDescription());
+							}
+						}
 
-							//Split scans
-							if(req.split())
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send program reply",
+								"");
+						}
+					}
+					else
+						LogWarning("ProgramRunRequest not supported - adapter isn't JTAG\n");
+					break;
+
+				//Send the (possibly cached) chain layout to the client
+				case JtaghalPacket::kChainInfoRequest:
+					if(jface)
+					{
+						vector<ChainCache::Device> devices;
+						vector<ChainCache::Phase> phases;
+						auto ci = reply.mutable_chaininforeply();
+						ci->set_cached(jface->GetChain(packet.chaininforequest().rescan(), devices, phases));
+						for(auto& d : devices)
+						{
+							auto cd = ci->add_devices();
+							cd->set_idcode(d.m_idcode);
+							cd->set_irlength(d.m_irlength);
+						}
+						for(auto& p : phases)
+						{
+							auto cp = ci->add_phases();
+							cp->set_name(p.m_name);
+							cp->set_seconds(p.m_time);
+						}
+
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send chain info",
+								"");
+						}
+					}
+					else
+						LogWarning("ChainInfoRequest not supported - adapter isn't JTAG\n");
+					break;
+
+				//Batch of ARM DP/AP register accesses
+				case JtaghalPacket::kDapTransactionRequest:
+					{
+						auto& req = packet.daptransactionrequest();
+						auto dr = reply.mutable_daptransactionreply();
+						try
+						{
+							auto dap = GetDapAccessor(jface, sface, daps, req.device());
+
+							vector<DapAccessor::Op> ops;
+							for(auto& op : req.ops())
+								ops.push_back({op.ap(), op.read(), op.addr(), op.wdata()});
+
+							if(req.maxretries())
+								dap->SetMaxRetries(req.maxretries());
+							if(req.reset())
+								dap->Reset();
+
+							vector<uint32_t> rdata;
+							size_t failindex = 0;
+							string error;
+							dr->set_ok(dap->Execute(ops, rdata, failindex, error));
+							for(auto d : rdata)
+								dr->add_rdata(d);
+							if(!dr->ok())
 							{
-								//Read only
-								if(req.writedata().size() == 0)
-									jface->ShiftDataReadOnly(rxdata, count);
+								dr->set_failindex(failindex);
+								dr->set_error(error);
+							}
+						}
+						catch(const JtagException& ex)
+						{
+							dr->set_ok(false);
+							dr->set_error(ex.GetDescription());
+						}
 
-								//Write only
-								else
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send DAP transaction reply",
+								"");
+						}
+					}
+					break;
+
+				//Block read through a MEM-AP
+				case JtaghalPacket::kMemReadRequest:
+					{
+						auto& req = packet.memreadrequest();
+						auto mr = reply.mutable_memreply();
+						if(req.count() > MAX_MEM_BLOCK_WORDS)
+						{
+							mr->set_ok(false);
+							mr->set_error("Block read is too large");
+						}
+						else
+						{
+							try
+							{
+								auto dap = GetDapAccessor(jface, sface, daps, req.device());
+								vector<uint32_t> data;
+								string error;
+								mr->set_ok(dap->ReadMemory(req.apsel(), req.addr(), req.count(), data, error));
+								if(mr->ok())
 								{
-									if(!jface->ShiftDataWriteOnly(req.settmsatend(), (const uint8_t*)req.writedata().c_str(), rxdata, count))
+									auto out = mr->mutable_data();
+									out->resize(data.size() * 4);
+									for(size_t i=0; i<data.size(); i++)
 									{
-										throw JtagExceptionWrapper(
-											"Read wasn't actually deferred - not implemented!",
-											"");
+										for(size_t j=0; j<4; j++)
+											(*out)[i*4 + j] = static_cast<char>(data[i] >> (8*j));
 									}
 								}
+								else
+									mr->set_error(error);
 							}
+							catch(const JtagException& ex)
+							{
+								mr->set_ok(false);
+								mr->set_error(ex.GetDescription());
+							}
+						}
 
-							//Non-split scans
-							else
-								jface->ShiftData(req.settmsatend(), (const uint8_t*)req.writedata().c_str(), rxdata, count);
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send memory reply",
+								"");
 						}
+					}
+					break;
 
-						//Send the reply
-						if(rxdata)
+				//Block write through a MEM-AP
+				case JtaghalPacket::kMemWriteRequest:
+					{
+						auto& req = packet.memwriterequest();
+						auto mr = reply.mutable_memreply();
+						if(req.data().size() % 4)
 						{
-							auto sr = reply.mutable_scanreply();
-							sr->set_readdata(string((char*)rxdata, bytesize));
+							mr->set_ok(false);
+							mr->set_error("Block write data must be a whole number of words");
+						}
+						else
+						{
+							try
+							{
+								auto dap = GetDapAccessor(jface, sface, daps, req.device());
+								auto& in = req.data();
+								vector<uint32_t> data(in.size() / 4);
+								for(size_t i=0; i<data.size(); i++)
+								{
+									for(size_t j=0; j<4; j++)
+										data[i] |= static_cast<uint32_t>(static_cast<uint8_t>(in[i*4 + j])) << (8*j);
+								}
 
-							if(!SendMessage(client, reply))
+								string error;
+								mr->set_ok(dap->WriteMemory(req.apsel(), req.addr(), data, error));
+								if(!mr->ok())
+									mr->set_error(error);
+							}
+							catch(const JtagException& ex)
 							{
-								throw JtagExceptionWrapper(
-									"Failed to send scan reply",
-									"");
+								mr->set_ok(false);
+								mr->set_error(ex.GetDescription());
+							}
+						}
+
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send memory reply",
+								"");
+						}
+					}
+					break;
+
+				//Change GPIO values and directions
+				case JtaghalPacket::kGpioWriteRequest:
+					if(gface)
+					{
+						auto& req = packet.gpiowriterequest();
+						int count = gface->GetGpioCount();
+						for(auto& pin : req.pins())
+						{
+							if(pin.pin() >= static_cast<uint32_t>(count))
+							{
+								LogError("Got GpioWriteRequest for nonexistent pin %u\n", pin.pin());
+								continue;
 							}
-							delete[] rxdata;
+							gface->SetGpioValueDeferred(pin.pin(), pin.value());
+							gface->SetGpioDirectionDeferred(pin.pin(), pin.is_output());
+						}
+
+						if(req.deferred())
+							gpio_pending = true;
+						else
+						{
+							FlushGpioWrites(iface, gface);
+							gpio_pending = false;
 						}
 					}
 					else
-						LogWarning("ScanRequest not supported - adapter isn't JTAG\n");
+						LogWarning("GpioWriteRequest not supported - adapter doesn't have GPIOs\n");
+					break;
+
+				//Play back a timed GPIO waveform
+				case JtaghalPacket::kGpioWaveformRequest:
+					{
+						auto wr = reply.mutable_gpiowaveformreply();
+						if(gface)
+						{
+							vector<GpioEngine::Step> steps;
+							for(auto& s : packet.gpiowaveformrequest().steps())
+								steps.push_back({s.time_us(), s.mask(), s.values(), s.outputs()});
+
+							try
+							{
+								GpioEngine engine(iface, gface);
+								wr->set_max_late_us(engine.Play(steps));
+								wr->set_ok(true);
+							}
+							catch(const JtagException& ex)
+							{
+								wr->set_ok(false);
+								wr->set_error(ex.GetDescription());
+							}
+						}
+						else
+						{
+							wr->set_ok(false);
+							wr->set_error("Adapter doesn't have GPIOs");
+						}
+
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send waveform reply",
+								"");
+						}
+					}
+					break;
+
+				//Sample GPIOs at a fixed rate and stream the samples back
+				case JtaghalPacket::kGpioCaptureRequest:
+					{
+						auto& req = packet.gpiocapturerequest();
+						uint64_t overruns = 0;
+
+						//Turn down captures that would hold the adapter too long.
+						//There's nowhere to put an error in the reply, so the client just gets an empty capture.
+						bool valid = true;
+						try
+						{
+							GpioEngine::CheckCapture(req.period_us(), req.samples());
+						}
+						catch(const JtagException& ex)
+						{
+							LogWarning("Rejecting GPIO capture: %s\n", ex.GetDescription().c_str());
+							valid = false;
+						}
+
+						if(!gface)
+							LogWarning("GpioCaptureRequest not supported - adapter doesn't have GPIOs\n");
+						else if(valid)
+						{
+							GpioEngine engine(iface, gface);
+							overruns = engine.Capture(req.period_us(), req.samples(), req.mask(),
+								[&client, &stats](uint64_t first, uint32_t count, const string& data)
+								{
+									JtaghalPacket block;
+									auto cb = block.mutable_gpiocaptureblock();
+									cb->set_first(first);
+									cb->set_count(count);
+									cb->set_data(data);
+									if(!SendMessage(client, block, *stats))
+									{
+										throw JtagExceptionWrapper(
+											"Failed to send capture block",
+											"");
+									}
+								});
+						}
+
+						//Empty block marks the end of the capture
+						auto cb = reply.mutable_gpiocaptureblock();
+						cb->set_last(true);
+						cb->set_overruns(overruns);
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send capture block",
+								"");
+						}
+					}
 					break;
 
 				//Read GPIO state and send it to the client
@@ -362,7 +1001,7 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 							}
 						}
 
-						if(!SendMessage(client, reply))
+						if(!SendMessage(client, reply, *stats))
 						{
 							throw JtagExceptionWrapper(
 								"Failed to send GPIO state",
@@ -371,45 +1010,494 @@ void ProcessConnection(TestInterface* iface, Socket& client)
 					}
 					break;
 
-				default:
-					LogError("Unimplemented type field: %d\n", packet.Payload_case());
-					break;
-			}
-
-			/*
-			switch(opcode)
-			{
-				case JTAGD_OP_WRITE_GPIO_STATE:
+				//Reserve part of the chain and/or set our share of the adapter
+				case JtaghalPacket::kReserveRequest:
 					{
-						GPIOInterface* gpio = dynamic_cast<GPIOInterface*>(iface);
-						if(gpio != NULL)
+						auto& req = packet.reserverequest();
+						auto rr = reply.mutable_reservereply();
+						g_arbiter.SetWeight(session_id, req.weight());
+						weight = req.weight() ? req.weight() : ChainArbiter::DEFAULT_WEIGHT;
+
+						string error;
+						if(jface)
 						{
-							int count = gpio->GetGpioCount();
-							uint8_t* buf = new uint8_t[count];
-							client.RecvLooped(buf, count);
-							for(int i=0; i<count; i++)
+							try
+							{
+								rr->set_ok(jface->Reserve(req.first(), req.count(), error));
+							}
+							catch(const JtagException& ex)
 							{
-								uint8_t val = buf[i];
-								gpio->SetGpioValueDeferred(i, (val & 1) ? true : false);
-								gpio->SetGpioDirectionDeferred(i, (val & 2) ? true : false);
+								rr->set_ok(false);
+								error = ex.GetDescription();
 							}
-							delete[] buf;
-							gpio->WriteGpioState();
 						}
-					};
+						else if(req.count() != 0)
+						{
+							rr->set_ok(false);
+							error = "Device reservations are only supported on JTAG adapters";
+						}
+						else
+							rr->set_ok(true);
+						if(!rr->ok())
+							rr->set_error(error);
+
+						//Device indexes are relative to the reservation, so DAP accessors have to be recreated
+						daps.clear();
+
+						if(!SendMessage(client, reply, *stats))
+						{
+							throw JtagExceptionWrapper(
+								"Failed to send reserve reply",
+								"");
+						}
+					}
+					break;
+
+				default:
+					LogError("Unimplemented type field: %d\n", packet.Payload_case());
 					break;
 			}
-			*/
 
+			stats->Update(rawjface);
+			stats->AddRequest(GetTime() - start);
+			if(first_op)
+			{
+				g_monitor.RecordFirstOp(cold, GetTime() - connected);
+				first_op = false;
+			}
 			if(quit)
 				break;
+
+			//Let someone else have the adapter once the chain is somewhere they can pick it up from.
+			//Deferred GPIO writes can wait for our next request unless someone else wants the adapter now.
+			if(!streaming && (!jface || jface->IsIdle()) )
+			{
+				executor.Sync();
+				if(gpio_pending && g_arbiter.HasWaiters(session_id))
+				{
+					FlushGpioWrites(iface, gface);
+					gpio_pending = false;
+				}
+				stats->Detach(rawjface);
+				g_arbiter.Release(session_id);
+			}
+		}
+
+		g_arbiter.Acquire(session_id);
+		rebind();
+		stats->Attach(rawjface);
+		if(gpio_pending)
+			FlushGpioWrites(iface, gface);
+
+		//Keep what the client set up, in case it comes back
+		if(!token.empty())
+		{
+			SessionCache::State state;
+			if(jface)
+			{
+				jface->GetReservation(state.m_first, state.m_count);
+				state.m_desired = jface->GetReservedIR();
+			}
+			state.m_weight = weight;
+			state.m_programs = move(programs);
+			state.m_images = move(images);
+			g_sessionCache.Save(token, move(state));
 		}
 	}
 	catch(JtagException& ex)
 	{
 		//Socket closed? Don't display the message, it just spams the console
 		if(ex.GetDescription().find("Socket closed") == string::npos)
+		{
 			LogError("%s\n", ex.GetDescription().c_str());
+
+			//Save what led up to the failure
+			string path = g_recorder.Dump("session " + to_string(session_id) + " failed: " + ex.GetDescription());
+			if(path != "")
+				LogNotice("Recent adapter operations saved to %s\n", path.c_str());
+
+			//We don't know what state the session left the chain in, so don't trust the cached layout
+			g_chainCache.Invalidate();
+
+			//The adapter may have gone away
+			g_monitor.ReportError();
+		}
 		fflush(stdout);
 	}
+
+	//Don't leave the chain mid-scan for the next session
+	try
+	{
+		if(session && !session->IsIdle())
+		{
+			g_arbiter.Acquire(session_id);
+			stats->Attach(dynamic_cast<JtagInterface*>(iface));
+			session->Abandon();
+		}
+	}
+	catch(const JtagException& ex)
+	{
+		LogError("%s\n", ex.GetDescription().c_str());
+	}
+	stats->Detach(dynamic_cast<JtagInterface*>(iface));
+	g_stats.RemoveSession(stats);
+	g_arbiter.RemoveSession(session_id);
+	g_monitor.RemoveSession();
+}
+
+/**
+	@brief Performs a single shift operation and sends the read data (if any) back to the client
+
+	@param jface		The interface to shift data through
+	@param client		Socket to send the reply to
+	@param codec		Compression settings for the read data
+	@param req			The scan to perform
+	@param txdata		Data to shift (from the request itself or a cached image)
+	@param txlen		Number of bytes of write data available
+	@param reply		Empty message to build the reply in
+	@param stats		Statistics to count the reply in
+ */
+static void DoScan(
+	JtagInterface* jface,
+	Socket& client,
+	PayloadCodec& codec,
+	const ScanRequest& req,
+	const uint8_t* txdata,
+	size_t txlen,
+	JtaghalPacket& reply,
+	SessionStats& stats)
+{
+	size_t count = req.totallen();
+	size_t bytesize =  ceil(count / 8.0f);
+
+	//If no read or write data, just send dummy clocks
+	if( (txlen == 0) && !req.readrequested())
+	{
+		jface->SendDummyClocks(count);
+		return;
+	}
+
+	//If we are going to have read data, allocate a buffer for it
+	vector<uint8_t> rxbuf;
+	uint8_t* rxdata = NULL;
+	if(req.readrequested())
+	{
+		rxbuf.resize(bytesize);
+		rxdata = &rxbuf[0];
+	}
+
+	//Split scans
+	if(req.split())
+	{
+		//Read only (collects the data of an earlier write-only scan, so there's nothing to send)
+		if(txlen == 0)
+			jface->ShiftDataReadOnly(rxdata, count);
+
+		//Write only
+		else
+		{
+			if(txlen < bytesize)
+			{
+				throw JtagExceptionWrapper(
+					"Not enough TX data for requested clock cycle count",
+					"");
+			}
+			if(!jface->ShiftDataWriteOnly(req.settmsatend(), txdata, rxdata, count))
+			{
+				throw JtagExceptionWrapper(
+					"Read wasn't actually deferred - not implemented!",
+					"");
+			}
+		}
+	}
+
+	//Non-split scans
+	else
+	{
+		//Sanity check that the send data is big enough
+		if(txlen < bytesize)
+		{
+			throw JtagExceptionWrapper(
+				"Not enough TX data for requested clock cycle count",
+				"");
+		}
+		jface->ShiftData(req.settmsatend(), txdata, rxdata, count);
+	}
+
+	//Send the reply
+	if(rxdata)
+	{
+		auto sr = reply.mutable_scanreply();
+		auto c = codec.Encode(rxdata, bytesize, *sr->mutable_readdata());
+		if(c == PayloadCodec::CODEC_NONE)
+			sr->set_readdata(reinterpret_cast<const char*>(rxdata), bytesize);
+		else
+		{
+			sr->set_codec(static_cast<CompressionCodec>(c));
+			sr->set_rawlen(bytesize);
+		}
+
+		double start = GetTime();
+		if(!SendMessage(client, reply, stats))
+		{
+			throw JtagExceptionWrapper(
+				"Failed to send scan reply",
+				"");
+		}
+		codec.RecordSend(sr->readdata().size(), GetTime() - start);
+	}
+}
+
+/**
+	@brief Runs a fast-path frame and sends the read data (if any) back to the client
+ */
+static void RunFastFrame(JtagInterface* jface, Socket& client, FastFrame& frame, SessionStats& stats)
+{
+	if(!jface)
+	{
+		throw JtagExceptionWrapper(
+			"Fast-path frames need a JTAG adapter",
+			"");
+	}
+
+	switch(frame.GetOpcode())
+	{
+		case FastFrame::FAST_STATE:
+			switch(frame.GetLength())
+			{
+				case JtagStateChangeRequest::TestLogicReset:
+					jface->TestLogicReset();
+					break;
+
+				case JtagStateChangeRequest::EnterShiftIR:
+					jface->EnterShiftIR();
+					break;
+
+				case JtagStateChangeRequest::LeaveExitIR:
+					jface->LeaveExit1IR();
+					break;
+
+				case JtagStateChangeRequest::EnterShiftDR:
+					jface->EnterShiftDR();
+					break;
+
+				case JtagStateChangeRequest::LeaveExitDR:
+					jface->LeaveExit1DR();
+					break;
+
+				case JtagStateChangeRequest::ResetToIdle:
+					jface->ResetToIdle();
+					break;
+
+				default:
+					LogError("Got invalid fast-path state change\n");
+					break;
+			}
+			break;
+
+		case FastFrame::FAST_SCAN:
+			if(frame.GetReadRequested())
+			{
+				jface->ShiftData(frame.GetTmsAtEnd(), frame.GetData(), frame.GetReadBuffer(), frame.GetLength());
+				if(!frame.SendScanReply(client, frame.GetReadBuffer(), frame.GetLength()))
+				{
+					throw JtagExceptionWrapper(
+						"Failed to send scan reply",
+						"");
+				}
+				stats.AddBytesOut(8 + frame.GetDataSize());
+			}
+			else
+				jface->ShiftData(frame.GetTmsAtEnd(), frame.GetData(), NULL, frame.GetLength());
+			break;
+
+		case FastFrame::FAST_DUMMY:
+			jface->SendDummyClocks(frame.GetLength());
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+	@brief Queues one chunk of a streamed scan for execution.
+
+	Each chunk is shifted as soon as the adapter is free, while we go back to receiving the next one. Only the final
+	chunk may leave Shift-DR/IR, so settmsatend is rejected on anything else.
+
+	@param jface		The interface to shift data through
+	@param client		Socket to send read data back to
+	@param codec		Compression settings for the session
+	@param executor		Executor to run the shift on
+	@param images		Cached images the chunk may reference
+	@param req			The chunk to shift. The write data is moved out of the request to avoid a copy.
+	@param stats		Statistics to count the reply in
+ */
+static void StreamScanChunk(
+	JtagInterface* jface,
+	Socket& client,
+	PayloadCodec& codec,
+	AdapterExecutor& executor,
+	const ImageMap& images,
+	ScanRequest* req,
+	shared_ptr<SessionStats> stats)
+{
+	if(req->settmsatend() && (req->chunk() != ScanRequest::CHUNK_END))
+	{
+		throw JtagExceptionWrapper(
+			"settmsatend is only legal on the last chunk of a chunked scan",
+			"");
+	}
+
+	//Take ownership of the chunk, since the request is freed with the session's arena before the chunk is shifted.
+	//Swapping with a heap message would deep copy, so move the (possibly large) write data out by itself.
+	auto chunk = make_shared<ScanRequest>();
+	string data;
+	data.swap(*req->mutable_writedata());
+	chunk->CopyFrom(*req);
+	chunk->mutable_writedata()->swap(data);
+
+	//Decompress here rather than in the executor so it overlaps with the previous chunk being shifted
+	DecompressScan(codec, chunk.get());
+
+	ImageCache::Image image;
+	const uint8_t* txdata;
+	size_t txlen;
+	GetScanWriteData(*chunk, images, image, txdata, txlen);
+
+	executor.Submit([jface, &client, &codec, chunk, image, txdata, txlen, stats]
+		{
+			JtaghalPacket reply;
+			DoScan(jface, client, codec, *chunk, txdata, txlen, reply, *stats);
+		});
+}
+
+/**
+	@brief Sends a message to the client and counts it in the session's statistics
+ */
+static bool SendMessage(Socket& client, const JtaghalPacket& msg, SessionStats& stats)
+{
+	stats.AddBytesOut(msg.ByteSizeLong() + 4);
+	return SendMessage(client, msg);
+}
+
+/**
+	@brief Replaces compressed write data in a scan request with the uncompressed data
+ */
+static void DecompressScan(PayloadCodec& codec, ScanRequest* req)
+{
+	auto c = static_cast<PayloadCodec::Codec>(req->codec());
+	if(c == PayloadCodec::CODEC_NONE)
+		return;
+
+	if(!codec.IsAllowed(c))
+	{
+		throw JtagExceptionWrapper(
+			"Scan uses a codec that wasn't negotiated",
+			"");
+	}
+
+	string raw;
+	PayloadCodec::Decode(c, req->writedata(), req->rawlen(), raw);
+	req->set_writedata(move(raw));
+	req->set_codec(CODEC_NONE);
+}
+
+/**
+	@brief Figures out where the write data for a scan comes from.
+
+	Scans normally carry their write data inline, but may instead reference a range of a cached image by hash.
+
+	@param req			The scan request
+	@param images		Cached images available to this session
+	@param image		Set to the referenced image, if any, so the caller can keep it alive while the scan runs
+	@param txdata		Set to the start of the write data
+	@param txlen		Set to the number of bytes of write data available
+ */
+static void GetScanWriteData(
+	const ScanRequest& req,
+	const ImageMap& images,
+	ImageCache::Image& image,
+	const uint8_t*& txdata,
+	size_t& txlen)
+{
+	if(req.imagehash().empty())
+	{
+		image = NULL;
+		txdata = (const uint8_t*)req.writedata().c_str();
+		txlen = req.writedata().size();
+		return;
+	}
+
+	auto it = images.find(req.imagehash());
+	if(it == images.end())
+	{
+		throw JtagExceptionWrapper(
+			"Scan references an image that wasn't offered or uploaded in this session",
+			"");
+	}
+	image = it->second;
+
+	if(req.imageoffset() > image->size())
+	{
+		throw JtagExceptionWrapper(
+			"Scan image offset is past the end of the image",
+			"");
+	}
+	txdata = (const uint8_t*)image->c_str() + req.imageoffset();
+	txlen = image->size() - req.imageoffset();
+}
+
+/**
+	@brief Sends staged GPIO writes to the adapter in one update.
+
+	Anything already queued in the adapter (typically scans) is committed first, so pins change after the operations
+	the client sent before the GPIO write and not before.
+ */
+static void FlushGpioWrites(TestInterface* iface, GPIOInterface* gface)
+{
+	iface->Commit();
+	gface->WriteGpioState();
+}
+
+/**
+	@brief Gets the DAP accessor for a session, creating it on first use
+
+	@param jface		The session's view of the interface, if it's JTAG
+	@param sface		The interface, if it's SWD
+	@param daps			Accessors already created for this session
+	@param device		Chain index of the JTAG-DP, relative to the session's reservation (ignored for SWD)
+ */
+static DapAccessor* GetDapAccessor(
+	SessionJtagInterface* jface,
+	SWDInterface* sface,
+	map<uint32_t, unique_ptr<DapAccessor> >& daps,
+	uint32_t device)
+{
+	if(sface)
+		device = 0;
+
+	auto& dap = daps[device];
+	if(dap)
+		return dap.get();
+
+	if(sface)
+		dap.reset(new SwdDapAccessor(sface));
+	else if(jface)
+	{
+		//Need IR lengths to put everything else in BYPASS
+		vector<ChainCache::Device> chain;
+		vector<ChainCache::Phase> phases;
+		jface->GetChain(false, chain, phases);
+		dap.reset(new JtagDapAccessor(jface, device, chain));
+	}
+	else
+	{
+		throw JtagExceptionWrapper(
+			"Adapter doesn't support DAP access",
+			"");
+	}
+
+	return dap.get();
 }
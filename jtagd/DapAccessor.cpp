@@ -0,0 +1,354 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of DapAccessor
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+DapAccessor::DapAccessor()
+	: m_maxRetries(100)
+	, m_select(0)
+	, m_selectValid(false)
+{
+}
+
+DapAccessor::~DapAccessor()
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch execution
+
+/**
+	@brief Runs a batch of accesses.
+
+	@param ops			The accesses to perform, in order
+	@param rdata		Read data, one word per read in ops
+	@param failindex	Index of the access that failed, if any
+	@param error		Description of the failure, if any
+
+	@return True on success. On failure, any sticky error flags have been cleared and the DAP is ready for another batch.
+ */
+bool DapAccessor::Execute(const vector<Op>& ops, vector<uint32_t>& rdata, size_t& failindex, string& error)
+{
+	rdata.clear();
+	Begin();
+
+	//Index in rdata of the AP read whose result is still in flight, if any
+	bool pending = false;
+	size_t pendingSlot = 0;
+
+	size_t i = 0;
+	try
+	{
+		for(; i<ops.size(); i++)
+		{
+			auto& op = ops[i];
+
+			//Another AP read in the same bank? Its posted result is the previous read's data
+			if(op.m_ap && op.m_read && pending && m_selectValid && ((op.m_addr & 0xff0000f0) == m_select) )
+			{
+				rdata[pendingSlot] = PostAPRead(op.m_addr & 0xff);
+				pendingSlot = rdata.size();
+				rdata.push_back(0);
+				continue;
+			}
+
+			//Anything else has to wait for the last posted read to complete
+			if(pending)
+			{
+				rdata[pendingSlot] = ReadDP(DP_RDBUFF);
+				pending = false;
+			}
+
+			if(op.m_ap)
+			{
+				Select(op.m_addr);
+				if(op.m_read)
+				{
+					PostAPRead(op.m_addr & 0xff);
+					pending = true;
+					pendingSlot = rdata.size();
+					rdata.push_back(0);
+				}
+				else
+					WriteAP(op.m_addr & 0xff, op.m_wdata);
+			}
+			else
+			{
+				if(op.m_read)
+					rdata.push_back(ReadDP(op.m_addr));
+				else
+				{
+					WriteDP(op.m_addr, op.m_wdata);
+					if(op.m_addr == DP_SELECT)
+					{
+						m_select = op.m_wdata;
+						m_selectValid = true;
+					}
+				}
+			}
+		}
+
+		if(pending)
+			rdata[pendingSlot] = ReadDP(DP_RDBUFF);
+
+		CheckErrors();
+		Commit();
+	}
+	catch(const JtagException& ex)
+	{
+		failindex = i;
+		error = ex.GetDescription();
+		Recover();
+		return false;
+	}
+
+	return true;
+}
+
+/**
+	@brief Reads a block of memory through a MEM-AP
+
+	@param apsel		The MEM-AP to use
+	@param addr			Word-aligned start address
+	@param count		Number of 32-bit words to read
+	@param data			The data read
+	@param error		Description of the failure, if any
+
+	@return True on success
+ */
+bool DapAccessor::ReadMemory(uint32_t apsel, uint32_t addr, size_t count, vector<uint32_t>& data, string& error)
+{
+	data.resize(count);
+	if(addr & 3)
+	{
+		error = "Block transfer address must be word aligned";
+		return false;
+	}
+
+	Begin();
+	try
+	{
+		SetupBlockTransfer(apsel);
+
+		size_t i = 0;
+		while(i < count)
+		{
+			//Go as far as the next auto-increment boundary
+			uint32_t wordaddr = addr + i*4;
+			size_t chunk = min(count - i, static_cast<size_t>(TAR_WRAP - (wordaddr % TAR_WRAP)) / 4);
+			ReadBlock(wordaddr, &data[i], chunk);
+			i += chunk;
+		}
+
+		CheckErrors();
+		Commit();
+	}
+	catch(const JtagException& ex)
+	{
+		error = ex.GetDescription();
+		Recover();
+		return false;
+	}
+
+	return true;
+}
+
+/**
+	@brief Writes a block of memory through a MEM-AP
+
+	@param apsel		The MEM-AP to use
+	@param addr			Word-aligned start address
+	@param data			The data to write
+	@param error		Description of the failure, if any
+
+	@return True on success
+ */
+bool DapAccessor::WriteMemory(uint32_t apsel, uint32_t addr, const vector<uint32_t>& data, string& error)
+{
+	if(addr & 3)
+	{
+		error = "Block transfer address must be word aligned";
+		return false;
+	}
+
+	Begin();
+	try
+	{
+		SetupBlockTransfer(apsel);
+
+		size_t i = 0;
+		while(i < data.size())
+		{
+			uint32_t wordaddr = addr + i*4;
+			size_t chunk = min(data.size() - i, static_cast<size_t>(TAR_WRAP - (wordaddr % TAR_WRAP)) / 4);
+			WriteBlock(wordaddr, &data[i], chunk);
+			i += chunk;
+		}
+
+		//Make sure the last write actually completed before reporting success
+		ReadDP(DP_RDBUFF);
+		CheckErrors();
+		Commit();
+	}
+	catch(const JtagException& ex)
+	{
+		error = ex.GetDescription();
+		Recover();
+		return false;
+	}
+
+	return true;
+}
+
+/**
+	@brief Selects a MEM-AP and sets it up for word-sized, auto-incrementing accesses.
+
+	Other CSW fields (protection, secure access, etc) are left as the target had them.
+ */
+void DapAccessor::SetupBlockTransfer(uint32_t apsel)
+{
+	Select(apsel << 24);
+	PostAPRead(MEMAP_CSW);
+	uint32_t csw = ReadDP(DP_RDBUFF);
+
+	uint32_t want = (csw & ~(CSW_SIZE_MASK | CSW_ADDRINC_MASK)) | CSW_SIZE_WORD | CSW_ADDRINC_SINGLE;
+	if(want != csw)
+		WriteAP(MEMAP_CSW, want);
+}
+
+/**
+	@brief Reads words from consecutive addresses, one access at a time
+
+	@param addr		Address of the first word
+	@param data		The data read
+	@param count	Number of words to read
+ */
+void DapAccessor::ReadBlock(uint32_t addr, uint32_t* data, size_t count)
+{
+	WriteAP(MEMAP_TAR, addr);
+
+	//Every DRW read returns the previous one's data, so the first result is junk and the last is in RDBUFF
+	PostAPRead(MEMAP_DRW);
+	for(size_t i=1; i<count; i++)
+		data[i - 1] = PostAPRead(MEMAP_DRW);
+	data[count - 1] = ReadDP(DP_RDBUFF);
+}
+
+/**
+	@brief Writes words to consecutive addresses, one access at a time
+
+	@param addr		Address of the first word
+	@param data		The data to write
+	@param count	Number of words to write
+ */
+void DapAccessor::WriteBlock(uint32_t addr, const uint32_t* data, size_t count)
+{
+	WriteAP(MEMAP_TAR, addr);
+	for(size_t i=0; i<count; i++)
+		WriteAP(MEMAP_DRW, data[i]);
+}
+
+/**
+	@brief Called at the start of each batch or block transfer.
+
+	Other sessions may have used the DAP since our last batch, so SELECT has to be written again before the first AP
+	access.
+ */
+void DapAccessor::Begin()
+{
+	m_selectValid = false;
+}
+
+/**
+	@brief Called at the end of each batch or block transfer to check for errors the transport doesn't report directly.
+
+	Throws a JtagException if anything failed.
+ */
+void DapAccessor::CheckErrors()
+{
+}
+
+/**
+	@brief Gets the DAP back into a usable state after a failed batch
+ */
+void DapAccessor::Recover()
+{
+	m_selectValid = false;
+	try
+	{
+		ClearStickyErrors();
+		Commit();
+	}
+	catch(const JtagException& ex)
+	{
+		LogWarning("Couldn't clear DAP errors: %s\n", ex.GetDescription().c_str());
+	}
+}
+
+/**
+	@brief Forgets anything we knew about the DAP state
+ */
+void DapAccessor::Reset()
+{
+	m_selectValid = false;
+}
+
+/**
+	@brief Points SELECT at the AP and register bank of an AP address, if it isn't already
+ */
+void DapAccessor::Select(uint32_t addr)
+{
+	uint32_t select = addr & 0xff0000f0;
+	if(m_selectValid && (m_select == select))
+		return;
+
+	WriteDP(DP_SELECT, select);
+	m_select = select;
+	m_selectValid = true;
+}
+
+/**
+	@brief Clears any sticky error flags set by a failed access
+ */
+void DapAccessor::ClearStickyErrors()
+{
+	uint32_t status = ReadDP(DP_CTRLSTAT);
+	if(status & (CTRLSTAT_STICKYORUN | CTRLSTAT_STICKYCMP | CTRLSTAT_STICKYERR | CTRLSTAT_WDATAERR))
+		WriteDP(DP_ABORT, ABORT_CLEAR_ALL);
+}
@@ -0,0 +1,158 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of DapAccessor
+ */
+
+#ifndef DapAccessor_h
+#define DapAccessor_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+	@brief Executes batches of ARM debug port and access port register accesses next to the adapter.
+
+	Talking to a DAP one register at a time over the network costs a round trip per access, plus more for the SELECT
+	writes and RDBUFF reads around each AP access. Clients instead send a whole list of accesses, which we run with:
+
+	\li SELECT written only when the AP or register bank actually changes
+	\li Consecutive AP reads pipelined: AP reads are posted, so each one returns the result of the one before and only the
+		last has to be fetched from RDBUFF
+	\li WAIT responses retried here, without involving the client
+	\li One adapter commit at the end of the batch
+
+	Memory behind a MEM-AP can also be read or written in blocks: TAR is written once per 1 KB (the largest range
+	auto-increment is guaranteed to cover) and DRW is accessed repeatedly with single auto-increment, with reads
+	pipelined as above. Transports that can queue accesses override ReadBlock() and WriteBlock() to run each 1 KB block
+	without waiting for the adapter between words.
+
+	Derived classes supply the transport (SWD-DP or JTAG-DP).
+
+	AP register addresses are (APSEL << 24) | byte address within the AP, DP register addresses are byte addresses.
+ */
+class DapAccessor
+{
+public:
+	DapAccessor();
+	virtual ~DapAccessor();
+
+	///@brief One register access
+	struct Op
+	{
+		bool m_ap;
+		bool m_read;
+		uint32_t m_addr;
+		uint32_t m_wdata;
+	};
+
+	bool Execute(const std::vector<Op>& ops, std::vector<uint32_t>& rdata, size_t& failindex, std::string& error);
+	bool ReadMemory(uint32_t apsel, uint32_t addr, size_t count, std::vector<uint32_t>& data, std::string& error);
+	bool WriteMemory(uint32_t apsel, uint32_t addr, const std::vector<uint32_t>& data, std::string& error);
+
+	virtual void Reset();
+	virtual void Commit() = 0;
+
+	void SetMaxRetries(unsigned int retries)
+	{ m_maxRetries = retries; }
+
+	///@brief DP register addresses
+	enum DpRegisters
+	{
+		DP_ABORT		= 0x0,
+		DP_CTRLSTAT		= 0x4,
+		DP_SELECT		= 0x8,
+		DP_RDBUFF		= 0xc
+	};
+
+	///@brief CTRL/STAT bits that indicate a failed transaction
+	enum CtrlStatBits
+	{
+		CTRLSTAT_STICKYORUN	= 0x02,
+		CTRLSTAT_STICKYCMP	= 0x10,
+		CTRLSTAT_STICKYERR	= 0x20,
+		CTRLSTAT_WDATAERR	= 0x80
+	};
+
+	///@brief ABORT bits to clear each of the sticky flags
+	static const uint32_t ABORT_CLEAR_ALL = 0x1e;
+
+	///@brief MEM-AP register addresses
+	enum MemApRegisters
+	{
+		MEMAP_CSW		= 0x00,
+		MEMAP_TAR		= 0x04,
+		MEMAP_DRW		= 0x0c
+	};
+
+	///@brief CSW fields we change for block transfers
+	enum CswBits
+	{
+		CSW_SIZE_MASK		= 0x07,
+		CSW_SIZE_WORD		= 0x02,
+		CSW_ADDRINC_MASK	= 0x30,
+		CSW_ADDRINC_SINGLE	= 0x10
+	};
+
+	///@brief Auto-increment is only guaranteed within a 1 KB block, so TAR has to be rewritten at each boundary
+	static const uint32_t TAR_WRAP = 1024;
+
+protected:
+	//Transport hooks. AP accesses use the low byte of the address (A[7:0]) and assume SELECT is already set up.
+	//AP reads are posted: PostAPRead returns the result of the previous AP read, not this one.
+	virtual uint32_t ReadDP(uint8_t addr) = 0;
+	virtual void WriteDP(uint8_t addr, uint32_t wdata) = 0;
+	virtual uint32_t PostAPRead(uint8_t addr) = 0;
+	virtual void WriteAP(uint8_t addr, uint32_t wdata) = 0;
+
+	virtual void Begin();
+	virtual void CheckErrors();
+
+	//Block transfer hooks. The range never crosses a TAR_WRAP boundary, and SELECT and CSW are already set up.
+	virtual void ReadBlock(uint32_t addr, uint32_t* data, size_t count);
+	virtual void WriteBlock(uint32_t addr, const uint32_t* data, size_t count);
+
+	void Select(uint32_t addr);
+	virtual void ClearStickyErrors();
+	void Recover();
+	void SetupBlockTransfer(uint32_t apsel);
+
+	///@brief Maximum number of times to retry an access that got a WAIT response
+	unsigned int m_maxRetries;
+
+	///@brief Current value of the SELECT register, if known
+	uint32_t m_select;
+	bool m_selectValid;
+};
+
+#endif
@@ -0,0 +1,136 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of FastFrame
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+const uint32_t FastFrame::FAST_MAGIC;
+const uint32_t FastFrame::FAST_MAX_BITS;
+
+FastFrame::FastFrame()
+	: m_opcode(FAST_STATE)
+	, m_flags(0)
+	, m_length(0)
+{
+}
+
+/**
+	@brief Waits for the next frame and checks whether it's a fast frame, without consuming anything
+
+	@return False if the socket was closed
+ */
+bool FastFrame::PeekIsFast(Socket& client, bool& fast)
+{
+	uint32_t tag;
+	while(true)
+	{
+		ssize_t len = recv(client, &tag, sizeof(tag), MSG_PEEK | MSG_WAITALL);
+		if(len <= 0)
+			return false;
+		if(len == sizeof(tag))
+			break;
+	}
+
+	fast = ( (tag & 0xffff0000) == FAST_MAGIC );
+	return true;
+}
+
+/**
+	@brief Reads a fast frame. Call only after PeekIsFast() said there is one.
+
+	@return False if the socket was closed
+ */
+bool FastFrame::Recv(Socket& client)
+{
+	uint32_t header[2];
+	if(!client.RecvLooped(reinterpret_cast<unsigned char*>(header), sizeof(header)))
+		return false;
+
+	if(!ParseHeader(header[0], header[1]))
+	{
+		throw JtagExceptionWrapper(
+			"Malformed fast-path frame",
+			"");
+	}
+
+	uint32_t size = GetDataSize();
+	if(size == 0)
+		return true;
+	return client.RecvLooped(m_data, size);
+}
+
+/**
+	@brief Decodes and sanity checks a frame header
+
+	@return True if the header is valid
+ */
+bool FastFrame::ParseHeader(uint32_t tag, uint32_t length)
+{
+	if( (tag & 0xffff0000) != FAST_MAGIC)
+		return false;
+
+	m_opcode = static_cast<Opcode>(tag & 0xff);
+	m_flags = (tag >> 8) & 0xff;
+	m_length = length;
+
+	switch(m_opcode)
+	{
+		case FAST_STATE:
+		case FAST_DUMMY:
+			return true;
+
+		case FAST_SCAN:
+			return (m_length != 0) && (m_length <= FAST_MAX_BITS);
+
+		default:
+			return false;
+	}
+}
+
+/**
+	@brief Sends read data for a scan back to the client
+
+	@return False if the socket was closed
+ */
+bool FastFrame::SendScanReply(Socket& client, const uint8_t* data, uint32_t bits)
+{
+	//Header and data go out in one send
+	uint32_t header[2] = { FAST_MAGIC | FAST_SCAN_REPLY, bits };
+	uint32_t size = (bits + 7) / 8;
+	memcpy(m_rdata, header, sizeof(header));
+	if(data != m_rdata + sizeof(header))
+		memmove(m_rdata + sizeof(header), data, size);
+	return client.SendLooped(m_rdata, sizeof(header) + size);
+}
@@ -0,0 +1,124 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of FastFrame
+ */
+
+#ifndef FastFrame_h
+#define FastFrame_h
+
+#include <stdint.h>
+
+/**
+	@brief Compact binary framing for the hot JTAG operations, used instead of protobuf once negotiated in Hello
+
+	A 5-bit IR write costs a few bytes of actual data but a JtaghalPacket around it, plus a parse that allocates. For
+	small-scan-heavy work like ARM debug that's most of the per-op cost on both ends. Fast frames are a fixed 8-byte
+	header followed by the raw scan data:
+
+		uint32	tag			FAST_MAGIC | (flags << 8) | opcode
+		uint32	length		scan length or dummy clock count in bits, or the state for FAST_STATE
+		uint8	data[]		ceil(length / 8) bytes of write data, FAST_SCAN only
+
+	Both words are in host byte order, the same as the length that starts every protobuf frame. A protobuf frame
+	could only start with the magic value if the message were nearly 4 GB long, so frames of both kinds can be mixed
+	freely on one connection and told apart by peeking at the first word. Scans are limited to FAST_MAX_BITS so the
+	data always fits in a fixed buffer; anything larger (and everything other than the hot ops) uses protobuf.
+
+	Scans with read data get a FAST_SCAN_REPLY frame back, laid out the same way.
+ */
+class FastFrame
+{
+public:
+	FastFrame();
+
+	enum Opcode
+	{
+		FAST_STATE		= 1,	//length is a JtagStateChangeRequest::StateType
+		FAST_SCAN		= 2,
+		FAST_DUMMY		= 3,
+		FAST_SCAN_REPLY	= 4
+	};
+
+	enum Flags
+	{
+		FLAG_TMS_AT_END	= 1,
+		FLAG_READ		= 2
+	};
+
+	///@brief Top 16 bits of the tag
+	static const uint32_t FAST_MAGIC = 0xffff0000;
+
+	///@brief Longest scan that can be sent as a fast frame
+	static const uint32_t FAST_MAX_BITS = 8192 * 8;
+
+	static bool PeekIsFast(Socket& client, bool& fast);
+
+	bool Recv(Socket& client);
+	bool ParseHeader(uint32_t tag, uint32_t length);
+	bool SendScanReply(Socket& client, const uint8_t* data, uint32_t bits);
+
+	Opcode GetOpcode()
+	{ return m_opcode; }
+
+	bool GetTmsAtEnd()
+	{ return (m_flags & FLAG_TMS_AT_END) != 0; }
+
+	bool GetReadRequested()
+	{ return (m_flags & FLAG_READ) != 0; }
+
+	uint32_t GetLength()
+	{ return m_length; }
+
+	uint32_t GetDataSize()
+	{ return (m_opcode == FAST_SCAN) ? (m_length + 7) / 8 : 0; }
+
+	///@brief Write data for a scan
+	uint8_t* GetData()
+	{ return m_data; }
+
+	///@brief Buffer for read data. Data read straight into here can be sent without a copy.
+	uint8_t* GetReadBuffer()
+	{ return m_rdata + 8; }
+
+protected:
+	Opcode m_opcode;
+	uint8_t m_flags;
+	uint32_t m_length;
+
+	uint8_t m_data[FAST_MAX_BITS / 8];
+
+	///@brief Reply header and read data
+	uint8_t m_rdata[8 + FAST_MAX_BITS / 8];
+};
+
+#endif
@@ -0,0 +1,272 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of FlightRecorder
+ */
+#include "jtagd.h"
+#include <time.h>
+
+using namespace std;
+
+const size_t FlightRecorder::HASH_MAX_BYTES;
+const size_t FlightRecorder::DEFAULT_CAPACITY;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+FlightRecorder::FlightRecorder()
+	: m_capacity(0)
+	, m_next(0)
+	, m_start(GetTime())
+	, m_dir(".")
+	, m_dumps(0)
+{
+}
+
+/**
+	@brief Allocates the buffer. Call once at startup, before anything is recorded.
+
+	@param entries	Number of operations to keep, or 0 to turn recording off
+ */
+void FlightRecorder::SetCapacity(size_t entries)
+{
+	m_capacity = entries;
+	if(entries)
+	{
+		m_entries.reset(new Entry[entries]);
+		for(size_t i=0; i<entries; i++)
+			m_entries[i].m_seq = 0;
+	}
+	else
+		m_entries.reset();
+	m_next = 0;
+	m_start = GetTime();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Recording
+
+/**
+	@brief Hashes (the start of) some scan data
+
+	@param data		The data, or NULL
+	@param bits		Length of the data in bits
+ */
+uint32_t FlightRecorder::Hash(const uint8_t* data, size_t bits)
+{
+	if(!data || !bits)
+		return 0;
+
+	//FNV-1a. Unused bits of a partial last byte may be garbage, so they're masked off.
+	size_t bytes = (bits + 7) / 8;
+	size_t n = min(bytes, HASH_MAX_BYTES);
+	uint32_t h = 2166136261u;
+	for(size_t i=0; i<n; i++)
+	{
+		uint8_t b = data[i];
+		if( (i == bytes-1) && (bits % 8) )
+			b &= (1 << (bits % 8)) - 1;
+		h = (h ^ b) * 16777619u;
+	}
+	return h;
+}
+
+/**
+	@brief Adds an operation to the buffer, overwriting the oldest one if it's full
+
+	@param session	ID of the session that did it
+	@param op		What it was
+	@param flags	Flags
+	@param length	Length in bits or clocks
+	@param start	When it started (GetTime()). It's assumed to have just finished.
+	@param txhash	Hash of the write data
+	@param rxhash	Hash of the read data
+ */
+void FlightRecorder::Record(
+	int session,
+	Op op,
+	uint8_t flags,
+	size_t length,
+	double start,
+	uint32_t txhash,
+	uint32_t rxhash)
+{
+	if(!m_capacity)
+		return;
+
+	uint64_t index = m_next ++;
+	auto& e = m_entries[index % m_capacity];
+
+	e.m_seq.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	double now = GetTime();
+	double latency = now - start;
+	e.m_time = (now - m_start) * 1E6;
+	e.m_session = session;
+	e.m_op = op;
+	e.m_flags = flags;
+	e.m_length = min(length, static_cast<size_t>(UINT32_MAX));
+	e.m_latency = min(latency * 1E9, static_cast<double>(UINT32_MAX));
+	e.m_txhash = txhash;
+	e.m_rxhash = rxhash;
+
+	e.m_seq.store(index + 1, memory_order_release);
+}
+
+FlightRecorder::Scope::Scope(
+	FlightRecorder& rec,
+	int session,
+	Op op,
+	size_t length,
+	uint8_t flags,
+	const uint8_t* txdata,
+	const uint8_t* rxdata)
+	: m_rec(rec)
+	, m_session(session)
+	, m_op(op)
+	, m_length(length)
+	, m_flags(flags)
+	, m_rxdata(rxdata)
+	, m_txhash(0)
+	, m_start(0)
+{
+	if(!m_rec.IsEnabled())
+		return;
+
+	if(rxdata)
+		m_flags |= FLAG_READ;
+	m_txhash = Hash(txdata, length);
+	m_start = GetTime();
+}
+
+FlightRecorder::Scope::~Scope()
+{
+	if(!m_rec.IsEnabled())
+		return;
+
+	m_rec.Record(m_session, m_op, m_flags, m_length, m_start, m_txhash, Hash(m_rxdata, m_length));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Dumping
+
+const char* FlightRecorder::GetOpName(Op op)
+{
+	switch(op)
+	{
+		case OP_SHIFT:				return "shift";
+		case OP_SHIFT_WRITE:		return "shift_write";
+		case OP_SHIFT_READ:			return "shift_read";
+		case OP_SHIFT_TMS:			return "shift_tms";
+		case OP_DUMMY_CLOCKS:		return "dummy_clocks";
+		case OP_RESET:				return "reset";
+		case OP_ENTER_SHIFT_IR:		return "enter_shift_ir";
+		case OP_LEAVE_EXIT1_IR:		return "leave_exit1_ir";
+		case OP_ENTER_SHIFT_DR:		return "enter_shift_dr";
+		case OP_LEAVE_EXIT1_DR:		return "leave_exit1_dr";
+		case OP_RESET_TO_IDLE:		return "reset_to_idle";
+		case OP_COMMIT:				return "commit";
+		default:					return "unknown";
+	}
+}
+
+/**
+	@brief Writes everything in the buffer, oldest first, to a new file
+
+	Recording carries on while the dump is written. Entries overwritten in the meantime are skipped.
+
+	@param reason	Why the dump was taken, written at the top of the file
+
+	@return Path of the file, or an empty string if nothing was written
+ */
+string FlightRecorder::Dump(const string& reason)
+{
+	if(!m_capacity)
+		return "";
+
+	char stamp[32];
+	time_t now = time(NULL);
+	tm t;
+	localtime_r(&now, &t);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &t);
+	string path = m_dir + "/jtagd-flight-" + stamp + "-" + to_string(getpid()) + "-" + to_string(m_dumps++) + ".txt";
+
+	FILE* fp = fopen(path.c_str(), "w");
+	if(!fp)
+	{
+		LogError("Couldn't write flight recorder dump to %s\n", path.c_str());
+		return "";
+	}
+
+	uint64_t end = m_next;
+	uint64_t begin = (end > m_capacity) ? (end - m_capacity) : 0;
+	fprintf(fp, "# jtagd flight recorder: %s\n", reason.c_str());
+	fprintf(fp, "# %zu operations recorded, last %zu kept\n", static_cast<size_t>(end), static_cast<size_t>(end - begin));
+	fprintf(fp, "# %-10s %14s %7s %-16s %10s %3s %3s %12s %8s %8s\n",
+		"seq", "time_us", "session", "op", "length", "tms", "rd", "latency_us", "tx_hash", "rx_hash");
+
+	for(uint64_t i=begin; i<end; i++)
+	{
+		auto& e = m_entries[i % m_capacity];
+
+		//Copy the entry, and throw it away if it changed while we were reading it
+		uint64_t seq = e.m_seq.load(memory_order_acquire);
+		Entry copy;
+		copy.m_time = e.m_time;
+		copy.m_session = e.m_session;
+		copy.m_op = e.m_op;
+		copy.m_flags = e.m_flags;
+		copy.m_length = e.m_length;
+		copy.m_latency = e.m_latency;
+		copy.m_txhash = e.m_txhash;
+		copy.m_rxhash = e.m_rxhash;
+		atomic_thread_fence(memory_order_acquire);
+		if( (seq != i+1) || (e.m_seq.load(memory_order_relaxed) != seq) )
+			continue;
+
+		fprintf(fp, "%-12zu %14zu %7d %-16s %10u %3d %3d %12.3f %08x %08x\n",
+			static_cast<size_t>(seq - 1),
+			static_cast<size_t>(copy.m_time),
+			copy.m_session,
+			GetOpName(static_cast<Op>(copy.m_op)),
+			copy.m_length,
+			(copy.m_flags & FLAG_TMS_AT_END) ? 1 : 0,
+			(copy.m_flags & FLAG_READ) ? 1 : 0,
+			copy.m_latency / 1000.0,
+			copy.m_txhash,
+			copy.m_rxhash);
+	}
+
+	fclose(fp);
+	return path;
+}
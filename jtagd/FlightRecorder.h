@@ -0,0 +1,171 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of FlightRecorder
+ */
+
+#ifndef FlightRecorder_h
+#define FlightRecorder_h
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+/**
+	@brief Ring buffer of the most recent adapter operations, for diagnosing failures after the fact
+
+	Every JTAG operation a session does is recorded with its length, flags, how long it took, and hashes of the write
+	and read data. Recording is a counter increment and a few stores into a buffer allocated once at startup, so it
+	can stay on all the time. The buffer is written to a text file when a session fails, on SIGUSR2, or on request
+	through the statistics control socket.
+
+	Entries are claimed with an atomic counter, so any number of threads can record at once. Each entry carries a
+	sequence number that's cleared while it's being written, so a dump taken at the same time just skips entries that
+	are mid-update.
+
+	Data hashes are FNV-1a over at most the first HASH_MAX_BYTES bytes of a scan. They are enough to tell whether two
+	runs sent or got the same data, without making big scans any slower.
+ */
+class FlightRecorder
+{
+public:
+	FlightRecorder();
+
+	enum Op
+	{
+		OP_SHIFT,
+		OP_SHIFT_WRITE,
+		OP_SHIFT_READ,
+		OP_SHIFT_TMS,
+		OP_DUMMY_CLOCKS,
+		OP_RESET,
+		OP_ENTER_SHIFT_IR,
+		OP_LEAVE_EXIT1_IR,
+		OP_ENTER_SHIFT_DR,
+		OP_LEAVE_EXIT1_DR,
+		OP_RESET_TO_IDLE,
+		OP_COMMIT
+	};
+
+	enum Flags
+	{
+		FLAG_TMS_AT_END	= 1,
+		FLAG_READ		= 2
+	};
+
+	///@brief Maximum number of bytes of data hashed per operation
+	static const size_t HASH_MAX_BYTES = 64;
+
+	static const size_t DEFAULT_CAPACITY = 16384;
+
+	void SetCapacity(size_t entries);
+	void SetDirectory(const std::string& dir)
+	{ m_dir = dir; }
+
+	bool IsEnabled()
+	{ return m_capacity != 0; }
+
+	void Record(int session, Op op, uint8_t flags, size_t length, double start, uint32_t txhash, uint32_t rxhash);
+	std::string Dump(const std::string& reason);
+
+	static uint32_t Hash(const uint8_t* data, size_t bits);
+	static const char* GetOpName(Op op);
+
+	/**
+		@brief Records one operation when it goes out of scope (including if it throws)
+	 */
+	class Scope
+	{
+	public:
+		Scope(
+			FlightRecorder& rec,
+			int session,
+			Op op,
+			size_t length,
+			uint8_t flags = 0,
+			const uint8_t* txdata = NULL,
+			const uint8_t* rxdata = NULL);
+		~Scope();
+
+	protected:
+		FlightRecorder& m_rec;
+		int m_session;
+		Op m_op;
+		size_t m_length;
+		uint8_t m_flags;
+		const uint8_t* m_rxdata;
+		uint32_t m_txhash;
+		double m_start;
+	};
+
+protected:
+	class Entry
+	{
+	public:
+		///@brief Index of the entry plus one, or 0 if the entry is empty or being written
+		std::atomic<uint64_t> m_seq;
+
+		///@brief When the operation finished, in us since the recorder was set up
+		uint64_t m_time;
+
+		int32_t m_session;
+		uint8_t m_op;
+		uint8_t m_flags;
+
+		///@brief Length in bits (or clocks)
+		uint32_t m_length;
+
+		///@brief Time the operation took, in ns (saturates at about 4 seconds)
+		uint32_t m_latency;
+
+		uint32_t m_txhash;
+		uint32_t m_rxhash;
+	};
+
+	std::unique_ptr<Entry[]> m_entries;
+	size_t m_capacity;
+
+	///@brief Index of the next entry to write
+	std::atomic<uint64_t> m_next;
+
+	///@brief Time the buffer was set up
+	double m_start;
+
+	///@brief Where dumps are written
+	std::string m_dir;
+
+	///@brief Number of dumps so far, to keep file names unique
+	std::atomic<int> m_dumps;
+};
+
+#endif
@@ -0,0 +1,372 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of GpioEngine
+ */
+#include "jtagd.h"
+#include <time.h>
+
+using namespace std;
+
+const int GpioEngine::MAX_PINS;
+const size_t GpioEngine::RING_SIZE;
+const size_t GpioEngine::BLOCK_SIZE;
+const uint32_t GpioEngine::BLOCK_TIMEOUT;
+
+/**
+	@brief Adds a number of microseconds to a timespec
+ */
+static void AddMicroseconds(timespec& t, uint64_t us)
+{
+	uint64_t ns = t.tv_nsec + (us % 1000000) * 1000;
+	t.tv_sec += us / 1000000 + ns / 1000000000;
+	t.tv_nsec = ns % 1000000000;
+}
+
+/**
+	@brief Gets the signed difference between two timespecs, in microseconds
+ */
+static double DiffMicroseconds(const timespec& a, const timespec& b)
+{
+	return (a.tv_sec - b.tv_sec) * 1E6 + (a.tv_nsec - b.tv_nsec) / 1E3;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+GpioEngine::GpioEngine(TestInterface* iface, GPIOInterface* gface)
+	: m_iface(iface)
+	, m_gface(gface)
+	, m_ringHead(0)
+	, m_ringCount(0)
+	, m_ringFirst(0)
+	, m_sampleIndex(0)
+	, m_overruns(0)
+	, m_overflow(false)
+	, m_sampling(false)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Playback
+
+/**
+	@brief Plays a waveform, blocking until the last step has been applied.
+
+	Throws a JtagException if the steps aren't in time order, touch pins the adapter doesn't have, or there are too many
+	of them or they take too long.
+
+	@param steps		The waveform
+
+	@return How late the latest step was applied, in microseconds
+ */
+double GpioEngine::Play(const vector<Step>& steps)
+{
+	int count = min(m_gface->GetGpioCount(), MAX_PINS);
+	uint32_t valid = (count == 32) ? 0xffffffff : ((1u << count) - 1);
+	if(steps.size() > MAX_STEPS)
+	{
+		throw JtagExceptionWrapper(
+			"Waveform has too many steps",
+			"");
+	}
+	if(!steps.empty() && (steps.back().m_time > MAX_DURATION) )
+	{
+		throw JtagExceptionWrapper(
+			"Waveform is too long",
+			"");
+	}
+	for(size_t i=0; i<steps.size(); i++)
+	{
+		if( (i > 0) && (steps[i].m_time < steps[i-1].m_time) )
+		{
+			throw JtagExceptionWrapper(
+				"Waveform steps must be in time order",
+				"");
+		}
+		if(steps[i].m_mask & ~valid)
+		{
+			throw JtagExceptionWrapper(
+				"Waveform uses pins the adapter doesn't have",
+				"");
+		}
+	}
+
+	//Make sure anything the client sent before the waveform has happened first
+	m_iface->Commit();
+
+	timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	double late = 0;
+	for(auto& s : steps)
+	{
+		timespec deadline = start;
+		AddMicroseconds(deadline, s.m_time);
+		while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL))
+		{}
+
+		for(int i=0; i<count; i++)
+		{
+			if(!(s.m_mask & (1u << i)))
+				continue;
+			m_gface->SetGpioValueDeferred(i, (s.m_values >> i) & 1);
+			m_gface->SetGpioDirectionDeferred(i, (s.m_outputs >> i) & 1);
+		}
+		m_gface->WriteGpioState();
+
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		late = max(late, DiffMicroseconds(now, deadline));
+	}
+
+	return late;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Capture
+
+/**
+	@brief Checks that a capture request is sane, throwing a JtagException if it isn't
+
+	@param period		Time between samples, in microseconds
+	@param nsamples		Number of samples to take
+ */
+void GpioEngine::CheckCapture(uint32_t period, uint64_t nsamples)
+{
+	if(period == 0)
+	{
+		throw JtagExceptionWrapper(
+			"Capture period must be nonzero",
+			"");
+	}
+	if(nsamples > MAX_DURATION / period)
+	{
+		throw JtagExceptionWrapper(
+			"Capture is too long",
+			"");
+	}
+}
+
+/**
+	@brief Samples the pins at a fixed rate and sends the samples to the client as they come in.
+
+	Blocks until all samples have been taken and sent. Throws a JtagException if CheckCapture() rejects the request.
+
+	@param period		Time between samples, in microseconds
+	@param nsamples		Number of samples to take
+	@param mask			Pins to sample. Others read as zero, which keeps them from breaking up runs.
+	@param callback		Called with each block of compressed samples
+
+	@return Number of samples dropped because the ring buffer was full
+ */
+uint64_t GpioEngine::Capture(uint32_t period, uint64_t nsamples, uint32_t mask, BlockCallback callback)
+{
+	CheckCapture(period, nsamples);
+	m_iface->Commit();
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_ring.resize(RING_SIZE);
+		m_ringHead = 0;
+		m_ringCount = 0;
+		m_ringFirst = 0;
+		m_sampleIndex = 0;
+		m_overruns = 0;
+		m_overflow = false;
+		m_sampling = true;
+		m_error = nullptr;
+	}
+	thread sampler(&GpioEngine::SampleThread, this, period, nsamples, mask);
+
+	vector<uint32_t> block;
+	string data;
+	try
+	{
+		while(true)
+		{
+			uint64_t first;
+			{
+				//Wait for a full block, or send whatever we have after a while so the client sees progress
+				unique_lock<mutex> lock(m_mutex);
+				m_ready.wait_for(lock, chrono::microseconds(BLOCK_TIMEOUT),
+					[&]{ return !m_sampling || (m_ringCount >= BLOCK_SIZE); });
+
+				if(m_ringCount == 0)
+				{
+					if(!m_sampling)
+						break;
+					continue;
+				}
+
+				first = m_ringFirst;
+				size_t n = min(m_ringCount, BLOCK_SIZE);
+				size_t tail = (m_ringHead + RING_SIZE - m_ringCount) % RING_SIZE;
+				block.resize(n);
+				for(size_t i=0; i<n; i++)
+					block[i] = m_ring[(tail + i) % RING_SIZE];
+				m_ringCount -= n;
+				m_ringFirst += n;
+			}
+
+			Compress(&block[0], block.size(), data);
+			callback(first, block.size(), data);
+		}
+	}
+	catch(...)
+	{
+		//Stop sampling before passing the error on
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_sampling = false;
+		}
+		sampler.join();
+		throw;
+	}
+
+	sampler.join();
+	if(m_error)
+		rethrow_exception(m_error);
+
+	return m_overruns;
+}
+
+/**
+	@brief Reads the current state of the pins in a mask as a bitmask
+ */
+uint32_t GpioEngine::ReadPins(uint32_t mask)
+{
+	m_gface->ReadGpioState();
+
+	int count = min(m_gface->GetGpioCount(), MAX_PINS);
+	uint32_t ret = 0;
+	for(int i=0; i<count; i++)
+	{
+		if(m_gface->GetGpioValueCached(i))
+			ret |= (1u << i);
+	}
+	return ret & mask;
+}
+
+/**
+	@brief Takes samples at fixed intervals and puts them in the ring buffer
+ */
+void GpioEngine::SampleThread(uint32_t period, uint64_t nsamples, uint32_t mask)
+{
+	try
+	{
+		timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+		for(uint64_t i=0; i<nsamples; i++)
+		{
+			uint32_t sample = ReadPins(mask);
+
+			{
+				lock_guard<mutex> lock(m_mutex);
+				if(!m_sampling)
+					return;
+
+				//Ring full? Drop samples until it has fully drained, so what's in the ring is always contiguous.
+				//Keep counting so the gap shows up in the block indexes.
+				if(m_ringCount == RING_SIZE)
+					m_overflow = true;
+				else if(m_ringCount == 0)
+					m_overflow = false;
+
+				if(m_overflow)
+					m_overruns ++;
+				else
+				{
+					if(m_ringCount == 0)
+						m_ringFirst = m_sampleIndex;
+					m_ring[m_ringHead] = sample;
+					m_ringHead = (m_ringHead + 1) % RING_SIZE;
+					m_ringCount ++;
+				}
+				m_sampleIndex ++;
+
+				if(m_ringCount >= BLOCK_SIZE)
+					m_ready.notify_one();
+			}
+
+			//If the adapter is too slow for the requested rate, sample as fast as we can rather than trying to catch up
+			AddMicroseconds(deadline, period);
+			timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if(DiffMicroseconds(now, deadline) > period)
+				deadline = now;
+			else
+			{
+				while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL))
+				{}
+			}
+		}
+	}
+	catch(...)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_error = current_exception();
+	}
+
+	lock_guard<mutex> lock(m_mutex);
+	m_sampling = false;
+	m_ready.notify_one();
+}
+
+/**
+	@brief Run-length encodes a block of samples
+ */
+void GpioEngine::Compress(const uint32_t* samples, size_t count, string& out)
+{
+	out.clear();
+	size_t i = 0;
+	while(i < count)
+	{
+		uint32_t value = samples[i];
+		size_t run = 1;
+		while( (i + run < count) && (samples[i + run] == value) )
+			run ++;
+		i += run;
+
+		for(int j=0; j<4; j++)
+			out += static_cast<char>(value >> (8*j));
+		do
+		{
+			uint8_t b = run & 0x7f;
+			run >>= 7;
+			if(run)
+				b |= 0x80;
+			out += static_cast<char>(b);
+		} while(run);
+	}
+}
@@ -0,0 +1,147 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of GpioEngine
+ */
+
+#ifndef GpioEngine_h
+#define GpioEngine_h
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+	@brief Timed GPIO waveform playback and sampled capture, run next to the adapter.
+
+	Clients can't get better than network timing by toggling pins one request at a time. Instead they send a whole
+	waveform (or a capture request) and we do the timing locally against CLOCK_MONOTONIC, so accuracy and sample rate
+	are limited only by how fast the adapter can update or read its pins.
+
+	Pin vectors are bitmasks with pin N in bit N, so only the first MAX_PINS pins are reachable.
+
+	Captured samples are stored in a ring buffer by a sampling thread and sent to the client in blocks, so a slow
+	network connection doesn't disturb the sample timing. If the client can't keep up and the ring fills, new samples
+	are dropped (and counted as overruns) until it drains; every block carries the index of its first sample so gaps
+	are visible.
+
+	Playback and capture both hold the adapter, so they're bounded: a waveform may have at most MAX_STEPS steps and end
+	within MAX_DURATION, and a capture must have a nonzero period and finish within MAX_DURATION. Longer runs have to be
+	split across several requests.
+
+	Blocks are run-length encoded, which suits pins that mostly sit still: each run is the 32-bit little-endian pin
+	vector followed by the run length as an unsigned LEB128 varint.
+ */
+class GpioEngine
+{
+public:
+	GpioEngine(TestInterface* iface, GPIOInterface* gface);
+
+	///@brief One step of a waveform
+	struct Step
+	{
+		///@brief Time of the step relative to the start of the waveform, in microseconds
+		uint64_t m_time;
+
+		///@brief Pins changed by this step
+		uint32_t m_mask;
+
+		///@brief New values of the pins in m_mask
+		uint32_t m_values;
+
+		///@brief New directions of the pins in m_mask (1 = output)
+		uint32_t m_outputs;
+	};
+
+	double Play(const std::vector<Step>& steps);
+
+	///@brief Called with each compressed block of samples: first sample index, sample count, RLE data
+	typedef std::function<void(uint64_t first, uint32_t count, const std::string& data)> BlockCallback;
+
+	uint64_t Capture(uint32_t period, uint64_t nsamples, uint32_t mask, BlockCallback callback);
+
+	static void CheckCapture(uint32_t period, uint64_t nsamples);
+
+	static void Compress(const uint32_t* samples, size_t count, std::string& out);
+
+	///@brief Highest pin number that can be played or captured, plus one
+	static const int MAX_PINS = 32;
+
+	///@brief Size of the capture ring buffer, in samples
+	static const size_t RING_SIZE = 256 * 1024;
+
+	///@brief Largest number of samples sent in one block
+	static const size_t BLOCK_SIZE = 8192;
+
+	///@brief Longest a captured sample waits before being sent, in microseconds
+	static const uint32_t BLOCK_TIMEOUT = 50 * 1000;
+
+	///@brief Most steps in one waveform
+	static const size_t MAX_STEPS = 64 * 1024;
+
+	///@brief Longest a waveform or capture may take, in microseconds
+	static const uint64_t MAX_DURATION = 5 * 1000 * 1000;
+
+protected:
+	uint32_t ReadPins(uint32_t mask);
+	void SampleThread(uint32_t period, uint64_t nsamples, uint32_t mask);
+
+	TestInterface* m_iface;
+	GPIOInterface* m_gface;
+
+	//Capture ring buffer, shared between the sampling thread and Capture()
+	std::mutex m_mutex;
+	std::condition_variable m_ready;
+	std::vector<uint32_t> m_ring;
+	size_t m_ringHead;
+	size_t m_ringCount;
+
+	///@brief Index of the oldest sample in the ring
+	uint64_t m_ringFirst;
+
+	///@brief Index of the next sample to be taken
+	uint64_t m_sampleIndex;
+
+	uint64_t m_overruns;
+
+	///@brief True if the ring filled up and we're dropping samples until it's empty
+	bool m_overflow;
+
+	bool m_sampling;
+	std::exception_ptr m_error;
+};
+
+#endif
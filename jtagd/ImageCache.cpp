@@ -0,0 +1,377 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of ImageCache
+ */
+#include "jtagd.h"
+#include <algorithm>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+ImageCache::ImageCache()
+	: m_memUsed(0)
+	, m_memLimit(256 * 1024 * 1024)
+	, m_diskUsed(0)
+	, m_diskLimit(0)
+	, m_hits(0)
+	, m_misses(0)
+	, m_bytesSaved(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Configuration
+
+/**
+	@brief Sets the maximum number of bytes of image data to keep in RAM
+ */
+void ImageCache::SetMemoryLimit(size_t bytes)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_memLimit = bytes;
+	EvictMemory();
+}
+
+/**
+	@brief Enables the on-disk tier of the cache.
+
+	Any images left in the directory by a previous run are indexed (most recently modified first) and immediately
+	available to clients.
+
+	@param dir		Directory to store images in. Created if it doesn't exist.
+	@param bytes	Maximum number of bytes of image data to keep on disk
+ */
+void ImageCache::SetDiskCache(const string& dir, size_t bytes)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	m_diskDir = dir;
+	m_diskLimit = bytes;
+	m_diskLRU.clear();
+	m_diskIndex.clear();
+	m_diskUsed = 0;
+
+	mkdir(dir.c_str(), 0755);
+	DIR* d = opendir(dir.c_str());
+	if(!d)
+	{
+		LogWarning("Couldn't open image cache directory \"%s\", disk cache disabled\n", dir.c_str());
+		m_diskDir = "";
+		return;
+	}
+
+	//Find everything that looks like one of our images
+	vector< pair<time_t, pair<string, size_t> > > found;
+	dirent* ent;
+	while( (ent = readdir(d)) != NULL)
+	{
+		string name = ent->d_name;
+		if(name.length() != Sha256::DIGEST_SIZE*2)
+			continue;
+		bool hex = true;
+		for(auto c : name)
+		{
+			if(!isxdigit(c))
+				hex = false;
+		}
+		if(!hex)
+			continue;
+
+		struct stat st;
+		if(0 != stat((dir + "/" + name).c_str(), &st))
+			continue;
+		if(!S_ISREG(st.st_mode))
+			continue;
+
+		//Convert the hex name back to a binary hash
+		string hash;
+		for(size_t i=0; i<name.length(); i += 2)
+			hash += static_cast<char>(strtol(name.substr(i, 2).c_str(), NULL, 16));
+		found.push_back(make_pair(st.st_mtime, make_pair(hash, st.st_size)));
+	}
+	closedir(d);
+
+	sort(found.begin(), found.end(),
+		[](const pair<time_t, pair<string, size_t> >& a, const pair<time_t, pair<string, size_t> >& b)
+		{ return a.first > b.first; });
+	for(auto& f : found)
+	{
+		m_diskLRU.push_back(f.second);
+		m_diskIndex[f.second.first] = prev(m_diskLRU.end());
+		m_diskUsed += f.second.second;
+	}
+
+	LogVerbose("Image cache: found %zu images (%.2f MB) in %s\n",
+		found.size(), m_diskUsed / 1048576.0, dir.c_str());
+
+	EvictDisk();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cache access
+
+/**
+	@brief Called when a client offers an image hash prior to uploading it.
+
+	This is the point at which hits and misses are counted, since it's where the upload is (or isn't) avoided. An image
+	that's indexed but can't be loaded (e.g. corrupted on disk) counts as a miss, since the client will have to upload it.
+
+	@return The image if we already have it and the client should not upload it, NULL otherwise
+ */
+ImageCache::Image ImageCache::Offer(const string& hash)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	auto img = LookupInternal(hash);
+	if(!img)
+	{
+		m_misses ++;
+		return NULL;
+	}
+
+	m_hits ++;
+	m_bytesSaved += img->size();
+	return img;
+}
+
+/**
+	@brief Gets an image from the cache, loading it from disk if necessary
+
+	@return The image, or NULL if it's not in the cache
+ */
+ImageCache::Image ImageCache::Lookup(const string& hash)
+{
+	lock_guard<mutex> lock(m_mutex);
+	return LookupInternal(hash);
+}
+
+ImageCache::Image ImageCache::LookupInternal(const string& hash)
+{
+	//Easy case: it's in RAM
+	auto mit = m_memIndex.find(hash);
+	if(mit != m_memIndex.end())
+	{
+		auto img = mit->second->second;
+		TouchMemory(hash, img);
+		if(m_diskIndex.find(hash) != m_diskIndex.end())
+			TouchDisk(hash, img->size());
+		return img;
+	}
+
+	//Not on disk either? Give up
+	auto dit = m_diskIndex.find(hash);
+	if(dit == m_diskIndex.end())
+		return NULL;
+
+	//Read it back in
+	size_t size = dit->second->second;
+	string path = GetDiskPath(hash);
+	FILE* fp = fopen(path.c_str(), "rb");
+	string data(size, '\0');
+	bool ok = (fp != NULL) && (size == 0 || 1 == fread(&data[0], size, 1, fp));
+	if(fp)
+		fclose(fp);
+
+	//Don't trust anything that doesn't match its name (truncated write, disk corruption, etc)
+	if(!ok || (Sha256::Hash(data) != hash))
+	{
+		LogWarning("Image cache: discarding corrupted image %s\n", Sha256::ToHex(hash).c_str());
+		unlink(path.c_str());
+		m_diskUsed -= size;
+		m_diskLRU.erase(dit->second);
+		m_diskIndex.erase(dit);
+		return NULL;
+	}
+
+	auto img = make_shared<const string>(move(data));
+	TouchDisk(hash, size);
+	TouchMemory(hash, img);
+	EvictMemory();
+	return img;
+}
+
+/**
+	@brief Adds a newly uploaded image to the cache
+
+	@param hash		SHA-256 the client claims the image has
+	@param data		The image contents. Moved into the cache.
+
+	@return The cached image, or NULL if the data didn't match the hash.
+			Images too large to cache are still returned, so the uploading session can use them, but not retained.
+ */
+ImageCache::Image ImageCache::Insert(const string& hash, string&& data)
+{
+	if(Sha256::Hash(data) != hash)
+		return NULL;
+
+	lock_guard<mutex> lock(m_mutex);
+
+	//Somebody else may have uploaded the same image while we were receiving ours
+	auto existing = LookupInternal(hash);
+	if(existing)
+		return existing;
+
+	auto img = make_shared<const string>(move(data));
+
+	//Write through to disk (via a temporary file, so a crash can't leave a truncated image under the real name)
+	if(!m_diskDir.empty() && (img->size() <= m_diskLimit))
+	{
+		string path = GetDiskPath(hash);
+		string tmppath = path + ".tmp";
+		FILE* fp = fopen(tmppath.c_str(), "wb");
+		if(fp && (img->empty() || 1 == fwrite(img->c_str(), img->size(), 1, fp)) && (0 == fclose(fp)) )
+		{
+			if(0 == rename(tmppath.c_str(), path.c_str()))
+			{
+				TouchDisk(hash, img->size());
+				EvictDisk();
+			}
+		}
+		else
+		{
+			LogWarning("Image cache: failed to write %s\n", tmppath.c_str());
+			unlink(tmppath.c_str());
+		}
+	}
+
+	if(img->size() <= m_memLimit)
+	{
+		TouchMemory(hash, img);
+		EvictMemory();
+	}
+
+	return img;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// LRU bookkeeping (caller must hold m_mutex)
+
+/**
+	@brief Marks an image as most recently used in RAM, adding it if it's not already there
+ */
+void ImageCache::TouchMemory(const string& hash, Image data)
+{
+	auto it = m_memIndex.find(hash);
+	if(it != m_memIndex.end())
+		m_memLRU.splice(m_memLRU.begin(), m_memLRU, it->second);
+	else
+	{
+		m_memLRU.push_front(make_pair(hash, data));
+		m_memIndex[hash] = m_memLRU.begin();
+		m_memUsed += data->size();
+	}
+}
+
+/**
+	@brief Marks an image as most recently used on disk, adding it if it's not already there
+ */
+void ImageCache::TouchDisk(const string& hash, size_t size)
+{
+	auto it = m_diskIndex.find(hash);
+	if(it != m_diskIndex.end())
+		m_diskLRU.splice(m_diskLRU.begin(), m_diskLRU, it->second);
+	else
+	{
+		m_diskLRU.push_front(make_pair(hash, size));
+		m_diskIndex[hash] = m_diskLRU.begin();
+		m_diskUsed += size;
+	}
+}
+
+/**
+	@brief Drops least recently used images from RAM until we're under the limit.
+
+	Sessions still holding a reference to an evicted image can keep using it.
+ */
+void ImageCache::EvictMemory()
+{
+	while( (m_memUsed > m_memLimit) && !m_memLRU.empty() )
+	{
+		auto& victim = m_memLRU.back();
+		m_memUsed -= victim.second->size();
+		m_memIndex.erase(victim.first);
+		m_memLRU.pop_back();
+	}
+}
+
+/**
+	@brief Deletes least recently used images from disk until we're under the limit
+ */
+void ImageCache::EvictDisk()
+{
+	while( (m_diskUsed > m_diskLimit) && !m_diskLRU.empty() )
+	{
+		auto& victim = m_diskLRU.back();
+		unlink(GetDiskPath(victim.first).c_str());
+		m_diskUsed -= victim.second;
+		m_diskIndex.erase(victim.first);
+		m_diskLRU.pop_back();
+	}
+}
+
+string ImageCache::GetDiskPath(const string& hash)
+{
+	return m_diskDir + "/" + Sha256::ToHex(hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Statistics
+
+size_t ImageCache::GetMemoryLimit()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_memLimit;
+}
+
+size_t ImageCache::GetHitCount()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_hits;
+}
+
+size_t ImageCache::GetMissCount()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_misses;
+}
+
+size_t ImageCache::GetBytesSaved()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_bytesSaved;
+}
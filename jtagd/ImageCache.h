@@ -0,0 +1,106 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of ImageCache
+ */
+
+#ifndef ImageCache_h
+#define ImageCache_h
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+	@brief Content-addressed LRU store of scan payloads (typically bitstreams) uploaded by clients
+
+	Images are keyed by the SHA-256 of their contents. Clients offer a hash before uploading and only send the image on
+	a miss; subsequent scans can then reference the cached copy by hash instead of carrying the data over the network.
+
+	Two tiers are kept, each with its own byte limit: an in-memory tier and an optional on-disk tier. Images are
+	written through to disk on insertion so they survive a daemon restart, and reloaded into memory on demand.
+
+	All public methods are thread safe.
+ */
+class ImageCache
+{
+public:
+	ImageCache();
+
+	typedef std::shared_ptr<const std::string> Image;
+
+	void SetMemoryLimit(size_t bytes);
+	void SetDiskCache(const std::string& dir, size_t bytes);
+
+	Image Offer(const std::string& hash);
+	Image Lookup(const std::string& hash);
+	Image Insert(const std::string& hash, std::string&& data);
+
+	size_t GetMemoryLimit();
+	size_t GetHitCount();
+	size_t GetMissCount();
+	size_t GetBytesSaved();
+
+protected:
+	Image LookupInternal(const std::string& hash);
+
+	void TouchMemory(const std::string& hash, Image data);
+	void TouchDisk(const std::string& hash, size_t size);
+	void EvictMemory();
+	void EvictDisk();
+
+	std::string GetDiskPath(const std::string& hash);
+
+	std::mutex m_mutex;
+
+	///@brief In-memory images, most recently used first
+	std::list< std::pair<std::string, Image> > m_memLRU;
+	std::map<std::string, std::list< std::pair<std::string, Image> >::iterator> m_memIndex;
+	size_t m_memUsed;
+	size_t m_memLimit;
+
+	///@brief Images on disk (hash and size), most recently used first
+	std::list< std::pair<std::string, size_t> > m_diskLRU;
+	std::map<std::string, std::list< std::pair<std::string, size_t> >::iterator> m_diskIndex;
+	size_t m_diskUsed;
+	size_t m_diskLimit;
+	std::string m_diskDir;
+
+	//Statistics
+	size_t m_hits;
+	size_t m_misses;
+	size_t m_bytesSaved;
+};
+
+#endif
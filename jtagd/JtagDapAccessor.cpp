@@ -0,0 +1,363 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of JtagDapAccessor
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+static void SetBit(vector<uint8_t>& buf, size_t i, bool value)
+{
+	if(value)
+		buf[i/8] |= (1 << (i%8));
+	else
+		buf[i/8] &= ~(1 << (i%8));
+}
+
+static bool GetBit(const uint8_t* buf, size_t i)
+{
+	return (buf[i/8] >> (i%8)) & 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Creates an accessor for a JTAG-DP
+
+	@param iface		The interface the chain is attached to
+	@param device		Index of the DP in the chain, closest to TDO first
+	@param chain		The devices in the chain
+ */
+JtagDapAccessor::JtagDapAccessor(JtagInterface* iface, size_t device, const vector<ChainCache::Device>& chain)
+	: m_iface(iface)
+	, m_irOffset(0)
+	, m_irLength(0)
+	, m_irTotal(0)
+	, m_drOffset(device)
+	, m_drTotal(chain.size() - 1 + 35)
+	, m_ir(0)
+{
+	if(device >= chain.size())
+	{
+		throw JtagExceptionWrapper(
+			"DAP device index is past the end of the chain",
+			"");
+	}
+
+	for(size_t i=0; i<chain.size(); i++)
+	{
+		if(chain[i].m_irlength == 0)
+		{
+			throw JtagExceptionWrapper(
+				"Can't reach a JTAG-DP through a device with unknown IR length",
+				"");
+		}
+		if(i < device)
+			m_irOffset += chain[i].m_irlength;
+		m_irTotal += chain[i].m_irlength;
+	}
+	m_irLength = chain[device].m_irlength;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Transport
+
+/**
+	@brief Someone else may have used the chain since our last batch, so don't trust the IR (or SELECT)
+ */
+void JtagDapAccessor::Begin()
+{
+	DapAccessor::Begin();
+	m_ir = 0;
+}
+
+void JtagDapAccessor::Commit()
+{
+	m_iface->Commit();
+}
+
+/**
+	@brief Checks the sticky error flags, since JTAG-DP doesn't report faults in the acknowledgement
+ */
+void JtagDapAccessor::CheckErrors()
+{
+	uint32_t status = ReadDP(DP_CTRLSTAT);
+	if(status & (CTRLSTAT_STICKYORUN | CTRLSTAT_STICKYCMP | CTRLSTAT_STICKYERR | CTRLSTAT_WDATAERR))
+	{
+		char err[64];
+		snprintf(err, sizeof(err), "DAP access faulted (CTRL/STAT = %08x)", status);
+		throw JtagExceptionWrapper(err, "");
+	}
+}
+
+/**
+	@brief Clears sticky error flags. On JTAG-DP they're write-one-to-clear bits in CTRL/STAT.
+ */
+void JtagDapAccessor::ClearStickyErrors()
+{
+	uint32_t status = ReadDP(DP_CTRLSTAT);
+	if(status & (CTRLSTAT_STICKYORUN | CTRLSTAT_STICKYCMP | CTRLSTAT_STICKYERR | CTRLSTAT_WDATAERR))
+		WriteDP(DP_CTRLSTAT, status);
+}
+
+uint32_t JtagDapAccessor::ReadDP(uint8_t addr)
+{
+	//The result comes back with the next access, and reading RDBUFF has no side effects
+	Transact(IR_DPACC, addr, true, 0);
+	return Transact(IR_DPACC, DP_RDBUFF, true, 0);
+}
+
+void JtagDapAccessor::WriteDP(uint8_t addr, uint32_t wdata)
+{
+	if(addr == DP_ABORT)
+		Transact(IR_ABORT, 0, false, wdata);
+	else
+		Transact(IR_DPACC, addr, false, wdata);
+}
+
+uint32_t JtagDapAccessor::PostAPRead(uint8_t addr)
+{
+	return Transact(IR_APACC, addr, true, 0);
+}
+
+void JtagDapAccessor::WriteAP(uint8_t addr, uint32_t wdata)
+{
+	Transact(IR_APACC, addr, false, wdata);
+}
+
+/**
+	@brief Loads an instruction into the DP, with every other device in BYPASS
+ */
+void JtagDapAccessor::SetIR(uint8_t ir)
+{
+	if(m_ir == ir)
+		return;
+
+	m_tx.assign( (m_irTotal + 7) / 8, 0xff);
+	for(size_t i=0; i<m_irLength; i++)
+		SetBit(m_tx, m_irOffset + i, (ir >> i) & 1);
+
+	m_iface->EnterShiftIR();
+	m_iface->ShiftData(true, &m_tx[0], NULL, m_irTotal);
+	m_iface->LeaveExit1IR();
+	m_ir = ir;
+}
+
+/**
+	@brief Fills m_tx with a 35-bit DPACC/APACC/ABORT scan: RnW, A[3:2], then data. Devices in BYPASS just pad it out.
+ */
+void JtagDapAccessor::BuildScan(uint8_t addr, bool read, uint32_t wdata)
+{
+	m_tx.assign( (m_drTotal + 7) / 8, 0);
+	SetBit(m_tx, m_drOffset, read);
+	SetBit(m_tx, m_drOffset + 1, (addr >> 2) & 1);
+	SetBit(m_tx, m_drOffset + 2, (addr >> 3) & 1);
+	for(size_t i=0; i<32; i++)
+		SetBit(m_tx, m_drOffset + 3 + i, (wdata >> i) & 1);
+}
+
+/**
+	@brief Gets the acknowledgement out of a captured scan
+ */
+uint8_t JtagDapAccessor::GetAck(const uint8_t* rx)
+{
+	uint8_t ack = 0;
+	for(size_t i=0; i<3; i++)
+		ack |= GetBit(rx, m_drOffset + i) << i;
+	return ack;
+}
+
+/**
+	@brief Gets the read data (from the previous access) out of a captured scan
+ */
+uint32_t JtagDapAccessor::GetData(const uint8_t* rx)
+{
+	uint32_t rdata = 0;
+	for(size_t i=0; i<32; i++)
+		rdata |= static_cast<uint32_t>(GetBit(rx, m_drOffset + 3 + i)) << i;
+	return rdata;
+}
+
+/**
+	@brief Performs one DPACC/APACC/ABORT access, retrying on WAIT
+
+	@return The read data from the previous access
+ */
+uint32_t JtagDapAccessor::Transact(uint8_t ir, uint8_t addr, bool read, uint32_t wdata)
+{
+	SetIR(ir);
+	BuildScan(addr, read, wdata);
+	m_rx.resize(m_tx.size());
+
+	for(unsigned int retries = 0; ; retries ++)
+	{
+		m_iface->EnterShiftDR();
+		m_iface->ShiftData(true, &m_tx[0], &m_rx[0], m_drTotal);
+		m_iface->LeaveExit1DR();
+
+		//ABORT doesn't return anything meaningful
+		if(ir == IR_ABORT)
+			return 0;
+
+		uint8_t ack = GetAck(&m_rx[0]);
+		if(ack == ACK_OK)
+			return GetData(&m_rx[0]);
+		else if(ack != ACK_WAIT)
+		{
+			char err[64];
+			snprintf(err, sizeof(err), "Invalid JTAG-DP acknowledgement %d", ack);
+			throw JtagExceptionWrapper(err, "");
+		}
+		else if(retries >= m_maxRetries)
+		{
+			throw JtagExceptionWrapper(
+				"JTAG-DP access timed out (WAIT)",
+				"");
+		}
+	}
+}
+
+/**
+	@brief Performs a sequence of accesses without waiting for any of them, then checks all of the acknowledgements.
+
+	Reads are deferred with split scans where the adapter supports them, so the whole sequence costs one round trip.
+	Otherwise each scan waits for its read data as usual.
+
+	@param scans	The accesses to perform
+	@param rdata	Read data (from the previous access) captured by each scan that was accepted
+
+	@return Number of scans accepted before the first WAIT, or scans.size() if there wasn't one
+ */
+size_t JtagDapAccessor::RunScans(const vector<Scan>& scans, vector<uint32_t>& rdata)
+{
+	size_t bytes = (m_drTotal + 7) / 8;
+	m_rx.assign(scans.size() * bytes, 0);
+	m_deferred.resize(scans.size());
+
+	for(size_t i=0; i<scans.size(); i++)
+	{
+		auto& scan = scans[i];
+		SetIR(scan.m_ir);
+		BuildScan(scan.m_addr, scan.m_read, scan.m_wdata);
+		m_iface->EnterShiftDR();
+		m_deferred[i] = m_iface->ShiftDataWriteOnly(true, &m_tx[0], &m_rx[i*bytes], m_drTotal);
+		m_iface->LeaveExit1DR();
+	}
+	for(size_t i=0; i<scans.size(); i++)
+	{
+		if(m_deferred[i])
+			m_iface->ShiftDataReadOnly(&m_rx[i*bytes], m_drTotal);
+	}
+
+	rdata.resize(scans.size());
+	for(size_t i=0; i<scans.size(); i++)
+	{
+		uint8_t ack = GetAck(&m_rx[i*bytes]);
+		if(ack == ACK_WAIT)
+			return i;
+		else if(ack != ACK_OK)
+		{
+			char err[64];
+			snprintf(err, sizeof(err), "Invalid JTAG-DP acknowledgement %d", ack);
+			throw JtagExceptionWrapper(err, "");
+		}
+		rdata[i] = GetData(&m_rx[i*bytes]);
+	}
+	return scans.size();
+}
+
+/**
+	@brief Reads a block of memory: TAR, then one queued sequence of a DRW read per word and RDBUFF for the last word
+ */
+void JtagDapAccessor::ReadBlock(uint32_t addr, uint32_t* data, size_t count)
+{
+	size_t done = 0;
+	unsigned int retries = 0;
+	while(done < count)
+	{
+		//TAR is written on its own, so we know it was accepted before anything auto-increments it
+		WriteAP(MEMAP_TAR, addr + done*4);
+
+		m_scans.clear();
+		for(size_t i=done; i<count; i++)
+			m_scans.push_back({IR_APACC, MEMAP_DRW, true, 0});
+		m_scans.push_back({IR_DPACC, DP_RDBUFF, true, 0});
+
+		//Each DRW read's data comes back with the scan after it, so scan i+1 has word i
+		size_t accepted = RunScans(m_scans, m_scanData);
+		size_t words = accepted ? (accepted - 1) : 0;
+		for(size_t i=0; i<words; i++)
+			data[done + i] = m_scanData[i + 1];
+
+		if(words)
+			retries = 0;
+		else if(++retries > m_maxRetries)
+		{
+			throw JtagExceptionWrapper(
+				"JTAG-DP access timed out (WAIT)",
+				"");
+		}
+		done += words;
+	}
+}
+
+/**
+	@brief Writes a block of memory: TAR, then one queued sequence of a DRW write per word.
+
+	The caller reads RDBUFF afterwards, which waits for the last write to complete.
+ */
+void JtagDapAccessor::WriteBlock(uint32_t addr, const uint32_t* data, size_t count)
+{
+	size_t done = 0;
+	unsigned int retries = 0;
+	while(done < count)
+	{
+		WriteAP(MEMAP_TAR, addr + done*4);
+
+		m_scans.clear();
+		for(size_t i=done; i<count; i++)
+			m_scans.push_back({IR_APACC, MEMAP_DRW, false, data[i]});
+
+		size_t words = RunScans(m_scans, m_scanData);
+		if(words)
+			retries = 0;
+		else if(++retries > m_maxRetries)
+		{
+			throw JtagExceptionWrapper(
+				"JTAG-DP access timed out (WAIT)",
+				"");
+		}
+		done += words;
+	}
+}
@@ -0,0 +1,127 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of JtagDapAccessor
+ */
+
+#ifndef JtagDapAccessor_h
+#define JtagDapAccessor_h
+
+/**
+	@brief DAP access through an ARM JTAG-DP somewhere in the scan chain
+
+	Every other device in the chain is kept in BYPASS, using the IR lengths from the chain cache. The DP's IR is only
+	rewritten when switching between DPACC, APACC and ABORT.
+
+	JTAG-DP has no FAULT acknowledgement, so sticky error flags are checked once at the end of each batch instead.
+	They're cleared by writing them back to CTRL/STAT, since the ABORT clear bits only exist on SW-DP.
+
+	Block transfers write TAR as a normal access, then queue the DRW accesses for the rest of the 1 KB block as split
+	scans, so they all go to the adapter before any of the read data (and acknowledgements) come back. If one of them
+	got a WAIT, the block is restarted from the first word that wasn't accepted. Accesses after a WAIT may or may not
+	have been accepted, but they can only have touched words from that one onwards (TAR is known to be right), and the
+	restart rewrites TAR and transfers all of those again.
+ */
+class JtagDapAccessor : public DapAccessor
+{
+public:
+	JtagDapAccessor(JtagInterface* iface, size_t device, const std::vector<ChainCache::Device>& chain);
+
+	virtual void Commit();
+
+	///@brief JTAG-DP instructions
+	enum Instructions
+	{
+		IR_ABORT	= 0x8,
+		IR_DPACC	= 0xa,
+		IR_APACC	= 0xb
+	};
+
+	///@brief JTAG-DP acknowledgements
+	enum Acks
+	{
+		ACK_WAIT	= 0x1,
+		ACK_OK		= 0x2
+	};
+
+protected:
+	virtual void Begin();
+	virtual void CheckErrors();
+	virtual void ClearStickyErrors();
+
+	virtual uint32_t ReadDP(uint8_t addr);
+	virtual void WriteDP(uint8_t addr, uint32_t wdata);
+	virtual uint32_t PostAPRead(uint8_t addr);
+	virtual void WriteAP(uint8_t addr, uint32_t wdata);
+
+	virtual void ReadBlock(uint32_t addr, uint32_t* data, size_t count);
+	virtual void WriteBlock(uint32_t addr, const uint32_t* data, size_t count);
+
+	///@brief One DPACC or APACC scan in a queued sequence
+	struct Scan
+	{
+		uint8_t m_ir;
+		uint8_t m_addr;
+		bool m_read;
+		uint32_t m_wdata;
+	};
+
+	uint32_t Transact(uint8_t ir, uint8_t addr, bool read, uint32_t wdata);
+	size_t RunScans(const std::vector<Scan>& scans, std::vector<uint32_t>& rdata);
+	void SetIR(uint8_t ir);
+	void BuildScan(uint8_t addr, bool read, uint32_t wdata);
+	uint8_t GetAck(const uint8_t* rx);
+	uint32_t GetData(const uint8_t* rx);
+
+	JtagInterface* m_iface;
+
+	///@brief Position of the DP's bits in the chain-wide IR and DR
+	size_t m_irOffset;
+	size_t m_irLength;
+	size_t m_irTotal;
+	size_t m_drOffset;
+	size_t m_drTotal;
+
+	///@brief Instruction currently loaded, or 0 if unknown
+	uint8_t m_ir;
+
+	//Scan buffers, kept around to avoid reallocating for every access
+	std::vector<uint8_t> m_tx;
+	std::vector<uint8_t> m_rx;
+
+	//Queued scans for block transfers, and their results
+	std::vector<Scan> m_scans;
+	std::vector<uint32_t> m_scanData;
+	std::vector<bool> m_deferred;
+};
+
+#endif
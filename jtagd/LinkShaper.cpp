@@ -0,0 +1,194 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of LinkShaper
+ */
+#include "jtagd.h"
+#include <deque>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace std;
+
+///@brief Largest chunk we read from a socket at once
+static const size_t SHAPER_CHUNK_SIZE = 16384;
+
+///@brief How often (in ms) an idle pump checks whether the other direction has hung up
+static const int SHAPER_POLL_MS = 50;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+LinkShaper::LinkShaper(const LinkShape& shape)
+	: m_shape(shape)
+	, m_client(-1)
+	, m_inner(-1)
+	, m_stop(false)
+{
+}
+
+LinkShaper::~LinkShaper()
+{
+	m_stop = true;
+	if(m_upstream.joinable())
+		m_upstream.join();
+	if(m_downstream.joinable())
+		m_downstream.join();
+
+	if(m_client >= 0)
+		close(m_client);
+	if(m_inner >= 0)
+		close(m_inner);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shaping
+
+/**
+	@brief Takes over a client connection and starts shaping its traffic
+
+	@param client	The connection to the client. Owned by the shaper from now on.
+
+	@return The socket the session handler should use instead of the client
+ */
+Socket LinkShaper::Start(Socket&& client)
+{
+	int fds[2];
+	if(0 != socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+	{
+		throw JtagExceptionWrapper(
+			"Failed to create socket pair for link shaping",
+			"");
+	}
+
+	m_client = client.Detach();
+	m_inner = fds[0];
+
+	//Use different jitter streams in each direction
+	m_upstream = thread(&LinkShaper::Pump, this, m_client, m_inner, m_shape.m_seed);
+	m_downstream = thread(&LinkShaper::Pump, this, m_inner, m_client, m_shape.m_seed ^ 0x5a5a5a5a);
+
+	return Socket(fds[1], AF_UNIX);
+}
+
+/**
+	@brief Copies data from one socket to another through the emulated link until either side hangs up
+ */
+void LinkShaper::Pump(int src, int dst, unsigned int seed)
+{
+	struct Chunk
+	{
+		vector<uint8_t> m_data;
+		double m_release;
+	};
+	deque<Chunk> queue;
+
+	mt19937 rng(seed);
+	normal_distribution<double> jitter(0, (m_shape.m_jitter > 0) ? m_shape.m_jitter : 1);
+
+	double linkFree = 0;
+	double lastRelease = 0;
+	bool eof = false;
+	while(!m_stop)
+	{
+		//Hung up and everything delivered? Pass the hangup along
+		if(eof && queue.empty())
+			break;
+
+		//Wait until there's new data or the oldest chunk is due
+		double now = GetTime();
+		int timeout = SHAPER_POLL_MS;
+		if(!queue.empty())
+		{
+			double wait = queue.front().m_release - now;
+			timeout = (wait <= 0) ? 0 : min(SHAPER_POLL_MS, static_cast<int>(wait * 1000) + 1);
+		}
+		pollfd pfd = { src, POLLIN, 0 };
+		int ready = eof ? 0 : poll(&pfd, 1, timeout);
+		if(eof && timeout)
+			usleep(timeout * 1000);
+
+		//Read whatever arrived and work out when it comes out the other end
+		if(ready > 0)
+		{
+			Chunk c;
+			c.m_data.resize(SHAPER_CHUNK_SIZE);
+			ssize_t len = recv(src, &c.m_data[0], SHAPER_CHUNK_SIZE, 0);
+			if(len <= 0)
+				eof = true;
+			else
+			{
+				now = GetTime();
+				c.m_data.resize(len);
+
+				double start = max(linkFree, now);
+				if(m_shape.m_bandwidth > 0)
+					linkFree = start + len / m_shape.m_bandwidth;
+				else
+					linkFree = start;
+
+				double delay = m_shape.m_latency;
+				if(m_shape.m_jitter > 0)
+					delay += max(0.0, jitter(rng));
+
+				c.m_release = max(linkFree + delay, lastRelease);
+				lastRelease = c.m_release;
+				queue.push_back(move(c));
+			}
+		}
+
+		//Deliver everything that's due
+		now = GetTime();
+		while(!queue.empty() && (queue.front().m_release <= now) )
+		{
+			auto& c = queue.front();
+			size_t sent = 0;
+			while(sent < c.m_data.size())
+			{
+				ssize_t len = send(dst, &c.m_data[sent], c.m_data.size() - sent, MSG_NOSIGNAL);
+				if(len <= 0)
+				{
+					m_stop = true;
+					return;
+				}
+				sent += len;
+			}
+			queue.pop_front();
+		}
+	}
+
+	//Let the other side know nothing more is coming.
+	//The session is over once the handler hangs up, but a client that stops sending may still be waiting for replies.
+	shutdown(dst, SHUT_WR);
+	if(src == m_inner)
+		m_stop = true;
+}
@@ -0,0 +1,112 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of LinkShaper
+ */
+
+#ifndef LinkShaper_h
+#define LinkShaper_h
+
+#include <atomic>
+#include <random>
+#include <thread>
+
+/**
+	@brief Settings for an emulated network link
+ */
+class LinkShape
+{
+public:
+	LinkShape()
+		: m_latency(0)
+		, m_jitter(0)
+		, m_bandwidth(0)
+		, m_seed(1)
+	{}
+
+	bool IsEnabled() const
+	{ return (m_latency > 0) || (m_jitter > 0) || (m_bandwidth > 0); }
+
+	///@brief One-way delay added to every chunk of data, in seconds
+	double m_latency;
+
+	///@brief Standard deviation of random extra delay, in seconds
+	double m_jitter;
+
+	///@brief Link rate in each direction, in bytes per second (0 = unlimited)
+	double m_bandwidth;
+
+	///@brief Seed for the jitter generator, so runs are reproducible
+	unsigned int m_seed;
+};
+
+/**
+	@brief Sits between a client socket and the session handler and makes the connection behave like a slow WAN link
+
+	Start() hands back one end of a local socket pair; the session handler talks to that instead of the client. Two
+	pump threads copy data between the pair and the real client, holding each chunk back until it would have arrived
+	over the emulated link:
+
+	\li Every chunk is delayed by the latency plus a random (normally distributed, clamped at zero) jitter sample
+	\li Each direction is a separate pipe of the given bandwidth, so a chunk can't start until the previous one is sent
+	\li Data is never reordered, even if a later chunk draws less jitter
+
+	Delays apply per recv() chunk rather than per protocol message, which is close enough since clients send one
+	request at a time and small messages arrive in one chunk.
+ */
+class LinkShaper
+{
+public:
+	LinkShaper(const LinkShape& shape);
+	virtual ~LinkShaper();
+
+	Socket Start(Socket&& client);
+
+protected:
+	void Pump(int src, int dst, unsigned int seed);
+
+	LinkShape m_shape;
+
+	///@brief Our side of the connection to the client
+	int m_client;
+
+	///@brief Our side of the socket pair connected to the session handler
+	int m_inner;
+
+	///@brief Set when either side hangs up, so the other pump can stop
+	std::atomic<bool> m_stop;
+
+	std::thread m_upstream;
+	std::thread m_downstream;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of MessageArena
+ */
+#include "jtagd.h"
+
+using namespace std;
+using namespace google::protobuf;
+
+const size_t MessageArena::DEFAULT_BLOCK_SIZE;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+MessageArena::MessageArena(size_t blocksize)
+	: m_block(blocksize)
+	, m_arena(GetOptions(m_block))
+	, m_request(NULL)
+	, m_reply(NULL)
+{
+	Reset();
+}
+
+/**
+	@brief Sets up the arena to start in our block, and spill into blocks of the same size
+ */
+ArenaOptions MessageArena::GetOptions(vector<char>& block)
+{
+	ArenaOptions options;
+	options.initial_block = &block[0];
+	options.initial_block_size = block.size();
+	options.start_block_size = block.size();
+	return options;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cycles
+
+/**
+	@brief Gets empty request and reply messages for the next cycle
+ */
+void MessageArena::Reset()
+{
+	//Most cycles don't need to touch the arena at all.
+	//String buffers are kept by Clear() too, so don't hang on to a big one from an unusually large message.
+	size_t limit = m_block.size() / 2;
+	if(m_request &&
+		(m_arena.SpaceUsed() < limit) &&
+		(m_request->ByteSizeLong() + m_reply->ByteSizeLong() < limit) )
+	{
+		m_request->Clear();
+		m_reply->Clear();
+		return;
+	}
+
+	m_arena.Reset();
+	m_request = Arena::CreateMessage<JtaghalPacket>(&m_arena);
+	m_reply = Arena::CreateMessage<JtaghalPacket>(&m_arena);
+}
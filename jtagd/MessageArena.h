@@ -0,0 +1,85 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of MessageArena
+ */
+
+#ifndef MessageArena_h
+#define MessageArena_h
+
+#include <google/protobuf/arena.h>
+#include <vector>
+
+/**
+	@brief Memory for the request and reply messages of one request/reply cycle
+
+	Parsing a request and building its reply on the heap costs a malloc/free pair for every submessage and string
+	field, which shows up in profiles at high op rates. Here both messages live on a protobuf arena whose first block
+	belongs to the session, so a typical small request (state change, short scan) doesn't touch the heap at all.
+
+	Between cycles the messages are just cleared, which keeps their submessages around for the next request of the same
+	type. Clearing never gives memory back to the arena, so once the arena has grown past half of our block it is reset
+	and the messages are recreated. Anything that spilled into extra blocks is freed then.
+
+	Message contents are only valid until the next Reset(). Anything that has to outlive the cycle (a scan chunk queued
+	on the executor, an uploaded image) must be copied or moved out first. Note that Swap() between an arena message and
+	a heap message does a deep copy.
+ */
+class MessageArena
+{
+public:
+	MessageArena(size_t blocksize = DEFAULT_BLOCK_SIZE);
+
+	void Reset();
+
+	JtaghalPacket& GetRequest()
+	{ return *m_request; }
+
+	JtaghalPacket& GetReply()
+	{ return *m_reply; }
+
+	///@brief Size of the block kept across cycles, in bytes
+	static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+protected:
+	static google::protobuf::ArenaOptions GetOptions(std::vector<char>& block);
+
+	///@brief The first block of the arena (must be declared before m_arena)
+	std::vector<char> m_block;
+
+	google::protobuf::Arena m_arena;
+
+	JtaghalPacket* m_request;
+	JtaghalPacket* m_reply;
+};
+
+#endif
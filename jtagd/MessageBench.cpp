@@ -0,0 +1,286 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Microbenchmark for request/reply message handling in jtagd sessions
+
+	Runs a mix of small requests typical of ARM debug (state changes, short IR/DR scans with read back, flushes) through
+	the parse / build reply / serialize part of the session loop. Each pass is done three times: with a fresh heap
+	message for every request and reply (how sessions used to work), with a MessageArena, and with the hot ops sent as
+	fast-path frames. Heap allocations are counted by replacing the global operator new, and bytes on the wire (both
+	directions, including framing) are counted per op.
+
+	Socket IO is left out, so the numbers are an upper bound on what the message handling alone costs.
+ */
+#include "jtagd.h"
+#include <atomic>
+#include <new>
+
+using namespace std;
+
+static atomic<size_t> g_allocs(0);
+
+void* operator new(size_t size)
+{
+	g_allocs ++;
+	void* p = malloc(size ? size : 1);
+	if(!p)
+		throw bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+/**
+	@brief Builds one cycle's worth of serialized requests: select DPACC, one DR access with read back, and a flush
+ */
+static vector<string> MakeRequests()
+{
+	vector<string> wire;
+	JtaghalPacket packet;
+	string buf;
+
+	packet.mutable_staterequest()->set_state(JtagStateChangeRequest::EnterShiftIR);
+	packet.SerializeToString(&buf);
+	wire.push_back(buf);
+
+	auto sr = packet.mutable_scanrequest();
+	sr->set_writedata(string("\x0a", 1));
+	sr->set_totallen(4);
+	sr->set_settmsatend(true);
+	sr->set_readrequested(false);
+	packet.SerializeToString(&buf);
+	wire.push_back(buf);
+
+	packet.mutable_staterequest()->set_state(JtagStateChangeRequest::LeaveExitIR);
+	packet.SerializeToString(&buf);
+	wire.push_back(buf);
+
+	packet.mutable_staterequest()->set_state(JtagStateChangeRequest::EnterShiftDR);
+	packet.SerializeToString(&buf);
+	wire.push_back(buf);
+
+	sr = packet.mutable_scanrequest();
+	sr->set_writedata(string("\x03\x00\x00\x00\x00", 5));
+	sr->set_totallen(35);
+	sr->set_settmsatend(true);
+	sr->set_readrequested(true);
+	packet.SerializeToString(&buf);
+	wire.push_back(buf);
+
+	packet.mutable_staterequest()->set_state(JtagStateChangeRequest::LeaveExitDR);
+	packet.SerializeToString(&buf);
+	wire.push_back(buf);
+
+	packet.mutable_flushrequest();
+	packet.SerializeToString(&buf);
+	wire.push_back(buf);
+
+	return wire;
+}
+
+/**
+	@brief Builds the same cycle as MakeRequests() with the hot ops as fast-path frames (the flush stays protobuf)
+ */
+static vector<string> MakeFastRequests()
+{
+	vector<string> wire;
+
+	auto frame = [&](uint32_t opcode, uint32_t flags, uint32_t length, const string& data)
+	{
+		uint32_t header[2] = { FastFrame::FAST_MAGIC | (flags << 8) | opcode, length };
+		wire.push_back(string(reinterpret_cast<const char*>(header), sizeof(header)) + data);
+	};
+
+	frame(FastFrame::FAST_STATE, 0, JtagStateChangeRequest::EnterShiftIR, "");
+	frame(FastFrame::FAST_SCAN, FastFrame::FLAG_TMS_AT_END, 4, string("\x0a", 1));
+	frame(FastFrame::FAST_STATE, 0, JtagStateChangeRequest::LeaveExitIR, "");
+	frame(FastFrame::FAST_STATE, 0, JtagStateChangeRequest::EnterShiftDR, "");
+	frame(FastFrame::FAST_SCAN, FastFrame::FLAG_TMS_AT_END | FastFrame::FLAG_READ, 35,
+		string("\x03\x00\x00\x00\x00", 5));
+	frame(FastFrame::FAST_STATE, 0, JtagStateChangeRequest::LeaveExitDR, "");
+
+	JtaghalPacket packet;
+	string buf;
+	packet.mutable_flushrequest();
+	packet.SerializeToString(&buf);
+	wire.push_back(buf);
+
+	return wire;
+}
+
+/**
+	@brief Does what the session loop does with a fast frame: parse the header, take the data, build a reply if needed
+
+	@return Size of the reply frame, or 0 if there is none
+ */
+static size_t HandleFast(const string& in, FastFrame& frame)
+{
+	uint32_t header[2];
+	memcpy(header, in.data(), sizeof(header));
+	frame.ParseHeader(header[0], header[1]);
+	size_t size = frame.GetDataSize();
+	memcpy(frame.GetData(), in.data() + sizeof(header), size);
+	if( (frame.GetOpcode() != FastFrame::FAST_SCAN) || !frame.GetReadRequested())
+		return 0;
+
+	//Pretend the read data is the write data
+	uint32_t reply[2] = { FastFrame::FAST_MAGIC | FastFrame::FAST_SCAN_REPLY, frame.GetLength() };
+	uint8_t* rdata = frame.GetReadBuffer();
+	memcpy(rdata - sizeof(reply), reply, sizeof(reply));
+	memcpy(rdata, frame.GetData(), size);
+	return sizeof(reply) + size;
+}
+
+/**
+	@brief Does what the session loop does with a request, minus the adapter: fill in a reply if one is needed
+ */
+static bool Handle(const JtaghalPacket& packet, JtaghalPacket& reply)
+{
+	if(packet.Payload_case() != JtaghalPacket::kScanRequest)
+		return false;
+	auto& req = packet.scanrequest();
+	if(!req.readrequested())
+		return false;
+
+	//Pretend the read data is the write data
+	auto sr = reply.mutable_scanreply();
+	sr->set_readdata(req.writedata());
+	return true;
+}
+
+enum BenchMode
+{
+	MODE_HEAP,
+	MODE_ARENA,
+	MODE_FAST
+};
+
+/**
+	@brief Runs the benchmark one way
+
+	@param wire		Serialized requests to cycle through
+	@param ops		Number of requests to handle
+	@param mode		How requests are parsed and replies built
+ */
+static void Run(const vector<string>& wire, size_t ops, BenchMode mode)
+{
+	MessageArena messages;
+	FastFrame* fast = new FastFrame;
+	string out;
+
+	//Protobuf frames have a 4-byte length in front
+	size_t bytes = 0;
+
+	size_t allocs = g_allocs;
+	double start = GetTime();
+	for(size_t i=0; i<ops; i++)
+	{
+		auto& in = wire[i % wire.size()];
+		out.clear();
+		bool is_fast = (mode == MODE_FAST) && (in.size() >= 4) &&
+			( (*reinterpret_cast<const uint32_t*>(in.data()) & 0xffff0000) == FastFrame::FAST_MAGIC );
+		if(is_fast)
+		{
+			bytes += in.size() + HandleFast(in, *fast);
+			continue;
+		}
+
+		bytes += in.size() + 4;
+		if(mode != MODE_HEAP)
+		{
+			messages.Reset();
+			auto& packet = messages.GetRequest();
+			auto& reply = messages.GetReply();
+			packet.ParseFromString(in);
+			if(Handle(packet, reply))
+				reply.SerializeToString(&out);
+		}
+		else
+		{
+			JtaghalPacket packet;
+			packet.ParseFromString(in);
+			JtaghalPacket reply;
+			if(Handle(packet, reply))
+				reply.SerializeToString(&out);
+		}
+		if(!out.empty())
+			bytes += out.size() + 4;
+	}
+	double dt = GetTime() - start;
+	allocs = g_allocs - allocs;
+	delete fast;
+
+	const char* names[] = { "heap", "arena", "fast" };
+	printf("%-8s %10.0f ops/s   %6.2f allocations/op   %6.2f wire bytes/op\n",
+		names[mode],
+		ops / dt,
+		allocs / static_cast<double>(ops),
+		bytes / static_cast<double>(ops));
+}
+
+int main(int argc, char* argv[])
+{
+	size_t ops = 10000000;
+	for(int i=1; i<argc; i++)
+	{
+		string s(argv[i]);
+		if( (s == "--ops") && (i+1 < argc) )
+			ops = strtoull(argv[++i], NULL, 10);
+		else
+		{
+			printf("Usage: jtagd-msgbench [--ops N]\n");
+			return 1;
+		}
+	}
+
+	auto wire = MakeRequests();
+	auto fastwire = MakeFastRequests();
+
+	//Warm up (first use of each message type allocates descriptors etc)
+	Run(wire, wire.size() * 100, MODE_HEAP);
+	Run(wire, wire.size() * 100, MODE_ARENA);
+	Run(fastwire, fastwire.size() * 100, MODE_FAST);
+	printf("\n");
+
+	Run(wire, ops, MODE_HEAP);
+	Run(wire, ops, MODE_ARENA);
+	Run(fastwire, ops, MODE_FAST);
+	return 0;
+}
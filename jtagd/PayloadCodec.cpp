@@ -0,0 +1,323 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of PayloadCodec
+ */
+#include "jtagd.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+PayloadCodec::PayloadCodec()
+	: m_allowed(0)
+	, m_linkRate(10E6)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Negotiation and link speed
+
+/**
+	@brief Gets a bitmask of codecs this build supports (bit N set means Codec N is supported)
+ */
+uint32_t PayloadCodec::GetSupportedCodecs()
+{
+	uint32_t mask = (1 << CODEC_RLE);
+	#ifdef HAVE_ZLIB
+		mask |= (1 << CODEC_ZLIB);
+	#endif
+	return mask;
+}
+
+/**
+	@brief Updates the link speed estimate after sending a message.
+
+	Once a message is bigger than the socket buffer, sending it takes about as long as the link needs to carry it, so only
+	large sends are counted.
+ */
+void PayloadCodec::RecordSend(size_t bytes, double seconds)
+{
+	if( (bytes < MIN_TIMED_SEND) || (seconds <= 0) )
+		return;
+	m_linkRate = 0.75*m_linkRate + 0.25*(bytes / seconds);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Encoding
+
+/**
+	@brief Compresses a payload with whichever allowed codec should get it across the link fastest
+
+	@param data			The payload
+	@param len			Length of the payload
+	@param out			Compressed data (empty if returning CODEC_NONE)
+
+	@return The codec used
+ */
+PayloadCodec::Codec PayloadCodec::Encode(const uint8_t* data, size_t len, string& out)
+{
+	out.clear();
+	if( (len < MIN_COMPRESS_SIZE) || (m_allowed == 0) )
+		return CODEC_NONE;
+
+	Codec best = CODEC_NONE;
+	double bestcost = len;
+
+	//RLE is effectively free, so just compare sizes
+	string tmp;
+	if(m_allowed & (1 << CODEC_RLE))
+	{
+		EncodeRLE(data, len, tmp);
+		if(tmp.size() < bestcost)
+		{
+			best = CODEC_RLE;
+			bestcost = tmp.size();
+			out.swap(tmp);
+		}
+	}
+
+	//zlib costs CPU time, so count that as the number of bytes the link could have carried in the meantime.
+	//Not worth even trying if the link is faster than we can compress.
+	#ifdef HAVE_ZLIB
+		if( (m_allowed & (1 << CODEC_ZLIB)) && (len >= MIN_ZLIB_SIZE) && (m_linkRate < ZLIB_RATE) )
+		{
+			uLongf zlen = compressBound(len);
+			tmp.resize(zlen);
+			if(Z_OK == compress2(reinterpret_cast<Bytef*>(&tmp[0]), &zlen, data, len, 1))
+			{
+				double cost = zlen + len * m_linkRate / ZLIB_RATE;
+				if(cost < bestcost)
+				{
+					tmp.resize(zlen);
+					best = CODEC_ZLIB;
+					bestcost = cost;
+					out.swap(tmp);
+				}
+			}
+		}
+	#endif
+
+	if(best == CODEC_NONE)
+		out.clear();
+	return best;
+}
+
+/**
+	@brief Decompresses a payload.
+
+	Throws a JtagException if the codec wasn't negotiated or the data is malformed.
+
+	@param codec		Codec the payload was compressed with
+	@param in			Compressed data
+	@param rawlen		Length of the uncompressed payload
+	@param out			Uncompressed data
+ */
+void PayloadCodec::Decode(Codec codec, const string& in, size_t rawlen, string& out)
+{
+	if(rawlen > MAX_RAW_SIZE)
+	{
+		throw JtagExceptionWrapper(
+			"Compressed payload is too large",
+			"");
+	}
+
+	switch(codec)
+	{
+		case CODEC_RLE:
+			DecodeRLE(in, rawlen, out);
+			break;
+
+		#ifdef HAVE_ZLIB
+		case CODEC_ZLIB:
+			{
+				out.resize(rawlen);
+				uLongf zlen = rawlen;
+				if( (Z_OK != uncompress(reinterpret_cast<Bytef*>(&out[0]), &zlen,
+					reinterpret_cast<const Bytef*>(in.c_str()), in.size())) || (zlen != rawlen) )
+				{
+					throw JtagExceptionWrapper(
+						"Malformed zlib payload",
+						"");
+				}
+			}
+			break;
+		#endif
+
+		default:
+			throw JtagExceptionWrapper(
+				"Payload uses an unsupported codec",
+				"");
+	}
+}
+
+/**
+	@brief RLE compresses a payload
+ */
+void PayloadCodec::EncodeRLE(const uint8_t* data, size_t len, string& out)
+{
+	out.clear();
+
+	auto token = [&](size_t count, int type)
+	{
+		uint64_t h = (static_cast<uint64_t>(count) << 2) | type;
+		do
+		{
+			uint8_t b = h & 0x7f;
+			h >>= 7;
+			if(h)
+				b |= 0x80;
+			out += static_cast<char>(b);
+		} while(h);
+	};
+
+	//Start of literal data not yet written out
+	size_t lit = 0;
+	size_t i = 0;
+	while(i < len)
+	{
+		size_t run = 1;
+		while( (i + run < len) && (data[i + run] == data[i]) )
+			run ++;
+
+		//Short runs are cheaper as literals
+		if(run < 4)
+		{
+			i += run;
+			continue;
+		}
+
+		if(i > lit)
+		{
+			token(i - lit, 0);
+			out.append(reinterpret_cast<const char*>(data + lit), i - lit);
+		}
+
+		if(data[i] == 0x00)
+			token(run, 1);
+		else if(data[i] == 0xff)
+			token(run, 2);
+		else
+		{
+			token(run, 3);
+			out += static_cast<char>(data[i]);
+		}
+
+		i += run;
+		lit = i;
+	}
+
+	if(len > lit)
+	{
+		token(len - lit, 0);
+		out.append(reinterpret_cast<const char*>(data + lit), len - lit);
+	}
+}
+
+/**
+	@brief Decompresses an RLE payload, throwing a JtagException if it's malformed or the wrong length
+ */
+void PayloadCodec::DecodeRLE(const string& in, size_t rawlen, string& out)
+{
+	out.clear();
+	out.reserve(rawlen);
+
+	size_t pos = 0;
+	while(pos < in.size())
+	{
+		uint64_t h = 0;
+		for(int shift=0; ; shift += 7)
+		{
+			if( (pos >= in.size()) || (shift > 56) )
+			{
+				throw JtagExceptionWrapper(
+					"Malformed RLE payload",
+					"");
+			}
+			uint8_t b = in[pos++];
+			h |= static_cast<uint64_t>(b & 0x7f) << shift;
+			if(!(b & 0x80))
+				break;
+		}
+
+		uint64_t count = h >> 2;
+		if(count > rawlen - out.size())
+		{
+			throw JtagExceptionWrapper(
+				"RLE payload is longer than expected",
+				"");
+		}
+
+		switch(h & 3)
+		{
+			case 0:
+				if(count > in.size() - pos)
+				{
+					throw JtagExceptionWrapper(
+						"Malformed RLE payload",
+						"");
+				}
+				out.append(in, pos, count);
+				pos += count;
+				break;
+
+			case 1:
+				out.append(count, '\x00');
+				break;
+
+			case 2:
+				out.append(count, '\xff');
+				break;
+
+			case 3:
+				if(pos >= in.size())
+				{
+					throw JtagExceptionWrapper(
+						"Malformed RLE payload",
+						"");
+				}
+				out.append(count, in[pos++]);
+				break;
+		}
+	}
+
+	if(out.size() != rawlen)
+	{
+		throw JtagExceptionWrapper(
+			"RLE payload is shorter than expected",
+			"");
+	}
+}
@@ -0,0 +1,111 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of PayloadCodec
+ */
+
+#ifndef PayloadCodec_h
+#define PayloadCodec_h
+
+#include <stdint.h>
+#include <string>
+
+/**
+	@brief Compression of scan payloads (write data and read data)
+
+	Which codecs may be used is negotiated in the Hello exchange: the server lists what it supports, the client replies
+	with the subset it supports too, and from then on either side may compress any payload with any codec in the set.
+
+	Each payload is compressed with whichever codec is expected to get it across fastest, based on its size and the
+	measured speed of the link. Tiny payloads aren't worth the bother, RLE costs next to nothing so it's used whenever
+	it helps, and zlib is only tried on larger payloads when the link is slow enough to be worth the CPU time.
+
+	RLE is aimed at the long runs of 0x00 and 0xff in erase, blank check and BYPASS padding data. A stream is a series of
+	tokens, each starting with an unsigned LEB128 varint holding (count << 2) | type:
+		\li type 0: count literal bytes follow
+		\li type 1: count bytes of 0x00
+		\li type 2: count bytes of 0xff
+		\li type 3: count copies of the single byte that follows
+ */
+class PayloadCodec
+{
+public:
+	PayloadCodec();
+
+	///@brief Codec IDs, as in the CompressionCodec protocol enum
+	enum Codec
+	{
+		CODEC_NONE	= 0,
+		CODEC_RLE	= 1,
+		CODEC_ZLIB	= 2
+	};
+
+	static uint32_t GetSupportedCodecs();
+
+	void SetAllowedCodecs(uint32_t mask)
+	{ m_allowed = mask & GetSupportedCodecs(); }
+
+	bool IsAllowed(Codec codec)
+	{ return (codec == CODEC_NONE) || (m_allowed & (1 << codec)); }
+
+	Codec Encode(const uint8_t* data, size_t len, std::string& out);
+	static void Decode(Codec codec, const std::string& in, size_t rawlen, std::string& out);
+
+	void RecordSend(size_t bytes, double seconds);
+
+	static void EncodeRLE(const uint8_t* data, size_t len, std::string& out);
+	static void DecodeRLE(const std::string& in, size_t rawlen, std::string& out);
+
+	///@brief Payloads smaller than this are never compressed
+	static const size_t MIN_COMPRESS_SIZE = 64;
+
+	///@brief Payloads smaller than this are never zlib compressed
+	static const size_t MIN_ZLIB_SIZE = 4096;
+
+	///@brief Largest decompressed payload we'll accept
+	static const size_t MAX_RAW_SIZE = 256 * 1024 * 1024;
+
+	///@brief Rough zlib (level 1) compression speed, in bytes per second
+	static constexpr double ZLIB_RATE = 100E6;
+
+	///@brief Sends at least this big are timed to estimate link speed
+	static const size_t MIN_TIMED_SEND = 256 * 1024;
+
+protected:
+	///@brief Bitmask of codecs negotiated for this session
+	uint32_t m_allowed;
+
+	///@brief Estimated link speed in bytes per second (moving average)
+	double m_linkRate;
+};
+
+#endif
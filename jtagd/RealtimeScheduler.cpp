@@ -0,0 +1,242 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of RealtimeScheduler
+ */
+#include "jtagd.h"
+#include <sched.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+const int RealtimeScheduler::MAX_PRIORITY;
+const int RealtimeScheduler::DEFAULT_PRIORITY;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+RealtimeScheduler::RealtimeScheduler()
+	: m_enabled(false)
+	, m_priority(DEFAULT_PRIORITY)
+	, m_warned(false)
+	, m_wakeups(0)
+	, m_totalLatency(0)
+	, m_maxLatency(0)
+{
+	for(auto& b : m_histogram)
+		b = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Configuration
+
+/**
+	@brief Parses a list of cores like "2", "2,3" or "4-7"
+
+	@return False if the list is malformed
+ */
+bool RealtimeScheduler::ParseCpuList(const string& str, vector<int>& cpus)
+{
+	cpus.clear();
+	size_t pos = 0;
+	while(pos < str.length())
+	{
+		size_t end = str.find(',', pos);
+		if(end == string::npos)
+			end = str.length();
+		string item = str.substr(pos, end - pos);
+		pos = end + 1;
+
+		int first;
+		int last;
+		char dummy;
+		if(2 != sscanf(item.c_str(), "%d-%d%c", &first, &last, &dummy))
+		{
+			if(1 != sscanf(item.c_str(), "%d%c", &first, &dummy))
+				return false;
+			last = first;
+		}
+
+		if( (first < 0) || (last < first) || (last >= CPU_SETSIZE) )
+			return false;
+		for(int i=first; i<=last; i++)
+			cpus.push_back(i);
+	}
+
+	return !cpus.empty();
+}
+
+/**
+	@brief Sets the SCHED_FIFO priority of adapter threads, clamped to what we're willing to use
+ */
+void RealtimeScheduler::SetPriority(int priority)
+{
+	if(priority > MAX_PRIORITY)
+	{
+		LogWarning("Real-time priority %d is too high, using %d\n", priority, MAX_PRIORITY);
+		priority = MAX_PRIORITY;
+	}
+
+	//Network threads run one below, so leave room for them
+	if(priority < 2)
+		priority = 2;
+
+	m_priority = priority;
+}
+
+void RealtimeScheduler::SetCpus(Role role, const vector<int>& cpus)
+{
+	if(role == ROLE_ADAPTER)
+		m_adapterCpus = cpus;
+	else
+		m_networkCpus = cpus;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Applying settings
+
+/**
+	@brief Locks all current and future memory so nothing on the hot path can page fault
+
+	Failing to get real-time privileges isn't fatal, we just run with normal scheduling and say so.
+ */
+void RealtimeScheduler::ApplyProcess()
+{
+	if(!m_enabled)
+		return;
+
+	if(0 != mlockall(MCL_CURRENT | MCL_FUTURE))
+	{
+		LogWarning("Couldn't lock memory (%s), pages may still fault on the hot path\n", strerror(errno));
+		LogWarning("    Raise RLIMIT_MEMLOCK or grant CAP_IPC_LOCK\n");
+	}
+	else
+		LogVerbose("Locked all memory\n");
+}
+
+/**
+	@brief Pins the calling thread to its role's cores and switches it to SCHED_FIFO
+ */
+void RealtimeScheduler::ApplyThread(Role role)
+{
+	if(!m_enabled)
+		return;
+
+	auto& cpus = (role == ROLE_ADAPTER) ? m_adapterCpus : m_networkCpus;
+	if(!cpus.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(auto c : cpus)
+			CPU_SET(c, &set);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(err != 0)
+			LogWarning("Couldn't pin thread to cores (%s)\n", strerror(err));
+	}
+
+	sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = (role == ROLE_ADAPTER) ? m_priority : m_priority - 1;
+	int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if( (err != 0) && !m_warned.exchange(true) )
+	{
+		LogWarning("Couldn't switch to SCHED_FIFO (%s), running with normal scheduling\n", strerror(err));
+		LogWarning("    Raise RLIMIT_RTPRIO or grant CAP_SYS_NICE\n");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Statistics
+
+/**
+	@brief Records how long an executor thread took to start running after being woken up
+
+	@param latency	Wakeup latency, in seconds
+ */
+void RealtimeScheduler::RecordWakeup(double latency)
+{
+	if(latency < 0)
+		latency = 0;
+	uint64_t ns = latency * 1E9;
+
+	uint64_t us = ns / 1000;
+	int bucket = 0;
+	while( (us > 0) && (bucket < LATENCY_BUCKETS - 1) )
+	{
+		us >>= 1;
+		bucket ++;
+	}
+	m_histogram[bucket] ++;
+
+	m_wakeups ++;
+	m_totalLatency += ns;
+	uint64_t prev = m_maxLatency;
+	while( (ns > prev) && !m_maxLatency.compare_exchange_weak(prev, ns) )
+	{}
+}
+
+///@brief Mean wakeup latency, in seconds
+double RealtimeScheduler::GetMeanWakeupLatency()
+{
+	size_t n = m_wakeups;
+	if(n == 0)
+		return 0;
+	return m_totalLatency * 1E-9 / n;
+}
+
+///@brief Worst wakeup latency, in seconds
+double RealtimeScheduler::GetMaxWakeupLatency()
+{
+	return m_maxLatency * 1E-9;
+}
+
+/**
+	@brief Gets an upper bound on a percentile of wakeup latency, in seconds
+
+	@param fraction		The percentile (e.g. 0.99)
+ */
+double RealtimeScheduler::GetWakeupLatencyPercentile(double fraction)
+{
+	size_t n = m_wakeups;
+	if(n == 0)
+		return 0;
+
+	size_t target = n * fraction;
+	size_t sum = 0;
+	for(int i=0; i<LATENCY_BUCKETS; i++)
+	{
+		sum += m_histogram[i];
+		if(sum > target)
+			return min( (1ULL << i) * 1E-6, GetMaxWakeupLatency() );
+	}
+	return GetMaxWakeupLatency();
+}
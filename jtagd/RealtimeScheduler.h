@@ -0,0 +1,125 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of RealtimeScheduler
+ */
+
+#ifndef RealtimeScheduler_h
+#define RealtimeScheduler_h
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+	@brief Real-time scheduling for the adapter and network threads, plus wakeup latency statistics
+
+	When enabled, all memory is locked so nothing on the hot path can page fault, and threads are pinned to the
+	configured cores and run under SCHED_FIFO. Adapter executor threads get the configured priority and network
+	threads one less, so a job that's ready to go to the adapter always runs before more requests are parsed.
+
+	The priority is capped at MAX_PRIORITY, below the default priority of threaded IRQ handlers. The USB host
+	controller's interrupt thread has to be able to preempt us or transfer completions would wait behind the thread
+	that's waiting for them.
+
+	Threads inherit their creator's affinity and policy, so applying the network role to the main thread early covers
+	every thread created later (sessions, link shapers, library event threads). Executor threads switch themselves to
+	the adapter role.
+
+	Wakeup latency is measured regardless of whether real-time mode is on, so the two can be compared: it's the time
+	from a job being submitted to an idle executor until the executor thread actually starts running it.
+ */
+class RealtimeScheduler
+{
+public:
+	RealtimeScheduler();
+
+	enum Role
+	{
+		ROLE_ADAPTER,
+		ROLE_NETWORK
+	};
+
+	///@brief Highest priority we'll ask for (threaded IRQ handlers default to 50)
+	static const int MAX_PRIORITY = 49;
+
+	static const int DEFAULT_PRIORITY = 40;
+
+	static bool ParseCpuList(const std::string& str, std::vector<int>& cpus);
+
+	void SetEnabled(bool enabled)
+	{ m_enabled = enabled; }
+
+	bool IsEnabled()
+	{ return m_enabled; }
+
+	void SetPriority(int priority);
+
+	void SetCpus(Role role, const std::vector<int>& cpus);
+
+	void ApplyProcess();
+	void ApplyThread(Role role);
+
+	void RecordWakeup(double latency);
+
+	size_t GetWakeupCount()
+	{ return m_wakeups; }
+
+	double GetMeanWakeupLatency();
+	double GetMaxWakeupLatency();
+	double GetWakeupLatencyPercentile(double fraction);
+
+protected:
+	bool m_enabled;
+
+	///@brief SCHED_FIFO priority of adapter threads
+	int m_priority;
+
+	///@brief Cores to pin adapter and network threads to (empty = don't pin)
+	std::vector<int> m_adapterCpus;
+	std::vector<int> m_networkCpus;
+
+	///@brief True once we've complained about missing privileges, so we only do it once
+	std::atomic<bool> m_warned;
+
+	///@brief Number of buckets in the latency histogram. Bucket i counts wakeups of [2^(i-1), 2^i) us.
+	static const int LATENCY_BUCKETS = 32;
+
+	std::atomic<size_t> m_histogram[LATENCY_BUCKETS];
+	std::atomic<size_t> m_wakeups;
+
+	///@brief Total and worst wakeup latency, in ns
+	std::atomic<uint64_t> m_totalLatency;
+	std::atomic<uint64_t> m_maxLatency;
+};
+
+#endif
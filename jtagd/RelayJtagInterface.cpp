@@ -0,0 +1,253 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of RelayJtagInterface
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Connects to the remote daemon and caches everything about the adapter that won't change
+ */
+RelayJtagInterface::RelayJtagInterface(const string& server, uint16_t port)
+	: m_pendingBits(0)
+	, m_readsInFlight(false)
+	, m_syncs(0)
+	, m_roundTrips(0)
+	, m_coalesced(0)
+{
+	m_remote.Connect(server, port);
+
+	m_name = m_remote.GetName();
+	m_serial = m_remote.GetSerial();
+	m_userid = m_remote.GetUserID();
+	m_freq = m_remote.GetFrequency();
+	m_split = m_remote.IsSplitScanSupported();
+	m_roundTrips += 5;
+}
+
+RelayJtagInterface::~RelayJtagInterface()
+{
+	try
+	{
+		Commit();
+	}
+	catch(const JtagException& ex)
+	{
+		LogWarning("Failed to flush relay on shutdown: %s\n", ex.GetDescription().c_str());
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Adapter information
+
+string RelayJtagInterface::GetName()
+{
+	m_syncs ++;
+	return m_name;
+}
+
+string RelayJtagInterface::GetSerial()
+{
+	m_syncs ++;
+	return m_serial;
+}
+
+string RelayJtagInterface::GetUserID()
+{
+	m_syncs ++;
+	return m_userid;
+}
+
+int RelayJtagInterface::GetFrequency()
+{
+	m_syncs ++;
+	return m_freq;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shifting
+
+void RelayJtagInterface::ShiftData(bool last_tms, const unsigned char* send_data, unsigned char* rcv_data, size_t count)
+{
+	if(count == 0)
+		return;
+
+	//Reads have to go out right away
+	if(rcv_data)
+	{
+		Flush();
+		m_remote.ShiftData(last_tms, send_data, rcv_data, count);
+		m_syncs ++;
+		m_roundTrips ++;
+		m_readsInFlight = false;
+		return;
+	}
+
+	//Append to the pending write. Everything already pending ended with TMS low, so the bits just run together.
+	if(m_pendingBits)
+		m_coalesced ++;
+	size_t bits = m_pendingBits + count;
+	m_pending.resize( (bits + 7) / 8, 0);
+	for(size_t i=0; i<count; i++)
+	{
+		size_t n = m_pendingBits + i;
+		if( (send_data[i/8] >> (i%8)) & 1 )
+			m_pending[n/8] |= (1 << (n%8));
+		else
+			m_pending[n/8] &= ~(1 << (n%8));
+	}
+	m_pendingBits = bits;
+
+	//Once TMS goes high the shift is over, so there's nothing more to merge with
+	if(last_tms || (m_pendingBits >= MAX_PENDING_BITS))
+	{
+		m_remote.ShiftData(last_tms, &m_pending[0], NULL, m_pendingBits);
+		m_pending.clear();
+		m_pendingBits = 0;
+	}
+}
+
+bool RelayJtagInterface::ShiftDataWriteOnly(
+	bool last_tms,
+	const unsigned char* send_data,
+	unsigned char* rcv_data,
+	size_t count)
+{
+	//Remote end can't split scans, so do it the slow way. The read data is valid when we return false.
+	if(!m_split)
+	{
+		ShiftData(last_tms, send_data, rcv_data, count);
+		return false;
+	}
+
+	//Let the remote end queue the read, we'll collect it when the client asks
+	Flush();
+	bool deferred = m_remote.ShiftDataWriteOnly(last_tms, send_data, rcv_data, count);
+	if(deferred)
+		m_readsInFlight = true;
+	else
+	{
+		m_syncs ++;
+		m_roundTrips ++;
+	}
+	return deferred;
+}
+
+bool RelayJtagInterface::ShiftDataReadOnly(unsigned char* rcv_data, size_t count)
+{
+	//Results of earlier split scans arrive back to back, so only the first one costs a round trip
+	m_syncs ++;
+	if(m_readsInFlight)
+		m_roundTrips ++;
+	m_readsInFlight = false;
+	return m_remote.ShiftDataReadOnly(rcv_data, count);
+}
+
+bool RelayJtagInterface::IsSplitScanSupported()
+{
+	return m_split;
+}
+
+void RelayJtagInterface::ShiftTMS(bool tdi, const unsigned char* send_data, size_t count)
+{
+	Flush();
+	m_remote.ShiftTMS(tdi, send_data, count);
+}
+
+void RelayJtagInterface::SendDummyClocks(size_t n)
+{
+	Flush();
+	m_remote.SendDummyClocks(n);
+}
+
+void RelayJtagInterface::Commit()
+{
+	Flush();
+	m_remote.Commit();
+}
+
+/**
+	@brief Forwards any pending write data
+ */
+void RelayJtagInterface::Flush()
+{
+	if(m_pendingBits == 0)
+		return;
+
+	m_remote.ShiftData(false, &m_pending[0], NULL, m_pendingBits);
+	m_pending.clear();
+	m_pendingBits = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// State changes
+
+void RelayJtagInterface::TestLogicReset()
+{
+	Flush();
+	m_remote.TestLogicReset();
+}
+
+void RelayJtagInterface::EnterShiftIR()
+{
+	Flush();
+	m_remote.EnterShiftIR();
+}
+
+void RelayJtagInterface::LeaveExit1IR()
+{
+	Flush();
+	m_remote.LeaveExit1IR();
+}
+
+void RelayJtagInterface::EnterShiftDR()
+{
+	Flush();
+	m_remote.EnterShiftDR();
+}
+
+void RelayJtagInterface::LeaveExit1DR()
+{
+	Flush();
+	m_remote.LeaveExit1DR();
+}
+
+void RelayJtagInterface::ResetToIdle()
+{
+	Flush();
+	m_remote.ResetToIdle();
+}
@@ -0,0 +1,124 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of RelayJtagInterface
+ */
+
+#ifndef RelayJtagInterface_h
+#define RelayJtagInterface_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+	@brief A JTAG "adapter" that forwards everything to another jtagd, for use as a latency-hiding relay.
+
+	Run a relay near the clients (on the same machine or LAN) and point it at the jtagd in the lab. Clients then only pay
+	the WAN round trip time when they actually need data back from the target:
+
+	\li Consecutive write-only shifts are merged into one large scan before being forwarded
+	\li Nothing is forwarded until the target has to be touched, and writes never wait for a reply
+	\li Split scans are passed through, so a client can have many reads in flight and wait for them all at once
+	\li Adapter information (name, serial, frequency) is fetched once and answered locally
+	\li Chain discovery is answered from the relay's own chain cache
+
+	We count every request a client had to wait for (sync points) and every time we had to wait for the remote daemon
+	(round trips); the difference is what the relay saved.
+ */
+class RelayJtagInterface : public JtagInterface
+{
+public:
+	RelayJtagInterface(const std::string& server, uint16_t port);
+	virtual ~RelayJtagInterface();
+
+	//Adapter information
+	virtual std::string GetName();
+	virtual std::string GetSerial();
+	virtual std::string GetUserID();
+	virtual int GetFrequency();
+
+	//Shifting
+	virtual void ShiftData(bool last_tms, const unsigned char* send_data, unsigned char* rcv_data, size_t count);
+	virtual bool ShiftDataWriteOnly(bool last_tms, const unsigned char* send_data, unsigned char* rcv_data, size_t count);
+	virtual bool ShiftDataReadOnly(unsigned char* rcv_data, size_t count);
+	virtual bool IsSplitScanSupported();
+	virtual void ShiftTMS(bool tdi, const unsigned char* send_data, size_t count);
+	virtual void SendDummyClocks(size_t n);
+	virtual void Commit();
+
+	//State changes
+	virtual void TestLogicReset();
+	virtual void EnterShiftIR();
+	virtual void LeaveExit1IR();
+	virtual void EnterShiftDR();
+	virtual void LeaveExit1DR();
+	virtual void ResetToIdle();
+
+	size_t GetSyncCount()
+	{ return m_syncs; }
+
+	size_t GetRoundTripCount()
+	{ return m_roundTrips; }
+
+	size_t GetCoalescedCount()
+	{ return m_coalesced; }
+
+	///@brief Largest write we'll hold back waiting for more to merge with, in bits
+	static const size_t MAX_PENDING_BITS = 8 * 1024 * 1024;
+
+protected:
+	void Flush();
+
+	NetworkedJtagInterface m_remote;
+
+	//Cached adapter information
+	std::string m_name;
+	std::string m_serial;
+	std::string m_userid;
+	int m_freq;
+	bool m_split;
+
+	///@brief Write-only shift data not yet forwarded (all with TMS low on the last bit)
+	std::vector<uint8_t> m_pending;
+	size_t m_pendingBits;
+
+	///@brief True if the last remote operation was a deferred read whose result we haven't collected yet
+	bool m_readsInFlight;
+
+	//Statistics
+	size_t m_syncs;
+	size_t m_roundTrips;
+	size_t m_coalesced;
+};
+
+#endif
@@ -0,0 +1,532 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of ScanProgram
+ */
+#include "jtagd.h"
+#include <algorithm>
+
+using namespace std;
+
+//Parameter byte counts are saturated here when loading, so they can't overflow
+static const uint64_t MAX_COUNTED_PARAMS = 0x7fffffff;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+ScanProgram::ScanProgram()
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Loading
+
+/**
+	@brief Decodes and validates a program.
+
+	Throws a JtagException describing the first problem found if the bytecode is malformed.
+ */
+void ScanProgram::Load(const string& bytecode)
+{
+	m_program.clear();
+	m_data.clear();
+
+	//Indexes of LOOP/POLL instructions we haven't seen the end of yet
+	vector<size_t> blocks;
+
+	//Worst case number of times the body of each open block runs (counting parameter-driven loops as one pass)
+	vector<uint64_t> iterations;
+
+	//Fewest parameter bytes consumed so far by one pass through each open block
+	vector<uint64_t> consumed;
+
+	char err[128];
+	size_t pos = 0;
+	while(pos < bytecode.size())
+	{
+		size_t start = pos;
+		Instruction insn;
+		insn.m_opcode = bytecode[pos++];
+		insn.m_flags = 0;
+		insn.m_arg = 0;
+		insn.m_data = 0;
+		insn.m_target = 0;
+		insn.m_minParams = 0;
+
+		switch(insn.m_opcode)
+		{
+			case OP_END:
+			case OP_COMMIT:
+				break;
+
+			case OP_STATE:
+				insn.m_arg = ReadOperand(bytecode, pos, 1);
+				if(!JtagStateChangeRequest::StateType_IsValid(insn.m_arg))
+				{
+					snprintf(err, sizeof(err), "Invalid chain state %u at offset %zu", insn.m_arg, start);
+					throw JtagExceptionWrapper(err, "");
+				}
+				break;
+
+			case OP_SHIFT:
+			case OP_SHIFTP:
+				insn.m_flags = ReadOperand(bytecode, pos, 1);
+				insn.m_arg = ReadOperand(bytecode, pos, 4);
+				if(insn.m_flags & ~(SHIFT_FLAG_TMS | SHIFT_FLAG_READ | SHIFT_FLAG_CAPTURE))
+				{
+					snprintf(err, sizeof(err), "Invalid shift flags 0x%02x at offset %zu", insn.m_flags, start);
+					throw JtagExceptionWrapper(err, "");
+				}
+				if( (insn.m_arg == 0) || (insn.m_arg > MAX_SHIFT_BITS) )
+				{
+					snprintf(err, sizeof(err), "Invalid shift length %u at offset %zu", insn.m_arg, start);
+					throw JtagExceptionWrapper(err, "");
+				}
+				if(insn.m_opcode == OP_SHIFT)
+					insn.m_data = ReadData(bytecode, pos, insn.m_arg);
+				else if(!consumed.empty())
+					consumed.back() = min<uint64_t>(consumed.back() + (insn.m_arg + 7) / 8, MAX_COUNTED_PARAMS);
+				break;
+
+			case OP_DUMMY:
+				insn.m_arg = ReadOperand(bytecode, pos, 4);
+				break;
+
+			case OP_DELAY:
+				insn.m_arg = ReadOperand(bytecode, pos, 4);
+				if(insn.m_arg > MAX_DELAY_US)
+				{
+					snprintf(err, sizeof(err), "Invalid delay %u at offset %zu", insn.m_arg, start);
+					throw JtagExceptionWrapper(err, "");
+				}
+				break;
+
+			case OP_LOOP:
+			case OP_POLL:
+				insn.m_arg = ReadOperand(bytecode, pos, 4);
+				if( (insn.m_opcode == OP_POLL) && (insn.m_arg == 0) )
+				{
+					snprintf(err, sizeof(err), "POLL at offset %zu must allow at least one iteration", start);
+					throw JtagExceptionWrapper(err, "");
+				}
+				if(blocks.size() >= MAX_NESTING)
+				{
+					snprintf(err, sizeof(err), "Blocks nested too deeply at offset %zu", start);
+					throw JtagExceptionWrapper(err, "");
+				}
+				blocks.push_back(m_program.size());
+				consumed.push_back(0);
+
+				//Parameter-driven loops are checked against the parameter stream when run
+				{
+					uint64_t outer = iterations.empty() ? 1 : iterations.back();
+					iterations.push_back(outer * max(insn.m_arg, 1u));
+				}
+				if(iterations.back() > MAX_ITERATIONS)
+				{
+					snprintf(err, sizeof(err), "Too many loop iterations at offset %zu", start);
+					throw JtagExceptionWrapper(err, "");
+				}
+				break;
+
+			case OP_ENDLOOP:
+			case OP_UNTIL:
+				{
+					uint8_t expected = (insn.m_opcode == OP_ENDLOOP) ? OP_LOOP : OP_POLL;
+					if(blocks.empty() || (m_program[blocks.back()].m_opcode != expected))
+					{
+						snprintf(err, sizeof(err), "Unbalanced %s at offset %zu",
+							(insn.m_opcode == OP_ENDLOOP) ? "ENDLOOP" : "UNTIL", start);
+						throw JtagExceptionWrapper(err, "");
+					}
+					auto& top = m_program[blocks.back()];
+					insn.m_target = blocks.back();
+					top.m_target = m_program.size();
+					top.m_minParams = consumed.back();
+					blocks.pop_back();
+					iterations.pop_back();
+					consumed.pop_back();
+
+					//A POLL body runs at least once, a counted loop's count times, a parameter-driven loop maybe never.
+					//(Saturating only makes us assume parameter-driven loops can run more often, never less.)
+					if(!consumed.empty())
+					{
+						uint64_t body = top.m_minParams;
+						if(top.m_opcode == OP_LOOP)
+							body *= top.m_arg;
+						consumed.back() = min<uint64_t>(consumed.back() + body, MAX_COUNTED_PARAMS);
+					}
+				}
+
+				//Mask and match values follow
+				if(insn.m_opcode == OP_UNTIL)
+				{
+					insn.m_arg = ReadOperand(bytecode, pos, 4);
+					if( (insn.m_arg == 0) || (insn.m_arg > MAX_SHIFT_BITS) )
+					{
+						snprintf(err, sizeof(err), "Invalid compare length %u at offset %zu", insn.m_arg, start);
+						throw JtagExceptionWrapper(err, "");
+					}
+					insn.m_data = ReadData(bytecode, pos, insn.m_arg);
+					ReadData(bytecode, pos, insn.m_arg);
+				}
+				break;
+
+			default:
+				snprintf(err, sizeof(err), "Invalid opcode 0x%02x at offset %zu", insn.m_opcode, start);
+				throw JtagExceptionWrapper(err, "");
+		}
+
+		m_program.push_back(insn);
+		if(insn.m_opcode == OP_END)
+			break;
+	}
+
+	if(!blocks.empty())
+	{
+		throw JtagExceptionWrapper(
+			"Program ended inside a LOOP or POLL block",
+			"");
+	}
+}
+
+/**
+	@brief Reads a little-endian operand from the bytecode
+ */
+uint32_t ScanProgram::ReadOperand(const string& bytecode, size_t& pos, size_t size)
+{
+	if(pos + size > bytecode.size())
+	{
+		throw JtagExceptionWrapper(
+			"Program truncated in the middle of an instruction",
+			"");
+	}
+
+	uint32_t ret = 0;
+	for(size_t i=0; i<size; i++)
+		ret |= static_cast<uint32_t>(static_cast<uint8_t>(bytecode[pos++])) << (8*i);
+	return ret;
+}
+
+/**
+	@brief Copies immediate data for a shift of the given length into the data pool
+
+	@return Offset of the data in m_data
+ */
+size_t ScanProgram::ReadData(const string& bytecode, size_t& pos, uint32_t bits)
+{
+	size_t bytes = (bits + 7) / 8;
+	if(pos + bytes > bytecode.size())
+	{
+		throw JtagExceptionWrapper(
+			"Program truncated in the middle of immediate data",
+			"");
+	}
+
+	size_t off = m_data.size();
+	m_data.append(bytecode, pos, bytes);
+	pos += bytes;
+	return off;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Execution
+
+/**
+	@brief Runs the program once
+
+	@param iface		Interface to run the program on
+	@param params		Parameter stream for SHIFTP instructions and parameter-driven loops
+	@param results		Captured read data
+	@param failpc		Index of the UNTIL instruction that timed out, if the run fails
+
+	@return True on success, false if a POLL block timed out. Malformed input (running out of parameters, etc)
+			throws a JtagException.
+ */
+bool ScanProgram::Run(JtagInterface* iface, const string& params, string& results, size_t& failpc)
+{
+	results.clear();
+	CheckIterations(params.size());
+	double start = GetTime();
+
+	//Position in the parameter stream
+	size_t ppos = 0;
+
+	//Read data from the most recent SHIFT with SHIFT_FLAG_READ
+	string lastread;
+
+	//Remaining iterations for each LOOP/POLL, and where in the parameter stream each loop iteration started
+	vector<uint32_t> remaining(m_program.size(), 0);
+	vector<size_t> loopstart(m_program.size(), 0);
+
+	size_t pc = 0;
+	while(pc < m_program.size())
+	{
+		auto& insn = m_program[pc];
+		switch(insn.m_opcode)
+		{
+			case OP_END:
+				return true;
+
+			case OP_STATE:
+				switch(insn.m_arg)
+				{
+					case JtagStateChangeRequest::TestLogicReset:
+						iface->TestLogicReset();
+						break;
+
+					case JtagStateChangeRequest::EnterShiftIR:
+						iface->EnterShiftIR();
+						break;
+
+					case JtagStateChangeRequest::LeaveExitIR:
+						iface->LeaveExit1IR();
+						break;
+
+					case JtagStateChangeRequest::EnterShiftDR:
+						iface->EnterShiftDR();
+						break;
+
+					case JtagStateChangeRequest::LeaveExitDR:
+						iface->LeaveExit1DR();
+						break;
+
+					case JtagStateChangeRequest::ResetToIdle:
+						iface->ResetToIdle();
+						break;
+
+					default:
+						break;
+				}
+				break;
+
+			case OP_SHIFT:
+			case OP_SHIFTP:
+				{
+					size_t bytes = (insn.m_arg + 7) / 8;
+
+					const uint8_t* txdata;
+					if(insn.m_opcode == OP_SHIFT)
+						txdata = reinterpret_cast<const uint8_t*>(m_data.c_str()) + insn.m_data;
+					else
+					{
+						if(ppos + bytes > params.size())
+						{
+							throw JtagExceptionWrapper(
+								"Program ran out of parameters",
+								"");
+						}
+						txdata = reinterpret_cast<const uint8_t*>(params.c_str()) + ppos;
+						ppos += bytes;
+					}
+
+					uint8_t* rxdata = NULL;
+					if(insn.m_flags & (SHIFT_FLAG_READ | SHIFT_FLAG_CAPTURE))
+					{
+						lastread.resize(bytes);
+						rxdata = reinterpret_cast<uint8_t*>(&lastread[0]);
+					}
+
+					iface->ShiftData(insn.m_flags & SHIFT_FLAG_TMS, txdata, rxdata, insn.m_arg);
+
+					if(insn.m_flags & SHIFT_FLAG_CAPTURE)
+					{
+						if(results.size() + bytes > MAX_RESULT_SIZE)
+						{
+							throw JtagExceptionWrapper(
+								"Program captured too much data",
+								"");
+						}
+						results += lastread;
+					}
+				}
+				break;
+
+			case OP_DUMMY:
+				iface->SendDummyClocks(insn.m_arg);
+				break;
+
+			case OP_LOOP:
+				//Parameter-driven loop with nothing left to do? Skip it entirely
+				if( (insn.m_arg == 0) && (ppos >= params.size()) )
+				{
+					pc = insn.m_target + 1;
+					continue;
+				}
+				remaining[pc] = insn.m_arg;
+				loopstart[pc] = ppos;
+				break;
+
+			case OP_ENDLOOP:
+				{
+					size_t top = insn.m_target;
+					if(m_program[top].m_arg == 0)
+					{
+						//A parameter-driven loop that doesn't consume parameters would never terminate
+						if(ppos == loopstart[top])
+						{
+							throw JtagExceptionWrapper(
+								"Parameter-driven loop didn't consume any parameters",
+								"");
+						}
+						if(ppos < params.size())
+						{
+							CheckRunTime(start);
+							loopstart[top] = ppos;
+							pc = top + 1;
+							continue;
+						}
+					}
+					else if(--remaining[top] > 0)
+					{
+						CheckRunTime(start);
+						pc = top + 1;
+						continue;
+					}
+				}
+				break;
+
+			case OP_POLL:
+				remaining[pc] = insn.m_arg;
+				break;
+
+			case OP_UNTIL:
+				{
+					size_t bytes = (insn.m_arg + 7) / 8;
+					if(lastread.size() < bytes)
+					{
+						throw JtagExceptionWrapper(
+							"UNTIL compares more bits than the last shift read",
+							"");
+					}
+
+					auto mask = reinterpret_cast<const uint8_t*>(m_data.c_str()) + insn.m_data;
+					auto match = mask + bytes;
+					bool ok = true;
+					for(size_t i=0; i<bytes; i++)
+					{
+						if( (lastread[i] & mask[i]) != (match[i] & mask[i]) )
+						{
+							ok = false;
+							break;
+						}
+					}
+
+					if(!ok)
+					{
+						size_t top = insn.m_target;
+						if(--remaining[top] == 0)
+						{
+							failpc = pc;
+							return false;
+						}
+						CheckRunTime(start);
+						pc = top + 1;
+						continue;
+					}
+				}
+				break;
+
+			case OP_COMMIT:
+				iface->Commit();
+				break;
+
+			case OP_DELAY:
+				iface->Commit();
+				usleep(insn.m_arg);
+				CheckRunTime(start);
+				break;
+		}
+
+		pc ++;
+	}
+
+	return true;
+}
+
+/**
+	@brief Makes sure the program can't run its innermost loop body more than MAX_ITERATIONS times
+
+	Counted blocks were checked when the program was loaded. Each parameter-driven loop can run at most once per
+	MAX(1, m_minParams) bytes of the parameter stream, so now that we know how long it is, check the whole thing again.
+
+	@param params	Size of the parameter stream, in bytes
+ */
+void ScanProgram::CheckIterations(size_t params)
+{
+	vector<uint64_t> iterations;
+	for(auto& insn : m_program)
+	{
+		switch(insn.m_opcode)
+		{
+			case OP_LOOP:
+			case OP_POLL:
+				{
+					uint64_t count = insn.m_arg;
+					if( (insn.m_opcode == OP_LOOP) && (count == 0) )
+						count = max<uint64_t>(1, params / max<uint64_t>(1, insn.m_minParams));
+					count = min<uint64_t>(count, MAX_ITERATIONS + 1);
+
+					uint64_t outer = iterations.empty() ? 1 : iterations.back();
+					iterations.push_back(min<uint64_t>(outer * count, MAX_ITERATIONS + 1));
+					if(iterations.back() > MAX_ITERATIONS)
+					{
+						throw JtagExceptionWrapper(
+							"Program would run too many loop iterations for this parameter stream",
+							"");
+					}
+				}
+				break;
+
+			case OP_ENDLOOP:
+			case OP_UNTIL:
+				iterations.pop_back();
+				break;
+
+			default:
+				break;
+		}
+	}
+}
+
+/**
+	@brief Stops a run that has held the adapter for longer than MAX_RUN_TIME
+ */
+void ScanProgram::CheckRunTime(double start)
+{
+	if(GetTime() - start > MAX_RUN_TIME)
+	{
+		throw JtagExceptionWrapper(
+			"Program ran for too long",
+			"");
+	}
+}
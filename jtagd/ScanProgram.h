@@ -0,0 +1,156 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of ScanProgram
+ */
+
+#ifndef ScanProgram_h
+#define ScanProgram_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+	@brief A compiled sequence of scan operations uploaded by a client and interpreted next to the adapter.
+
+	Programs let a client run a fixed scan sequence (flash page writes, memory fills, register sweeps) many times
+	while only streaming the data that changes. The client uploads the bytecode once, then sends a parameter stream
+	for each run and gets back only the captured read data.
+
+	Bytecode is a sequence of instructions, each an opcode byte followed by little-endian operands:
+
+	\li END								Stop execution (optional, implied at end of program)
+	\li STATE state:u8					Chain state change, values as in JtagStateChangeRequest
+	\li SHIFT flags:u8 bits:u32 data	Shift immediate data (ceil(bits/8) bytes follow)
+	\li SHIFTP flags:u8 bits:u32		Shift the next ceil(bits/8) bytes of the parameter stream
+	\li DUMMY clocks:u32				Send dummy clocks
+	\li LOOP count:u32					Repeat the body up to the matching ENDLOOP count times.
+										A count of zero repeats until the parameter stream is exhausted (each
+										iteration must consume parameters, so the stream bounds it).
+	\li ENDLOOP
+	\li POLL maxiter:u32				Start of a polling block, ended by UNTIL
+	\li UNTIL bits:u32 mask match		Compare the last read data against match under mask (ceil(bits/8) bytes each)
+										and repeat the POLL block if it doesn't match. Fails after maxiter tries.
+	\li COMMIT							Flush the adapter's queue
+	\li DELAY us:u32					Wait for a fixed time (after committing), at most MAX_DELAY_US
+
+	Shift flags: SHIFT_FLAG_TMS leaves the shift state on the last bit, SHIFT_FLAG_READ stores the read data for a
+	following UNTIL, SHIFT_FLAG_CAPTURE additionally appends it to the results returned to the client.
+
+	Programs are fully validated when loaded, so the interpreter never has to bounds check the bytecode.
+
+	A run holds the adapter, so it's bounded two ways. Nested LOOP and POLL blocks may not run their innermost body more
+	than MAX_ITERATIONS times. Counted blocks are checked when the program is loaded, and parameter-driven loops when it's
+	run, counting each one as many iterations as the parameter stream could feed it. A run that takes longer than
+	MAX_RUN_TIME (delays included) is stopped with an error; longer sequences have to be split across several runs.
+ */
+class ScanProgram
+{
+public:
+	ScanProgram();
+
+	enum Opcodes
+	{
+		OP_END		= 0x00,
+		OP_STATE	= 0x01,
+		OP_SHIFT	= 0x02,
+		OP_SHIFTP	= 0x03,
+		OP_DUMMY	= 0x04,
+		OP_LOOP		= 0x05,
+		OP_ENDLOOP	= 0x06,
+		OP_POLL		= 0x07,
+		OP_UNTIL	= 0x08,
+		OP_COMMIT	= 0x09,
+		OP_DELAY	= 0x0a
+	};
+
+	enum ShiftFlags
+	{
+		SHIFT_FLAG_TMS		= 0x01,
+		SHIFT_FLAG_READ		= 0x02,
+		SHIFT_FLAG_CAPTURE	= 0x04
+	};
+
+	void Load(const std::string& bytecode);
+	bool Run(JtagInterface* iface, const std::string& params, std::string& results, size_t& failpc);
+
+	///@brief Maximum length of a single shift, in bits
+	static const uint32_t MAX_SHIFT_BITS = 1024 * 1024 * 8;
+
+	///@brief Maximum nesting depth of LOOP and POLL blocks
+	static const size_t MAX_NESTING = 8;
+
+	///@brief Maximum number of times the innermost body of nested LOOP and POLL blocks may run
+	static const uint64_t MAX_ITERATIONS = 16 * 1024 * 1024;
+
+	///@brief Maximum DELAY, in microseconds (usleep() doesn't accept a second or more)
+	static const uint32_t MAX_DELAY_US = 999999;
+
+	///@brief Maximum time a single run may take, in seconds
+	static constexpr double MAX_RUN_TIME = 5;
+
+	///@brief Maximum number of bytes of results a single run may capture
+	static const size_t MAX_RESULT_SIZE = 64 * 1024 * 1024;
+
+protected:
+	uint32_t ReadOperand(const std::string& bytecode, size_t& pos, size_t size);
+	size_t ReadData(const std::string& bytecode, size_t& pos, uint32_t bits);
+	void CheckIterations(size_t params);
+	void CheckRunTime(double start);
+
+	///@brief A decoded instruction
+	struct Instruction
+	{
+		uint8_t m_opcode;
+		uint8_t m_flags;
+
+		///@brief Count, bit length, state, or delay depending on opcode
+		uint32_t m_arg;
+
+		///@brief Offset of immediate data in m_data
+		size_t m_data;
+
+		///@brief For LOOP/POLL the index of the matching ENDLOOP/UNTIL, and vice versa
+		size_t m_target;
+
+		///@brief For LOOP/POLL the fewest parameter bytes one pass through the body consumes
+		uint64_t m_minParams;
+	};
+
+	std::vector<Instruction> m_program;
+
+	///@brief Pool of immediate data (shift data, masks, match values)
+	std::string m_data;
+};
+
+#endif
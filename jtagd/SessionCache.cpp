@@ -0,0 +1,139 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of SessionCache
+ */
+#include "jtagd.h"
+#include <random>
+
+using namespace std;
+
+constexpr double SessionCache::DEFAULT_LIFETIME;
+const size_t SessionCache::MAX_SESSIONS;
+const size_t SessionCache::TOKEN_SIZE;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+SessionCache::SessionCache()
+	: m_lifetime(DEFAULT_LIFETIME)
+	, m_resumes(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Saving and restoring
+
+/**
+	@brief Makes a new random token. Anyone holding it can take over the session's reservation, so it has to be
+	unguessable rather than just unique.
+ */
+string SessionCache::NewToken()
+{
+	random_device rng;
+	string token;
+	while(token.size() < TOKEN_SIZE)
+	{
+		uint32_t r = rng();
+		token.append(reinterpret_cast<const char*>(&r), min(sizeof(r), TOKEN_SIZE - token.size()));
+	}
+	return token;
+}
+
+/**
+	@brief Saves the state of a session that has just ended
+ */
+void SessionCache::Save(const string& token, State&& state)
+{
+	if(!IsEnabled() || token.empty())
+		return;
+
+	lock_guard<mutex> lock(m_mutex);
+	double now = GetTime();
+	Expire(now);
+
+	//Make room by dropping whatever would expire first
+	while(m_entries.size() >= MAX_SESSIONS)
+	{
+		auto oldest = m_entries.begin();
+		for(auto it = m_entries.begin(); it != m_entries.end(); ++it)
+		{
+			if(it->second.m_expiry < oldest->second.m_expiry)
+				oldest = it;
+		}
+		m_entries.erase(oldest);
+	}
+
+	auto& e = m_entries[token];
+	e.m_state = move(state);
+	e.m_expiry = now + m_lifetime;
+}
+
+/**
+	@brief Gets the saved state of a session, and forgets it
+
+	@return False if the token is unknown or has expired
+ */
+bool SessionCache::Take(const string& token, State& state)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Expire(GetTime());
+
+	auto it = m_entries.find(token);
+	if(it == m_entries.end())
+		return false;
+
+	state = move(it->second.m_state);
+	m_entries.erase(it);
+	m_resumes ++;
+	return true;
+}
+
+/**
+	@brief Drops saved state that nobody came back for
+ */
+void SessionCache::Expire(double now)
+{
+	for(auto it = m_entries.begin(); it != m_entries.end(); )
+	{
+		if(it->second.m_expiry < now)
+			it = m_entries.erase(it);
+		else
+			++it;
+	}
+}
+
+size_t SessionCache::GetResumeCount()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_resumes;
+}
@@ -0,0 +1,125 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of SessionCache
+ */
+
+#ifndef SessionCache_h
+#define SessionCache_h
+
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+	@brief State of recently ended sessions, kept so a client that reconnects can carry on where it left off
+
+	Every session is given a random token in the server hello. When the session ends cleanly (the client disconnects or
+	just closes the socket between requests) its state is saved here under that token for a while. A client that sends
+	the token back in its own hello gets the state back, along with the chain layout (if it's still cached) so it can
+	skip chain discovery entirely. Short-lived scripted tools can then start with one round trip instead of several.
+
+	Tokens are single use. Saved state is dropped once it has been unused for the lifetime, and the oldest state is
+	dropped first if more than MAX_SESSIONS are saved.
+ */
+class SessionCache
+{
+public:
+	SessionCache();
+
+	///@brief Everything about a session that outlives the TCP connection
+	struct State
+	{
+		State()
+			: m_first(0)
+			, m_count(0)
+			, m_weight(ChainArbiter::DEFAULT_WEIGHT)
+		{}
+
+		//Reserved devices and the instructions last loaded into them
+		size_t m_first;
+		size_t m_count;
+		std::vector< std::vector<bool> > m_desired;
+
+		///@brief Share of the adapter
+		unsigned int m_weight;
+
+		///@brief Uploaded scan programs
+		std::map<uint32_t, ScanProgram> m_programs;
+
+		///@brief Cached images the session offered or uploaded
+		std::map<std::string, ImageCache::Image> m_images;
+	};
+
+	static std::string NewToken();
+
+	void Save(const std::string& token, State&& state);
+	bool Take(const std::string& token, State& state);
+
+	///@brief Sets how long saved state is kept, in seconds (0 to not keep any)
+	void SetLifetime(double seconds)
+	{ m_lifetime = seconds; }
+
+	bool IsEnabled()
+	{ return m_lifetime > 0; }
+
+	size_t GetResumeCount();
+
+	///@brief Default lifetime of saved state, in seconds
+	static constexpr double DEFAULT_LIFETIME = 60;
+
+	///@brief Largest number of sessions we keep state for
+	static const size_t MAX_SESSIONS = 256;
+
+	///@brief Length of a token, in bytes
+	static const size_t TOKEN_SIZE = 16;
+
+protected:
+	void Expire(double now);
+
+	struct Entry
+	{
+		State m_state;
+		double m_expiry;
+	};
+
+	std::mutex m_mutex;
+	std::map<std::string, Entry> m_entries;
+	double m_lifetime;
+
+	///@brief Number of sessions resumed so far
+	size_t m_resumes;
+};
+
+#endif
@@ -0,0 +1,663 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of SessionJtagInterface
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+static bool GetBit(const unsigned char* buf, size_t i)
+{
+	return (buf[i/8] >> (i%8)) & 1;
+}
+
+static void SetBit(unsigned char* buf, size_t i, bool value)
+{
+	if(value)
+		buf[i/8] |= (1 << (i%8));
+	else
+		buf[i/8] &= ~(1 << (i%8));
+}
+
+static bool IsBypass(const ChainArbiter::DeviceState& state)
+{
+	if(state.m_state != ChainArbiter::DeviceState::IR_SET)
+		return false;
+	for(auto b : state.m_ir)
+	{
+		if(!b)
+			return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+SessionJtagInterface::SessionJtagInterface(JtagInterface* iface, ChainArbiter& arbiter, int id)
+	: m_iface(iface)
+	, m_arbiter(arbiter)
+	, m_id(id)
+	, m_state(TAP_IDLE)
+	, m_first(0)
+	, m_count(0)
+	, m_prefix(0)
+	, m_prefixOnes(false)
+{
+}
+
+SessionJtagInterface::~SessionJtagInterface()
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reservations
+
+/**
+	@brief Reserves a range of devices, or gives up the reservation if count is zero. Must own the adapter.
+
+	@param first		Index of the first device (closest to TDO)
+	@param count		Number of devices
+	@param error		Why the reservation failed
+
+	@return True on success
+ */
+bool SessionJtagInterface::Reserve(size_t first, size_t count, string& error)
+{
+	if(!IsIdle())
+	{
+		error = "Can't change reservations in the middle of a scan";
+		return false;
+	}
+
+	vector<ChainCache::Device> chain;
+	vector<ChainCache::Phase> phases;
+	g_chainCache.GetChain(m_iface, false, chain, phases);
+	m_arbiter.GetDeviceStates(chain.size());
+	m_arbiter.ResetDeviceStates();
+
+	//Padding other devices' IRs needs every IR length
+	if(count)
+	{
+		for(auto& d : chain)
+		{
+			if(d.m_irlength == 0)
+			{
+				error = "Can't reserve devices on a chain with unknown IR lengths";
+				return false;
+			}
+		}
+	}
+
+	if(!m_arbiter.Reserve(m_id, first, count, chain.size(), error))
+		return false;
+
+	m_chain = chain;
+	m_first = first;
+	m_count = count;
+	m_desired.clear();
+	m_desired.resize(count);
+	return true;
+}
+
+/**
+	@brief Picks up the reservation of an earlier session that has been resumed (see SessionCache)
+
+	Unlike Reserve() this doesn't touch the chain. The layout comes straight from the cache, and the device states are
+	left alone, so whatever the earlier session loaded is still in place (or is put back by SyncIR() if another session
+	changed it in the meantime).
+
+	@param first	First reserved device
+	@param count	Number of reserved devices, or 0 for none
+	@param desired	The instructions the earlier session last loaded
+	@param devices	The chain as the session sees it, or empty if it isn't cached any more
+	@param error	Why the reservation couldn't be restored
+
+	@return False if there was a reservation and it couldn't be restored (the chain isn't cached any more, or someone
+			else has reserved the devices since)
+ */
+bool SessionJtagInterface::Restore(
+	size_t first,
+	size_t count,
+	const vector< vector<bool> >& desired,
+	vector<ChainCache::Device>& devices,
+	string& error)
+{
+	vector<ChainCache::Device> chain;
+	devices.clear();
+	if(!g_chainCache.Peek(chain))
+	{
+		if(!count)
+			return true;
+		error = "Scan chain is no longer cached";
+		return false;
+	}
+
+	if(count)
+	{
+		if( (first + count > chain.size()) || (desired.size() != count) )
+		{
+			error = "Scan chain changed since the session was saved";
+			return false;
+		}
+		if(!m_arbiter.Reserve(m_id, first, count, chain.size(), error))
+			return false;
+	}
+
+	m_chain = chain;
+	m_first = first;
+	m_count = count;
+	m_desired = desired;
+
+	if(count)
+		devices = vector<ChainCache::Device>(chain.begin() + first, chain.begin() + first + count);
+	else
+		devices = chain;
+	return true;
+}
+
+/**
+	@brief Gets the chain as the session sees it: the whole chain, or only the reserved devices
+
+	@return True if the layout came from the cache
+ */
+bool SessionJtagInterface::GetChain(bool rescan, vector<ChainCache::Device>& devices, vector<ChainCache::Phase>& phases)
+{
+	//Discovery and validation both start with a Test-Logic-Reset
+	bool cached = g_chainCache.GetChain(m_iface, rescan, devices, phases);
+	m_arbiter.GetDeviceStates(devices.size());
+	m_arbiter.ResetDeviceStates();
+
+	if(IsReserved())
+	{
+		if(devices.size() != m_chain.size())
+		{
+			throw JtagExceptionWrapper(
+				"Scan chain changed while devices were reserved",
+				"");
+		}
+		m_chain = devices;
+		devices = vector<ChainCache::Device>(m_chain.begin() + m_first, m_chain.begin() + m_first + m_count);
+	}
+
+	return cached;
+}
+
+/**
+	@brief Puts the TAP back somewhere other sessions can use it, for sessions that end mid-scan
+ */
+void SessionJtagInterface::Abandon()
+{
+	RealReset();
+	m_state = TAP_IDLE;
+}
+
+/**
+	@brief Switches to a reconnected adapter (see AdapterMonitor). Only call while idle.
+
+	The monitor resets the chain after reconnecting, so any reserved instructions are put back by SyncIR() as usual.
+ */
+void SessionJtagInterface::Rebind(JtagInterface* iface)
+{
+	m_iface = iface;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Adapter information
+
+string SessionJtagInterface::GetName()
+{
+	return m_iface->GetName();
+}
+
+string SessionJtagInterface::GetSerial()
+{
+	return m_iface->GetSerial();
+}
+
+string SessionJtagInterface::GetUserID()
+{
+	return m_iface->GetUserID();
+}
+
+int SessionJtagInterface::GetFrequency()
+{
+	return m_iface->GetFrequency();
+}
+
+void SessionJtagInterface::Commit()
+{
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_COMMIT, 0);
+	m_iface->Commit();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shifting
+
+void SessionJtagInterface::ShiftData(bool last_tms, const unsigned char* send_data, unsigned char* rcv_data, size_t count)
+{
+	FlightRecorder::Scope rec(
+		g_recorder,
+		m_id,
+		FlightRecorder::OP_SHIFT,
+		count,
+		last_tms ? FlightRecorder::FLAG_TMS_AT_END : 0,
+		send_data,
+		rcv_data);
+
+	if(!IsReserved())
+	{
+		m_iface->ShiftData(last_tms, send_data, rcv_data, count);
+		if(last_tms)
+		{
+			if(m_state == TAP_SHIFT_IR)
+				m_state = TAP_EXIT1_IR;
+			else if(m_state == TAP_SHIFT_DR)
+				m_state = TAP_EXIT1_DR;
+			else
+				m_state = TAP_UNKNOWN;
+		}
+		return;
+	}
+
+	if( (m_state != TAP_SHIFT_IR) && (m_state != TAP_SHIFT_DR) )
+	{
+		throw JtagExceptionWrapper(
+			"Shifting outside of Shift-IR/Shift-DR isn't allowed while holding a reservation",
+			"");
+	}
+	ShiftPadded(last_tms, send_data, rcv_data, count);
+}
+
+/**
+	@brief Shifts part of a reserved session's scan, adding padding for the other devices at either end
+ */
+void SessionJtagInterface::ShiftPadded(bool last_tms, const unsigned char* send_data, unsigned char* rcv_data, size_t count)
+{
+	bool ir = (m_state == TAP_SHIFT_IR);
+	if(ir)
+	{
+		for(size_t i=0; i<count; i++)
+			m_irBits.push_back(GetBit(send_data, i));
+	}
+
+	//Padding after the session's data, for devices closer to TDI
+	size_t suffix = 0;
+	if(last_tms)
+	{
+		for(size_t i=m_first + m_count; i<m_chain.size(); i++)
+			suffix += ir ? m_chain[i].m_irlength : GetPadLength(i);
+	}
+
+	//Nothing to add, pass it straight through
+	if( (m_prefix == 0) && (suffix == 0) )
+		m_iface->ShiftData(last_tms, send_data, rcv_data, count);
+
+	//Build one scan with the padding and the session's data
+	else
+	{
+		size_t total = m_prefix + count + suffix;
+		m_tx.assign( (total + 7) / 8, 0);
+		if(m_prefixOnes)
+		{
+			for(size_t i=0; i<m_prefix; i++)
+				SetBit(&m_tx[0], i, true);
+		}
+		for(size_t i=0; i<count; i++)
+			SetBit(&m_tx[0], m_prefix + i, GetBit(send_data, i));
+		if(ir)
+		{
+			for(size_t i=0; i<suffix; i++)
+				SetBit(&m_tx[0], m_prefix + count + i, true);
+		}
+
+		if(rcv_data)
+		{
+			m_rx.resize(m_tx.size());
+			m_iface->ShiftData(last_tms, &m_tx[0], &m_rx[0], total);
+			for(size_t i=0; i<count; i++)
+				SetBit(rcv_data, i, GetBit(&m_rx[0], m_prefix + i));
+		}
+		else
+			m_iface->ShiftData(last_tms, &m_tx[0], NULL, total);
+	}
+
+	m_prefix = 0;
+
+	if(last_tms)
+	{
+		if(ir)
+		{
+			m_state = TAP_EXIT1_IR;
+			FinishIR();
+		}
+		else
+			m_state = TAP_EXIT1_DR;
+	}
+}
+
+/**
+	@brief Records what a finished IR scan loaded into each device
+ */
+void SessionJtagInterface::FinishIR()
+{
+	auto& states = m_arbiter.GetDeviceStates(m_chain.size());
+
+	//Everyone else is in BYPASS now
+	for(size_t i=0; i<m_chain.size(); i++)
+	{
+		if( (i >= m_first) && (i < m_first + m_count) )
+			continue;
+		states[i].m_state = ChainArbiter::DeviceState::IR_SET;
+		states[i].m_ir.assign(m_chain[i].m_irlength, true);
+	}
+
+	size_t total = 0;
+	for(size_t i=0; i<m_count; i++)
+		total += m_chain[m_first + i].m_irlength;
+
+	if(m_irBits.size() != total)
+	{
+		for(size_t i=0; i<m_count; i++)
+			states[m_first + i].m_state = ChainArbiter::DeviceState::IR_UNKNOWN;
+		m_irBits.clear();
+
+		throw JtagExceptionWrapper(
+			"IR scan length doesn't match the reserved devices",
+			"");
+	}
+
+	size_t offset = 0;
+	for(size_t i=0; i<m_count; i++)
+	{
+		size_t len = m_chain[m_first + i].m_irlength;
+		m_desired[i].assign(m_irBits.begin() + offset, m_irBits.begin() + offset + len);
+		states[m_first + i].m_state = ChainArbiter::DeviceState::IR_SET;
+		states[m_first + i].m_ir = m_desired[i];
+		offset += len;
+	}
+	m_irBits.clear();
+}
+
+/**
+	@brief Gets the number of DR bits a device we don't own adds to a scan
+ */
+size_t SessionJtagInterface::GetPadLength(size_t device)
+{
+	auto& state = m_arbiter.GetDeviceStates(m_chain.size())[device];
+	if(IsBypass(state))
+		return 1;
+	if(state.m_state == ChainArbiter::DeviceState::IR_RESET)
+		return m_chain[device].m_idcode ? 32 : 1;
+
+	throw JtagExceptionWrapper(
+		"Device outside the reservation isn't in BYPASS",
+		"");
+}
+
+/**
+	@brief Makes sure the session's devices have the instruction it last loaded, and everyone else is in BYPASS or reset
+ */
+void SessionJtagInterface::SyncIR()
+{
+	auto& states = m_arbiter.GetDeviceStates(m_chain.size());
+
+	bool others_ok = true;
+	for(size_t i=0; i<m_chain.size(); i++)
+	{
+		if( (i >= m_first) && (i < m_first + m_count) )
+			continue;
+		if( (states[i].m_state != ChainArbiter::DeviceState::IR_RESET) && !IsBypass(states[i]) )
+			others_ok = false;
+	}
+
+	//The session wants the reset instructions, which we can only get back with a real reset
+	if(m_desired[0].empty())
+	{
+		bool own_ok = true;
+		for(size_t i=0; i<m_count; i++)
+		{
+			if(states[m_first + i].m_state != ChainArbiter::DeviceState::IR_RESET)
+				own_ok = false;
+		}
+		if(!own_ok || !others_ok)
+			RealReset();
+		return;
+	}
+
+	bool own_ok = true;
+	for(size_t i=0; i<m_count; i++)
+	{
+		auto& s = states[m_first + i];
+		if( (s.m_state != ChainArbiter::DeviceState::IR_SET) || (s.m_ir != m_desired[i]) )
+			own_ok = false;
+	}
+	if(own_ok && others_ok)
+		return;
+
+	//Reload the whole IR
+	size_t total = 0;
+	for(auto& d : m_chain)
+		total += d.m_irlength;
+	m_tx.assign( (total + 7) / 8, 0xff);
+	size_t offset = 0;
+	for(size_t i=0; i<m_chain.size(); i++)
+	{
+		size_t len = m_chain[i].m_irlength;
+		if( (i >= m_first) && (i < m_first + m_count) )
+		{
+			auto& bits = m_desired[i - m_first];
+			for(size_t j=0; j<len; j++)
+				SetBit(&m_tx[0], offset + j, bits[j]);
+			states[i].m_ir = bits;
+		}
+		else
+			states[i].m_ir.assign(len, true);
+		states[i].m_state = ChainArbiter::DeviceState::IR_SET;
+		offset += len;
+	}
+
+	m_iface->EnterShiftIR();
+	m_iface->ShiftData(true, &m_tx[0], NULL, total);
+	m_iface->LeaveExit1IR();
+}
+
+/**
+	@brief Resets every TAP on the chain and goes to Run-Test/Idle
+ */
+void SessionJtagInterface::RealReset()
+{
+	m_iface->TestLogicReset();
+	m_iface->ResetToIdle();
+	m_arbiter.ResetDeviceStates();
+}
+
+bool SessionJtagInterface::ShiftDataWriteOnly(
+	bool last_tms,
+	const unsigned char* send_data,
+	unsigned char* rcv_data,
+	size_t count)
+{
+	//Reserved sessions need padding for the rest of the chain, which is only added on the synchronous path.
+	//Returning false tells the caller the scan is done and the read data is already valid.
+	if(IsReserved())
+	{
+		ShiftData(last_tms, send_data, rcv_data, count);
+		return false;
+	}
+
+	//Read data (if any) isn't available until the matching ShiftDataReadOnly()
+	FlightRecorder::Scope rec(
+		g_recorder,
+		m_id,
+		FlightRecorder::OP_SHIFT_WRITE,
+		count,
+		(last_tms ? FlightRecorder::FLAG_TMS_AT_END : 0) | (rcv_data ? FlightRecorder::FLAG_READ : 0),
+		send_data);
+
+	//The TAP moves on whether or not the read was deferred
+	bool deferred = m_iface->ShiftDataWriteOnly(last_tms, send_data, rcv_data, count);
+	if(last_tms)
+	{
+		if(m_state == TAP_SHIFT_IR)
+			m_state = TAP_EXIT1_IR;
+		else if(m_state == TAP_SHIFT_DR)
+			m_state = TAP_EXIT1_DR;
+		else
+			m_state = TAP_UNKNOWN;
+	}
+	return deferred;
+}
+
+bool SessionJtagInterface::ShiftDataReadOnly(unsigned char* rcv_data, size_t count)
+{
+	if(IsReserved())
+		return false;
+
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_SHIFT_READ, count, 0, NULL, rcv_data);
+	return m_iface->ShiftDataReadOnly(rcv_data, count);
+}
+
+bool SessionJtagInterface::IsSplitScanSupported()
+{
+	if(IsReserved())
+		return false;
+	return m_iface->IsSplitScanSupported();
+}
+
+void SessionJtagInterface::ShiftTMS(bool tdi, const unsigned char* send_data, size_t count)
+{
+	if(IsReserved())
+	{
+		throw JtagExceptionWrapper(
+			"Raw TMS shifts aren't allowed while holding a reservation",
+			"");
+	}
+
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_SHIFT_TMS, count, 0, send_data);
+	m_iface->ShiftTMS(tdi, send_data, count);
+	m_state = TAP_UNKNOWN;
+	m_arbiter.InvalidateDeviceStates();
+}
+
+void SessionJtagInterface::SendDummyClocks(size_t n)
+{
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_DUMMY_CLOCKS, n);
+	m_iface->SendDummyClocks(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// State changes
+
+void SessionJtagInterface::TestLogicReset()
+{
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_RESET, 0);
+
+	if(!IsReserved())
+		RealReset();
+
+	//Only pay for a real reset if something else is needed to get the TAP idle, or the reset IR is used later
+	else
+	{
+		if(!IsIdle())
+			RealReset();
+		for(auto& d : m_desired)
+			d.clear();
+	}
+
+	m_state = TAP_IDLE;
+}
+
+void SessionJtagInterface::EnterShiftIR()
+{
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_ENTER_SHIFT_IR, 0);
+	m_iface->EnterShiftIR();
+	m_state = TAP_SHIFT_IR;
+
+	if(!IsReserved())
+	{
+		m_arbiter.InvalidateDeviceStates();
+		return;
+	}
+
+	//Devices closer to TDO get BYPASS
+	m_prefix = 0;
+	for(size_t i=0; i<m_first; i++)
+		m_prefix += m_chain[i].m_irlength;
+	m_prefixOnes = true;
+	m_irBits.clear();
+}
+
+void SessionJtagInterface::LeaveExit1IR()
+{
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_LEAVE_EXIT1_IR, 0);
+	m_iface->LeaveExit1IR();
+	m_state = TAP_IDLE;
+}
+
+void SessionJtagInterface::EnterShiftDR()
+{
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_ENTER_SHIFT_DR, 0);
+
+	if(IsReserved())
+	{
+		SyncIR();
+
+		m_prefix = 0;
+		for(size_t i=0; i<m_first; i++)
+			m_prefix += GetPadLength(i);
+		m_prefixOnes = false;
+	}
+
+	m_iface->EnterShiftDR();
+	m_state = TAP_SHIFT_DR;
+}
+
+void SessionJtagInterface::LeaveExit1DR()
+{
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_LEAVE_EXIT1_DR, 0);
+	m_iface->LeaveExit1DR();
+	m_state = TAP_IDLE;
+}
+
+void SessionJtagInterface::ResetToIdle()
+{
+	//Already there, and forwarding it would cost other sessions their IR state (it may be done with a reset)
+	if(IsReserved() && IsIdle())
+		return;
+
+	FlightRecorder::Scope rec(g_recorder, m_id, FlightRecorder::OP_RESET_TO_IDLE, 0);
+	m_iface->ResetToIdle();
+	m_state = TAP_IDLE;
+	m_arbiter.InvalidateDeviceStates();
+}
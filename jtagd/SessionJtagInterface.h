@@ -0,0 +1,166 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of SessionJtagInterface
+ */
+
+#ifndef SessionJtagInterface_h
+#define SessionJtagInterface_h
+
+#include <stdint.h>
+#include <vector>
+
+/**
+	@brief One client session's view of a JTAG adapter shared through a ChainArbiter
+
+	Without a reservation everything is passed straight through, including scans of devices other sessions have
+	reserved: reservations are advisory (see ChainArbiter). We only keep track of where the TAP is, so the session
+	gives up the adapter when the TAP is idle and not in the middle of a scan, and we tell the arbiter when the session
+	may have changed other devices' IRs.
+
+	With a reservation the session sees a chain made up of only its own devices:
+
+	\li IR scans cover only the reserved devices. Every other device gets the BYPASS instruction.
+	\li DR scans cover only the reserved devices. Every other device adds one padding bit, or 32 if it's still showing
+		its IDCODE after a reset.
+	\li Before each DR scan the session's last instruction is put back, if another session's scan changed it.
+	\li A Test-Logic-Reset only affects the session's own view. A real reset is done only when the session next needs
+		the reset instructions.
+
+	The reserved devices must be contiguous, since a DR scan can't be split between devices without knowing each
+	device's DR length. Scans have to be exactly as long as the registers they target (true for any normal tool), and
+	raw TMS sequences aren't allowed while holding a reservation.
+
+	Every operation the session asks for is logged to g_recorder.
+ */
+class SessionJtagInterface : public JtagInterface
+{
+public:
+	SessionJtagInterface(JtagInterface* iface, ChainArbiter& arbiter, int id);
+	virtual ~SessionJtagInterface();
+
+	bool Reserve(size_t first, size_t count, std::string& error);
+	bool Restore(
+		size_t first,
+		size_t count,
+		const std::vector< std::vector<bool> >& desired,
+		std::vector<ChainCache::Device>& devices,
+		std::string& error);
+	bool GetChain(bool rescan, std::vector<ChainCache::Device>& devices, std::vector<ChainCache::Phase>& phases);
+
+	///@brief True if the TAP is somewhere another session can pick it up from
+	bool IsIdle()
+	{ return m_state == TAP_IDLE; }
+
+	void Abandon();
+
+	void GetReservation(size_t& first, size_t& count)
+	{
+		first = m_first;
+		count = m_count;
+	}
+
+	///@brief The instruction the session last loaded into each reserved device
+	const std::vector< std::vector<bool> >& GetReservedIR()
+	{ return m_desired; }
+
+	void Rebind(JtagInterface* iface);
+
+	//Adapter information
+	virtual std::string GetName();
+	virtual std::string GetSerial();
+	virtual std::string GetUserID();
+	virtual int GetFrequency();
+	virtual void Commit();
+
+	//Shifting
+	virtual void ShiftData(bool last_tms, const unsigned char* send_data, unsigned char* rcv_data, size_t count);
+	virtual bool ShiftDataWriteOnly(bool last_tms, const unsigned char* send_data, unsigned char* rcv_data, size_t count);
+	virtual bool ShiftDataReadOnly(unsigned char* rcv_data, size_t count);
+	virtual bool IsSplitScanSupported();
+	virtual void ShiftTMS(bool tdi, const unsigned char* send_data, size_t count);
+	virtual void SendDummyClocks(size_t n);
+
+	//State changes
+	virtual void TestLogicReset();
+	virtual void EnterShiftIR();
+	virtual void LeaveExit1IR();
+	virtual void EnterShiftDR();
+	virtual void LeaveExit1DR();
+	virtual void ResetToIdle();
+
+protected:
+	bool IsReserved()
+	{ return m_count != 0; }
+
+	void RealReset();
+	void SyncIR();
+	size_t GetPadLength(size_t device);
+	void ShiftPadded(bool last_tms, const unsigned char* send_data, unsigned char* rcv_data, size_t count);
+	void FinishIR();
+
+	JtagInterface* m_iface;
+	ChainArbiter& m_arbiter;
+	int m_id;
+
+	///@brief Where the TAP is, as far as this session is concerned
+	enum
+	{
+		TAP_IDLE,
+		TAP_SHIFT_IR,
+		TAP_SHIFT_DR,
+		TAP_EXIT1_IR,
+		TAP_EXIT1_DR,
+		TAP_UNKNOWN
+	} m_state;
+
+	//Reserved devices
+	size_t m_first;
+	size_t m_count;
+	std::vector<ChainCache::Device> m_chain;
+
+	///@brief The instruction this session last loaded into each reserved device, or empty for the reset value
+	std::vector< std::vector<bool> > m_desired;
+
+	///@brief Padding still to be shifted before the first bit of the session's current scan
+	size_t m_prefix;
+	bool m_prefixOnes;
+
+	///@brief IR bits of the current IR scan, so we know what the session loaded
+	std::vector<bool> m_irBits;
+
+	///@brief Scratch buffers for padded scans
+	std::vector<uint8_t> m_tx;
+	std::vector<uint8_t> m_rx;
+};
+
+#endif
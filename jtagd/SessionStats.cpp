@@ -0,0 +1,243 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of SessionStats
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+SessionStats::SessionStats(int id, const string& peer)
+	: m_id(id)
+	, m_peer(peer)
+	, m_start(GetTime())
+	, m_requests(0)
+	, m_commits(0)
+	, m_shiftOps(0)
+	, m_dataBits(0)
+	, m_modeBits(0)
+	, m_dummyClocks(0)
+	, m_hostTime(0)
+	, m_bytesIn(0)
+	, m_bytesOut(0)
+	, m_totalLatency(0)
+	, m_maxLatency(0)
+	, m_attached(false)
+	, m_lastShiftOps(0)
+	, m_lastDataBits(0)
+	, m_lastModeBits(0)
+	, m_lastDummyClocks(0)
+	, m_lastShiftTime(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Adapter accounting
+
+/**
+	@brief Starts charging adapter activity to this session. Call right after the session gets the adapter.
+
+	Does nothing if we're already attached, so it can follow every ChainArbiter::Acquire() whether or not the session
+	already had the adapter.
+
+	@param iface	The shared adapter, or NULL if it isn't JTAG (then there's nothing to count)
+ */
+void SessionStats::Attach(JtagInterface* iface)
+{
+	if(!iface || m_attached)
+		return;
+
+	m_lastShiftOps = iface->GetShiftOpCount();
+	m_lastDataBits = iface->GetDataBitCount();
+	m_lastModeBits = iface->GetModeBitCount();
+	m_lastDummyClocks = iface->GetDummyClockCount();
+	m_lastShiftTime = iface->GetShiftTime();
+	m_attached = true;
+}
+
+/**
+	@brief Charges adapter activity since the last Attach() or Update() to this session
+ */
+void SessionStats::Update(JtagInterface* iface)
+{
+	if(!iface || !m_attached)
+		return;
+
+	size_t ops = iface->GetShiftOpCount();
+	size_t data = iface->GetDataBitCount();
+	size_t mode = iface->GetModeBitCount();
+	size_t dummy = iface->GetDummyClockCount();
+	double t = iface->GetShiftTime();
+
+	m_shiftOps += ops - m_lastShiftOps;
+	m_dataBits += data - m_lastDataBits;
+	m_modeBits += mode - m_lastModeBits;
+	m_dummyClocks += dummy - m_lastDummyClocks;
+	m_hostTime += static_cast<uint64_t>( (t - m_lastShiftTime) * 1E9 );
+
+	m_lastShiftOps = ops;
+	m_lastDataBits = data;
+	m_lastModeBits = mode;
+	m_lastDummyClocks = dummy;
+	m_lastShiftTime = t;
+}
+
+/**
+	@brief Stops charging adapter activity to this session. Call right before the session gives up the adapter.
+ */
+void SessionStats::Detach(JtagInterface* iface)
+{
+	Update(iface);
+	m_attached = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Request accounting
+
+/**
+	@brief Records one handled request
+
+	@param latency	Time from receiving the request to being done with it, in seconds
+ */
+void SessionStats::AddRequest(double latency)
+{
+	uint64_t ns = (latency > 0) ? latency * 1E9 : 0;
+
+	m_requests ++;
+	m_totalLatency += ns;
+	uint64_t prev = m_maxLatency;
+	while( (ns > prev) && !m_maxLatency.compare_exchange_weak(prev, ns) )
+	{}
+}
+
+///@brief Mean request latency, in seconds
+double SessionStats::GetMeanLatency() const
+{
+	size_t n = m_requests;
+	if(n == 0)
+		return 0;
+	return m_totalLatency * 1E-9 / n;
+}
+
+/**
+	@brief Adds another session's counters to ours (used to keep totals for sessions that have ended)
+ */
+void SessionStats::Accumulate(const SessionStats& rhs)
+{
+	m_requests += rhs.m_requests;
+	m_commits += rhs.m_commits;
+	m_shiftOps += rhs.m_shiftOps;
+	m_dataBits += rhs.m_dataBits;
+	m_modeBits += rhs.m_modeBits;
+	m_dummyClocks += rhs.m_dummyClocks;
+	m_hostTime += rhs.m_hostTime;
+	m_bytesIn += rhs.m_bytesIn;
+	m_bytesOut += rhs.m_bytesOut;
+	m_totalLatency += rhs.m_totalLatency;
+
+	uint64_t ns = rhs.m_maxLatency;
+	uint64_t prev = m_maxLatency;
+	while( (ns > prev) && !m_maxLatency.compare_exchange_weak(prev, ns) )
+	{}
+}
+
+/**
+	@brief Zeroes all counters. The adapter snapshot is kept, so activity in progress is still counted.
+ */
+void SessionStats::Reset()
+{
+	m_start = GetTime();
+	m_requests = 0;
+	m_commits = 0;
+	m_shiftOps = 0;
+	m_dataBits = 0;
+	m_modeBits = 0;
+	m_dummyClocks = 0;
+	m_hostTime = 0;
+	m_bytesIn = 0;
+	m_bytesOut = 0;
+	m_totalLatency = 0;
+	m_maxLatency = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reporting
+
+/**
+	@brief Formats the counters as a JSON object
+
+	@param freq		Adapter TCK frequency, for working out board-side time (0 if unknown)
+ */
+string SessionStats::ToJson(int freq) const
+{
+	//Peer addresses are plain IPs, but escape anyway so a weird one can't break the output
+	string peer;
+	for(auto c : m_peer)
+	{
+		if( (c == '"') || (c == '\\') )
+			peer += '\\';
+		if(c >= ' ')
+			peer += c;
+	}
+
+	double host = GetHostTime();
+	double board = freq ? GetCycleCount() / static_cast<double>(freq) : 0;
+
+	char buf[1024];
+	snprintf(buf, sizeof(buf),
+		"{\"id\":%d,\"peer\":\"%s\",\"seconds\":%.3f,"
+		"\"requests\":%zu,\"commits\":%zu,"
+		"\"shift_ops\":%zu,\"data_bits\":%zu,\"mode_bits\":%zu,\"dummy_clocks\":%zu,"
+		"\"bytes_in\":%zu,\"bytes_out\":%zu,"
+		"\"latency_mean_ms\":%.3f,\"latency_max_ms\":%.3f,"
+		"\"host_time_ms\":%.3f,\"board_time_ms\":%.3f,\"overhead_ms\":%.3f}",
+		m_id,
+		peer.c_str(),
+		GetTime() - m_start,
+		m_requests.load(),
+		m_commits.load(),
+		m_shiftOps.load(),
+		m_dataBits.load(),
+		m_modeBits.load(),
+		m_dummyClocks.load(),
+		m_bytesIn.load(),
+		m_bytesOut.load(),
+		GetMeanLatency() * 1000,
+		GetMaxLatency() * 1000,
+		host * 1000,
+		board * 1000,
+		(host - board) * 1000);
+	return buf;
+}
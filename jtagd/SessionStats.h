@@ -0,0 +1,156 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of SessionStats
+ */
+
+#ifndef SessionStats_h
+#define SessionStats_h
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+/**
+	@brief Live performance counters for one client session
+
+	Updated by the session thread (and its executor), read at any time by StatsServer. Every counter is atomic so reads
+	never block the session, though a snapshot taken mid-request may be a request behind on some counters.
+
+	Adapter counters come from the shared interface's own counters: the session owns the adapter between Attach() and
+	Detach() (see ChainArbiter), so whatever the counters moved by in that time belongs to this session.
+ */
+class SessionStats
+{
+public:
+	SessionStats(int id, const std::string& peer);
+
+	void Attach(JtagInterface* iface);
+	void Update(JtagInterface* iface);
+	void Detach(JtagInterface* iface);
+
+	void AddRequest(double latency);
+
+	void AddCommit()
+	{ m_commits ++; }
+
+	void AddBytesIn(size_t bytes)
+	{ m_bytesIn += bytes; }
+
+	void AddBytesOut(size_t bytes)
+	{ m_bytesOut += bytes; }
+
+	void Accumulate(const SessionStats& rhs);
+	void Reset();
+
+	std::string ToJson(int freq) const;
+
+	int GetID() const
+	{ return m_id; }
+
+	const std::string& GetPeer() const
+	{ return m_peer; }
+
+	double GetStartTime() const
+	{ return m_start.load(); }
+
+	size_t GetRequestCount() const
+	{ return m_requests; }
+
+	size_t GetCommitCount() const
+	{ return m_commits; }
+
+	size_t GetShiftOpCount() const
+	{ return m_shiftOps; }
+
+	size_t GetDataBitCount() const
+	{ return m_dataBits; }
+
+	size_t GetCycleCount() const
+	{ return m_dataBits + m_modeBits + m_dummyClocks; }
+
+	double GetHostTime() const
+	{ return m_hostTime * 1E-9; }
+
+	size_t GetBytesIn() const
+	{ return m_bytesIn; }
+
+	size_t GetBytesOut() const
+	{ return m_bytesOut; }
+
+	double GetMeanLatency() const;
+
+	double GetMaxLatency() const
+	{ return m_maxLatency * 1E-9; }
+
+protected:
+	int m_id;
+
+	///@brief Address of the client
+	std::string m_peer;
+
+	///@brief When the session started (or the counters were last reset)
+	std::atomic<double> m_start;
+
+	///@brief Requests handled, and commits (flush requests) among them
+	std::atomic<size_t> m_requests;
+	std::atomic<size_t> m_commits;
+
+	//Adapter activity
+	std::atomic<size_t> m_shiftOps;
+	std::atomic<size_t> m_dataBits;
+	std::atomic<size_t> m_modeBits;
+	std::atomic<size_t> m_dummyClocks;
+
+	///@brief Host-side shift time, in ns
+	std::atomic<uint64_t> m_hostTime;
+
+	///@brief Bytes received from and sent to the client, including framing
+	std::atomic<size_t> m_bytesIn;
+	std::atomic<size_t> m_bytesOut;
+
+	///@brief Total and worst time from receiving a request to being done with it, in ns
+	std::atomic<uint64_t> m_totalLatency;
+	std::atomic<uint64_t> m_maxLatency;
+
+	///@brief True if we own the adapter and the snapshot below is valid
+	bool m_attached;
+
+	//Adapter counters at the last Attach() or Update(). Only touched by the session thread.
+	size_t m_lastShiftOps;
+	size_t m_lastDataBits;
+	size_t m_lastModeBits;
+	size_t m_lastDummyClocks;
+	double m_lastShiftTime;
+};
+
+#endif
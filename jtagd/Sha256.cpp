@@ -0,0 +1,215 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of Sha256
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+static const uint32_t g_sha256RoundConstants[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t RotateRight(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+Sha256::Sha256()
+	: m_blockLen(0)
+	, m_totalLen(0)
+{
+	m_state[0] = 0x6a09e667;
+	m_state[1] = 0xbb67ae85;
+	m_state[2] = 0x3c6ef372;
+	m_state[3] = 0xa54ff53a;
+	m_state[4] = 0x510e527f;
+	m_state[5] = 0x9b05688c;
+	m_state[6] = 0x1f83d9ab;
+	m_state[7] = 0x5be0cd19;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hashing
+
+/**
+	@brief Adds more data to the hash
+ */
+void Sha256::Update(const uint8_t* data, size_t len)
+{
+	m_totalLen += len;
+
+	while(len > 0)
+	{
+		size_t n = min(len, sizeof(m_block) - m_blockLen);
+		memcpy(m_block + m_blockLen, data, n);
+		m_blockLen += n;
+		data += n;
+		len -= n;
+
+		if(m_blockLen == sizeof(m_block))
+		{
+			ProcessBlock(m_block);
+			m_blockLen = 0;
+		}
+	}
+}
+
+/**
+	@brief Pads the message and returns the binary digest.
+
+	The object cannot be updated after this is called.
+ */
+string Sha256::Final()
+{
+	uint64_t bitlen = m_totalLen * 8;
+
+	//Append the 1 bit, then zeroes until we have room for the length
+	uint8_t pad = 0x80;
+	Update(&pad, 1);
+	pad = 0;
+	while(m_blockLen != 56)
+		Update(&pad, 1);
+
+	//Length is big endian
+	uint8_t lenbuf[8];
+	for(int i=0; i<8; i++)
+		lenbuf[i] = bitlen >> (56 - 8*i);
+	Update(lenbuf, 8);
+
+	string digest(DIGEST_SIZE, '\0');
+	for(int i=0; i<8; i++)
+	{
+		digest[i*4 + 0] = m_state[i] >> 24;
+		digest[i*4 + 1] = m_state[i] >> 16;
+		digest[i*4 + 2] = m_state[i] >> 8;
+		digest[i*4 + 3] = m_state[i];
+	}
+	return digest;
+}
+
+void Sha256::ProcessBlock(const uint8_t* block)
+{
+	//Expand the message schedule
+	uint32_t w[64];
+	for(int i=0; i<16; i++)
+	{
+		w[i] =
+			(block[i*4 + 0] << 24) |
+			(block[i*4 + 1] << 16) |
+			(block[i*4 + 2] << 8) |
+			block[i*4 + 3];
+	}
+	for(int i=16; i<64; i++)
+	{
+		uint32_t s0 = RotateRight(w[i-15], 7) ^ RotateRight(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = RotateRight(w[i-2], 17) ^ RotateRight(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	//Compression rounds
+	uint32_t a = m_state[0];
+	uint32_t b = m_state[1];
+	uint32_t c = m_state[2];
+	uint32_t d = m_state[3];
+	uint32_t e = m_state[4];
+	uint32_t f = m_state[5];
+	uint32_t g = m_state[6];
+	uint32_t h = m_state[7];
+	for(int i=0; i<64; i++)
+	{
+		uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+		uint32_t ch = (e & f) ^ (~e & g);
+		uint32_t t1 = h + s1 + ch + g_sha256RoundConstants[i] + w[i];
+		uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2 = s0 + maj;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	m_state[0] += a;
+	m_state[1] += b;
+	m_state[2] += c;
+	m_state[3] += d;
+	m_state[4] += e;
+	m_state[5] += f;
+	m_state[6] += g;
+	m_state[7] += h;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+/**
+	@brief Hashes a complete buffer in one go
+ */
+string Sha256::Hash(const string& data)
+{
+	Sha256 h;
+	h.Update(reinterpret_cast<const uint8_t*>(data.c_str()), data.size());
+	return h.Final();
+}
+
+/**
+	@brief Converts a binary digest to lowercase hex
+ */
+string Sha256::ToHex(const string& digest)
+{
+	static const char* hex = "0123456789abcdef";
+	string ret;
+	for(auto c : digest)
+	{
+		ret += hex[(c >> 4) & 0xf];
+		ret += hex[c & 0xf];
+	}
+	return ret;
+}
@@ -0,0 +1,430 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of StatsServer
+ */
+#include "jtagd.h"
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/un.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+StatsServer::StatsServer()
+	: m_freq(0)
+	, m_closed(-1, "")
+	, m_start(GetTime())
+	, m_listenfd(-1)
+	, m_signalfd(-1)
+{
+	m_stopfd[0] = -1;
+	m_stopfd[1] = -1;
+}
+
+StatsServer::~StatsServer()
+{
+	Stop();
+}
+
+/**
+	@brief Blocks SIGUSR1 and SIGUSR2 in the calling thread and every thread it creates later, so only our signalfd sees it
+ */
+void StatsServer::BlockSignals()
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+/**
+	@brief Gets the address of whoever is on the other end of a socket, for display
+ */
+string StatsServer::GetPeerName(int fd)
+{
+	sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if(0 != getpeername(fd, reinterpret_cast<sockaddr*>(&addr), &len))
+		return "unknown";
+
+	char buf[INET6_ADDRSTRLEN] = {0};
+	if(addr.ss_family == AF_INET6)
+	{
+		auto a = reinterpret_cast<sockaddr_in6*>(&addr);
+		inet_ntop(AF_INET6, &a->sin6_addr, buf, sizeof(buf));
+		return string(buf) + ":" + to_string(ntohs(a->sin6_port));
+	}
+	else if(addr.ss_family == AF_INET)
+	{
+		auto a = reinterpret_cast<sockaddr_in*>(&addr);
+		inet_ntop(AF_INET, &a->sin_addr, buf, sizeof(buf));
+		return string(buf) + ":" + to_string(ntohs(a->sin_port));
+	}
+	return "local";
+}
+
+/**
+	@brief Reads the adapter information to report. Called whenever the adapter is opened.
+ */
+void StatsServer::SetInterface(TestInterface* iface)
+{
+	string name = iface->GetName();
+	string serial = iface->GetSerial();
+	int freq = dynamic_cast<JtagInterface*>(iface) ? iface->GetFrequency() : 0;
+
+	lock_guard<mutex> lock(m_mutex);
+	m_name = name;
+	m_serial = serial;
+	m_freq = freq;
+}
+
+/**
+	@brief Starts listening for SIGUSR1 and (if a path is given) control socket connections
+
+	@param path		Path of the control socket, or empty for none
+ */
+void StatsServer::Start(const string& path)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	m_signalfd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if(m_signalfd < 0)
+		LogWarning("Couldn't create signalfd, SIGUSR1/SIGUSR2 are disabled\n");
+
+	if(path != "")
+	{
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(path.length() >= sizeof(addr.sun_path))
+		{
+			throw JtagExceptionWrapper(
+				"Control socket path is too long",
+				"");
+		}
+		strcpy(addr.sun_path, path.c_str());
+
+		//Remove any stale socket from a previous run
+		unlink(path.c_str());
+
+		m_listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if( (m_listenfd < 0) ||
+			(0 != ::bind(m_listenfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) ||
+			(0 != listen(m_listenfd, 4)) )
+		{
+			throw JtagExceptionWrapper(
+				"Failed to create control socket",
+				"");
+		}
+		m_path = path;
+		LogNotice("    Statistics available on %s\n", path.c_str());
+	}
+
+	if(0 != pipe(m_stopfd))
+	{
+		throw JtagExceptionWrapper(
+			"Failed to create pipe",
+			"");
+	}
+	m_thread = thread(&StatsServer::ServerThread, this);
+}
+
+void StatsServer::Stop()
+{
+	if(m_thread.joinable())
+	{
+		char c = 0;
+		if(1 != write(m_stopfd[1], &c, 1))
+			LogWarning("Couldn't stop statistics thread\n");
+		m_thread.join();
+	}
+
+	for(auto fd : {m_listenfd, m_signalfd, m_stopfd[0], m_stopfd[1]})
+	{
+		if(fd >= 0)
+			close(fd);
+	}
+	m_listenfd = -1;
+	m_signalfd = -1;
+	m_stopfd[0] = -1;
+	m_stopfd[1] = -1;
+
+	if(m_path != "")
+	{
+		unlink(m_path.c_str());
+		m_path = "";
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Session registry
+
+/**
+	@brief Creates the statistics for a new session
+ */
+shared_ptr<SessionStats> StatsServer::AddSession(int id, const string& peer)
+{
+	auto stats = make_shared<SessionStats>(id, peer);
+	lock_guard<mutex> lock(m_mutex);
+	m_sessions.push_back(stats);
+	return stats;
+}
+
+/**
+	@brief Folds a finished session's counters into the closed-session totals
+ */
+void StatsServer::RemoveSession(shared_ptr<SessionStats> stats)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_sessions.remove(stats);
+	m_closed.Accumulate(*stats);
+}
+
+/**
+	@brief Zeroes the counters of all sessions, live and closed
+ */
+void StatsServer::Reset()
+{
+	lock_guard<mutex> lock(m_mutex);
+	for(auto& s : m_sessions)
+		s->Reset();
+	m_closed.Reset();
+	m_start = GetTime();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reporting
+
+/**
+	@brief Formats everything as one JSON document
+ */
+string StatsServer::ToJson()
+{
+	//The monitor calls us with its own lock held, so ask it before taking ours
+	bool open = (g_monitor.GetInterface() != NULL);
+	size_t opens = g_monitor.GetOpenCount();
+	auto cold = g_monitor.GetStartupStats(true);
+	auto warm = g_monitor.GetStartupStats(false);
+
+	lock_guard<mutex> lock(m_mutex);
+	int freq = m_freq;
+
+	SessionStats total(-1, "");
+	total.Accumulate(m_closed);
+
+	char buf[512];
+	string json = "{\"adapter\":{";
+	snprintf(buf, sizeof(buf),
+		"\"freq\":%d,\"open\":%s,\"opens\":%zu,"
+		"\"cold_starts\":%zu,\"cold_first_op_mean_ms\":%.3f,\"cold_first_op_max_ms\":%.3f,"
+		"\"warm_starts\":%zu,\"warm_first_op_mean_ms\":%.3f,\"warm_first_op_max_ms\":%.3f,",
+		freq,
+		open ? "true" : "false",
+		opens,
+		cold.m_count,
+		cold.GetMean() * 1000,
+		cold.m_max * 1000,
+		warm.m_count,
+		warm.GetMean() * 1000,
+		warm.m_max * 1000);
+	json += buf;
+	json += "\"name\":\"" + m_name + "\",\"serial\":\"" + m_serial + "\"},";
+	snprintf(buf, sizeof(buf), "\"seconds\":%.3f,", GetTime() - m_start);
+	json += buf;
+
+	json += "\"sessions\":[";
+	for(auto& s : m_sessions)
+	{
+		if(s != m_sessions.front())
+			json += ",";
+		json += s->ToJson(freq);
+		total.Accumulate(*s);
+	}
+	json += "],";
+
+	json += "\"closed\":" + m_closed.ToJson(freq) + ",";
+	json += "\"total\":" + total.ToJson(freq) + "}\n";
+	return json;
+}
+
+/**
+	@brief Prints a summary of every session to the log
+ */
+void StatsServer::Dump()
+{
+	lock_guard<mutex> lock(m_mutex);
+	int freq = m_freq;
+	LogNotice("Session statistics (%zu connected):\n", m_sessions.size());
+	LogIndenter li;
+
+	SessionStats total(-1, "");
+	total.Accumulate(m_closed);
+	for(auto& s : m_sessions)
+		total.Accumulate(*s);
+
+	auto print = [&](const SessionStats& s, const char* label)
+	{
+		double host = s.GetHostTime();
+		double board = freq ? s.GetCycleCount() / static_cast<double>(freq) : 0;
+		LogNotice("%-24s %8zu req %6zu commits %8zu shifts %10zu bits %8.1f kB in %8.1f kB out  "
+			"latency %.2f / %.2f ms  host %.1f ms  board %.1f ms\n",
+			label,
+			s.GetRequestCount(),
+			s.GetCommitCount(),
+			s.GetShiftOpCount(),
+			s.GetDataBitCount(),
+			s.GetBytesIn() / 1024.0,
+			s.GetBytesOut() / 1024.0,
+			s.GetMeanLatency() * 1000,
+			s.GetMaxLatency() * 1000,
+			host * 1000,
+			board * 1000);
+	};
+
+	for(auto& s : m_sessions)
+	{
+		string label = to_string(s->GetID()) + " " + s->GetPeer();
+		print(*s, label.c_str());
+	}
+	print(m_closed, "closed");
+	print(total, "total");
+}
+
+/**
+	@brief Saves the flight recorder contents
+
+	@return Path of the dump, or an empty string if there wasn't one
+ */
+string StatsServer::DumpFlightRecorder()
+{
+	string path = g_recorder.Dump("requested");
+	if(path != "")
+		LogNotice("Recent adapter operations saved to %s\n", path.c_str());
+	return path;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Server thread
+
+void StatsServer::ServerThread()
+{
+	pollfd fds[3];
+	fds[0].fd = m_stopfd[0];
+	fds[1].fd = m_signalfd;
+	fds[2].fd = m_listenfd;
+	for(auto& f : fds)
+		f.events = POLLIN;
+
+	while(true)
+	{
+		if(poll(fds, 3, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		if(fds[0].revents)
+			break;
+
+		if(fds[1].revents & POLLIN)
+		{
+			signalfd_siginfo info;
+			if(sizeof(info) != read(m_signalfd, &info, sizeof(info)))
+				continue;
+			if(info.ssi_signo == SIGUSR1)
+				Dump();
+			else
+				DumpFlightRecorder();
+		}
+
+		if(fds[2].revents & POLLIN)
+		{
+			int fd = accept4(m_listenfd, NULL, NULL, SOCK_CLOEXEC);
+			if(fd >= 0)
+			{
+				ServeClient(fd);
+				close(fd);
+			}
+		}
+	}
+}
+
+/**
+	@brief Reads one command from a control socket client and sends back the statistics
+ */
+void StatsServer::ServeClient(int fd)
+{
+	//Don't let a client that never sends anything hold up SIGUSR1 handling
+	string cmd;
+	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while( (cmd.find('\n') == string::npos) && (cmd.length() < 64) && (poll(&pfd, 1, 1000) > 0) )
+	{
+		char buf[64];
+		ssize_t len = recv(fd, buf, sizeof(buf), 0);
+		if(len <= 0)
+			break;
+		cmd.append(buf, len);
+	}
+	while( (cmd != "") && isspace(cmd.back()) )
+		cmd.pop_back();
+
+	string json;
+	if( (cmd == "") || (cmd == "stats") )
+		json = ToJson();
+	else if(cmd == "reset")
+	{
+		json = ToJson();
+		Reset();
+	}
+	else if(cmd == "flight")
+		json = "{\"flight_recorder\":\"" + DumpFlightRecorder() + "\"}\n";
+	else
+		json = "{\"error\":\"unknown command\"}\n";
+
+	size_t off = 0;
+	while(off < json.length())
+	{
+		ssize_t len = send(fd, json.c_str() + off, json.length() - off, MSG_NOSIGNAL);
+		if(len <= 0)
+			break;
+		off += len;
+	}
+}
@@ -0,0 +1,119 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of StatsServer
+ */
+
+#ifndef StatsServer_h
+#define StatsServer_h
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+	@brief Live statistics for all sessions, reported on SIGUSR1 or through a local control socket
+
+	Every session registers a SessionStats here for its lifetime. Counters of sessions that have ended are folded into
+	one "closed" entry so totals survive them.
+
+	A background thread waits for SIGUSR1 (through a signalfd, so nothing happens in signal context) and dumps a table
+	to the log. SIGUSR2 saves the flight recorder (see FlightRecorder) instead. Both signals have to be blocked in every
+	thread for that to work, so BlockSignals() must be called before any other thread is started.
+
+	If a control socket path is given, the same thread also serves it. A client connects, optionally sends one line,
+	and gets one JSON document back before the socket is closed:
+
+	\li "stats" (or nothing): current counters
+	\li "reset": current counters, which are then zeroed, for sampling over fixed intervals
+	\li "flight": saves the flight recorder, and returns the path of the file
+ */
+class StatsServer
+{
+public:
+	StatsServer();
+	virtual ~StatsServer();
+
+	static void BlockSignals();
+	static std::string GetPeerName(int fd);
+
+	void SetInterface(TestInterface* iface);
+
+	void Start(const std::string& path);
+	void Stop();
+
+	std::shared_ptr<SessionStats> AddSession(int id, const std::string& peer);
+	void RemoveSession(std::shared_ptr<SessionStats> stats);
+
+	std::string ToJson();
+	void Dump();
+	void Reset();
+	std::string DumpFlightRecorder();
+
+protected:
+	void ServerThread();
+	void ServeClient(int fd);
+
+	//Adapter information, read when the adapter is opened so we never talk to it from the stats thread.
+	//Clients can't change the TCK frequency, so it stays valid.
+	std::string m_name;
+	std::string m_serial;
+
+	///@brief TCK frequency, or 0 if not a JTAG adapter
+	int m_freq;
+
+	std::mutex m_mutex;
+
+	///@brief Sessions currently connected
+	std::list< std::shared_ptr<SessionStats> > m_sessions;
+
+	///@brief Totals for sessions that have ended
+	SessionStats m_closed;
+
+	///@brief When the daemon started (or the counters were last reset)
+	double m_start;
+
+	///@brief Path of the control socket, or empty if there isn't one
+	std::string m_path;
+
+	int m_listenfd;
+	int m_signalfd;
+
+	///@brief Pipe written to wake up the server thread when shutting down
+	int m_stopfd[2];
+
+	std::thread m_thread;
+};
+
+#endif
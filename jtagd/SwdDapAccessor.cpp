@@ -0,0 +1,144 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of SwdDapAccessor
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+SwdDapAccessor::SwdDapAccessor(SWDInterface* iface)
+	: m_iface(iface)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Transport
+
+void SwdDapAccessor::Reset()
+{
+	DapAccessor::Reset();
+	m_iface->ResetInterface();
+}
+
+void SwdDapAccessor::Commit()
+{
+	m_iface->Commit();
+}
+
+uint32_t SwdDapAccessor::ReadDP(uint8_t addr)
+{
+	return Read(addr, false);
+}
+
+void SwdDapAccessor::WriteDP(uint8_t addr, uint32_t wdata)
+{
+	Write(addr, false, wdata);
+}
+
+uint32_t SwdDapAccessor::PostAPRead(uint8_t addr)
+{
+	return Read(addr, true);
+}
+
+void SwdDapAccessor::WriteAP(uint8_t addr, uint32_t wdata)
+{
+	Write(addr, true, wdata);
+}
+
+/**
+	@brief Reads a register, retrying on WAIT
+ */
+uint32_t SwdDapAccessor::Read(uint8_t addr, bool ap)
+{
+	unsigned int retries = 0;
+	while(true)
+	{
+		try
+		{
+			return m_iface->ReadWord((addr >> 2) & 3, ap);
+		}
+		catch(const JtagException& ex)
+		{
+			CheckRetry(retries, ex);
+		}
+	}
+}
+
+/**
+	@brief Writes a register, retrying on WAIT
+ */
+void SwdDapAccessor::Write(uint8_t addr, bool ap, uint32_t wdata)
+{
+	unsigned int retries = 0;
+	while(true)
+	{
+		try
+		{
+			m_iface->WriteWord((addr >> 2) & 3, ap, wdata);
+			return;
+		}
+		catch(const JtagException& ex)
+		{
+			CheckRetry(retries, ex);
+		}
+	}
+}
+
+/**
+	@brief Decides whether a failed access should be retried, and rethrows if not
+ */
+void SwdDapAccessor::CheckRetry(unsigned int& retries, const JtagException& ex)
+{
+	if(++retries > m_maxRetries)
+		throw ex;
+
+	//Sticky errors mean the access faulted, and retrying won't help.
+	//If CTRL/STAT can't be read either the target is still busy, so just count it as another retry.
+	uint32_t status = 0;
+	try
+	{
+		m_iface->Commit();
+		status = m_iface->ReadWord(DP_CTRLSTAT >> 2, false);
+	}
+	catch(const JtagException&)
+	{
+	}
+	if(status & (CTRLSTAT_STICKYORUN | CTRLSTAT_STICKYCMP | CTRLSTAT_STICKYERR | CTRLSTAT_WDATAERR))
+		throw ex;
+
+	//Give the target a moment to finish whatever it's busy with
+	usleep(min(retries, 100u) * 10);
+}
@@ -0,0 +1,67 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of SwdDapAccessor
+ */
+
+#ifndef SwdDapAccessor_h
+#define SwdDapAccessor_h
+
+/**
+	@brief DAP access over SWD
+
+	The SWD interface reports WAIT and FAULT acknowledgements as exceptions. Since it can't tell us which one it got, we
+	look at CTRL/STAT after a failure: any sticky error flag means the access faulted, otherwise it was a WAIT and is
+	retried.
+ */
+class SwdDapAccessor : public DapAccessor
+{
+public:
+	SwdDapAccessor(SWDInterface* iface);
+
+	virtual void Reset();
+	virtual void Commit();
+
+protected:
+	virtual uint32_t ReadDP(uint8_t addr);
+	virtual void WriteDP(uint8_t addr, uint32_t wdata);
+	virtual uint32_t PostAPRead(uint8_t addr);
+	virtual void WriteAP(uint8_t addr, uint32_t wdata);
+
+	uint32_t Read(uint8_t addr, bool ap);
+	void Write(uint8_t addr, bool ap, uint32_t wdata);
+	void CheckRetry(unsigned int& retries, const JtagException& ex);
+
+	SWDInterface* m_iface;
+};
+
+#endif
@@ -0,0 +1,259 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of XvcTap
+ */
+#include "jtagd.h"
+
+using namespace std;
+
+static inline bool GetBit(const uint8_t* buf, size_t i)
+{ return (buf[i / 8] >> (i % 8)) & 1; }
+
+static inline void SetBit(uint8_t* buf, size_t i)
+{ buf[i / 8] |= (1 << (i % 8)); }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Starts out in Run-Test/Idle, which is where every session leaves the TAP
+ */
+XvcTap::XvcTap()
+	: m_state(STATE_IDLE)
+	, m_parkedInReset(false)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// TAP state machine
+
+XvcTap::State XvcTap::NextState(State state, bool tms)
+{
+	switch(state)
+	{
+		case STATE_RESET:		return tms ? STATE_RESET : STATE_IDLE;
+		case STATE_IDLE:		return tms ? STATE_SELECT_DR : STATE_IDLE;
+
+		case STATE_SELECT_DR:	return tms ? STATE_SELECT_IR : STATE_CAPTURE_DR;
+		case STATE_CAPTURE_DR:	return tms ? STATE_EXIT1_DR : STATE_SHIFT_DR;
+		case STATE_SHIFT_DR:	return tms ? STATE_EXIT1_DR : STATE_SHIFT_DR;
+		case STATE_EXIT1_DR:	return tms ? STATE_UPDATE_DR : STATE_PAUSE_DR;
+		case STATE_PAUSE_DR:	return tms ? STATE_EXIT2_DR : STATE_PAUSE_DR;
+		case STATE_EXIT2_DR:	return tms ? STATE_UPDATE_DR : STATE_SHIFT_DR;
+		case STATE_UPDATE_DR:	return tms ? STATE_SELECT_DR : STATE_IDLE;
+
+		case STATE_SELECT_IR:	return tms ? STATE_RESET : STATE_CAPTURE_IR;
+		case STATE_CAPTURE_IR:	return tms ? STATE_EXIT1_IR : STATE_SHIFT_IR;
+		case STATE_SHIFT_IR:	return tms ? STATE_EXIT1_IR : STATE_SHIFT_IR;
+		case STATE_EXIT1_IR:	return tms ? STATE_UPDATE_IR : STATE_PAUSE_IR;
+		case STATE_PAUSE_IR:	return tms ? STATE_EXIT2_IR : STATE_PAUSE_IR;
+		case STATE_EXIT2_IR:	return tms ? STATE_UPDATE_IR : STATE_SHIFT_IR;
+		case STATE_UPDATE_IR:	return tms ? STATE_SELECT_DR : STATE_IDLE;
+
+		default:				return STATE_RESET;
+	}
+}
+
+/**
+	@brief Follows one TCK, and keeps track of the instruction the client loaded
+ */
+void XvcTap::Clock(bool tms)
+{
+	m_state = NextState(m_state, tms);
+	switch(m_state)
+	{
+		case STATE_RESET:
+			m_ir.clear();
+			break;
+
+		case STATE_CAPTURE_IR:
+			m_pendingIR.clear();
+			break;
+
+		case STATE_UPDATE_IR:
+			m_ir = m_pendingIR;
+			break;
+
+		default:
+			break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shifting
+
+/**
+	@brief Runs one XVC shift vector
+
+	Bits clocked in Shift-DR or Shift-IR (up to and including the one that leaves it) are shifted as data, and TDO is
+	only captured for those. Every other run of bits is a TMS-only move, with TDO reading back as zero.
+
+	@param jface	The adapter
+	@param count	Length of the vector in bits
+	@param tms		TMS bits, LSB first
+	@param tdi		TDI bits, LSB first
+	@param tdo		TDO bits, LSB first (same length as the others)
+
+	@return True if the vector may have changed what's in the devices' instruction registers
+ */
+bool XvcTap::Shift(JtagInterface* jface, size_t count, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo)
+{
+	size_t bytes = (count + 7) / 8;
+	memset(tdo, 0, bytes);
+
+	vector<uint8_t> txbuf(bytes);
+	vector<uint8_t> rxbuf(bytes);
+	bool changed = false;
+	size_t i = 0;
+	while(i < count)
+	{
+		size_t start = i;
+		memset(&txbuf[0], 0, bytes);
+
+		if( (m_state == STATE_SHIFT_DR) || (m_state == STATE_SHIFT_IR) )
+		{
+			bool last_tms = false;
+			while( (i < count) && !last_tms)
+			{
+				last_tms = GetBit(tms, i);
+				if(GetBit(tdi, i))
+					SetBit(&txbuf[0], i - start);
+				if(m_state == STATE_SHIFT_IR)
+					m_pendingIR.push_back(GetBit(tdi, i));
+				i ++;
+			}
+
+			memset(&rxbuf[0], 0, bytes);
+			jface->ShiftData(last_tms, &txbuf[0], &rxbuf[0], i - start);
+			for(size_t j=start; j<i; j++)
+			{
+				if(GetBit(&rxbuf[0], j - start))
+					SetBit(tdo, j);
+			}
+			if(last_tms)
+				Clock(true);
+		}
+
+		else
+		{
+			while( (i < count) && (m_state != STATE_SHIFT_DR) && (m_state != STATE_SHIFT_IR) )
+			{
+				bool b = GetBit(tms, i);
+				if(b)
+					SetBit(&txbuf[0], i - start);
+				Clock(b);
+				if( (m_state == STATE_RESET) || (m_state == STATE_UPDATE_IR) )
+					changed = true;
+				i ++;
+			}
+			jface->ShiftTMS(false, &txbuf[0], i - start);
+		}
+	}
+
+	jface->Commit();
+	return changed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sharing the adapter
+
+/**
+	@brief Leaves the TAP in Run-Test/Idle for the next session. Only call if IsStable().
+ */
+void XvcTap::Park(JtagInterface* jface)
+{
+	if(m_state != STATE_RESET)
+		return;
+
+	const uint8_t idle = 0x00;
+	jface->ShiftTMS(false, &idle, 1);
+	jface->Commit();
+	m_parkedInReset = true;
+}
+
+/**
+	@brief Puts the TAP back the way the client left it, after getting the adapter back
+
+	@param jface	The adapter
+	@param others	True if another session had the adapter since we last did
+
+	@return True if instruction registers were changed
+ */
+bool XvcTap::Resume(JtagInterface* jface, bool others)
+{
+	//Straight back to Test-Logic-Reset, which also undoes whatever the other sessions loaded
+	if(m_parkedInReset)
+	{
+		const uint8_t reset = 0x1f;
+		jface->ShiftTMS(false, &reset, 5);
+		jface->Commit();
+		m_parkedInReset = false;
+		return true;
+	}
+
+	if(!others || m_ir.empty())
+		return false;
+
+	//Run-Test/Idle to Shift-IR, shift the instruction, then Update-IR and back to Run-Test/Idle
+	vector<uint8_t> ir((m_ir.size() + 7) / 8);
+	for(size_t i=0; i<m_ir.size(); i++)
+	{
+		if(m_ir[i])
+			SetBit(&ir[0], i);
+	}
+	const uint8_t enter = 0x03;
+	const uint8_t leave = 0x01;
+	jface->ShiftTMS(false, &enter, 4);
+	jface->ShiftData(true, &ir[0], NULL, m_ir.size());
+	jface->ShiftTMS(false, &leave, 2);
+	jface->Commit();
+	return true;
+}
+
+/**
+	@brief Gets the TAP out of wherever a client that went away left it, via Test-Logic-Reset to Run-Test/Idle
+
+	@return True if it had to go through Test-Logic-Reset
+ */
+bool XvcTap::Abandon(JtagInterface* jface)
+{
+	if(m_state == STATE_IDLE)
+		return false;
+
+	const uint8_t idle = 0x1f;
+	jface->ShiftTMS(false, &idle, 6);
+	jface->Commit();
+	m_state = STATE_IDLE;
+	m_ir.clear();
+	return true;
+}
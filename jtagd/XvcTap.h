@@ -0,0 +1,115 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2019 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of XvcTap
+ */
+
+#ifndef XvcTap_h
+#define XvcTap_h
+
+#include <stdint.h>
+#include <vector>
+
+/**
+	@brief Runs XVC shift vectors on a shared adapter, and keeps track of where they leave the TAP
+
+	An XVC client sends raw TMS and TDI bit vectors and expects the TAP (and the instructions it loaded) to stay the
+	way it left them between vectors. We follow the TAP state machine through every vector, so that bits clocked in
+	Shift-DR or Shift-IR can go to the adapter as data shifts and everything else as TMS-only moves, and so that we know
+	when the client has left the chain somewhere another session can pick it up from.
+
+	That's only the case in Run-Test/Idle or Test-Logic-Reset. Anywhere else the XVC session keeps the adapter, just
+	like a native session in the middle of a scan. Other sessions expect the TAP in Run-Test/Idle, so Park() moves it
+	there from Test-Logic-Reset and Resume() puts it back before the client's next vector.
+
+	If someone else had the adapter in between, Resume() also shifts the client's last instruction back in (re-running
+	Update-IR), since the other session will have put its own instructions in. Devices see the same instruction loaded
+	twice, which is harmless for everything an XVC client normally loads.
+ */
+class XvcTap
+{
+public:
+	XvcTap();
+
+	bool Shift(JtagInterface* jface, size_t count, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo);
+
+	///@brief True if the client left the TAP somewhere we can hand the adapter over from
+	bool IsStable()
+	{ return (m_state == STATE_IDLE) || (m_state == STATE_RESET); }
+
+	void Park(JtagInterface* jface);
+	bool Resume(JtagInterface* jface, bool others);
+	bool Abandon(JtagInterface* jface);
+
+	///@brief TAP controller states (IEEE 1149.1 figure 6-1)
+	enum State
+	{
+		STATE_RESET,
+		STATE_IDLE,
+		STATE_SELECT_DR,
+		STATE_CAPTURE_DR,
+		STATE_SHIFT_DR,
+		STATE_EXIT1_DR,
+		STATE_PAUSE_DR,
+		STATE_EXIT2_DR,
+		STATE_UPDATE_DR,
+		STATE_SELECT_IR,
+		STATE_CAPTURE_IR,
+		STATE_SHIFT_IR,
+		STATE_EXIT1_IR,
+		STATE_PAUSE_IR,
+		STATE_EXIT2_IR,
+		STATE_UPDATE_IR
+	};
+
+	static State NextState(State state, bool tms);
+
+	State GetState()
+	{ return m_state; }
+
+protected:
+	void Clock(bool tms);
+
+	///@brief State the client thinks the TAP is in
+	State m_state;
+
+	///@brief True if the client left the TAP in Test-Logic-Reset but Park() moved it to Run-Test/Idle
+	bool m_parkedInReset;
+
+	///@brief Last instruction the client loaded into the whole chain, LSB first (empty if none since the last reset)
+	std::vector<bool> m_ir;
+
+	///@brief Instruction currently being shifted in
+	std::vector<bool> m_pendingIR;
+};
+
+#endif
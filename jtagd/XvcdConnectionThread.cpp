@@ -37,11 +37,95 @@
 
 using namespace std;
 
+///@brief Longest shift vector we accept, in bytes of TMS (or TDI)
+static const uint32_t XVC_MAX_VECTOR_BYTES = 2048;
+
+//Commands we understand. No two start with the same two characters.
+static const char* const XVC_GETINFO	= "getinfo:";
+static const char* const XVC_SETTCK		= "settck:";
+static const char* const XVC_SHIFT		= "shift:";
+static const char* const XVC_MRD		= "mrd:";
+static const char* const XVC_MWR		= "mwr:";
+static const char* const XVC_COMMANDS[] = { XVC_GETINFO, XVC_SETTCK, XVC_SHIFT, XVC_MRD, XVC_MWR };
+
 /**
 	@brief Main function for handling connections using the XVCD protocol
+
+	XVC sessions share the adapter with everyone else through g_arbiter. Each shift vector runs as one transaction,
+	and the adapter is handed over between vectors whenever the client has left the TAP somewhere another session can
+	pick it up from (see XvcTap).
+
+	We speak XVC 1.1, which adds memory access for AXI debug bridges and the like. Both commands take a 32-bit flags
+	word, a 64-bit address and a 32-bit length in bytes, all little endian. The flags are reserved, so we ignore them.
+	The protocol has no way to say which MEM-AP to use, so every client gets the one given on the command line
+	(apsel, behind the JTAG-DP at chain index dap_index). Addresses and lengths must be whole words.
+
+		mrd:<flags><addr><len>			replies with len bytes of data, then a 32-bit status
+		mwr:<flags><addr><len><data>	replies with a 32-bit status
+
+	A status of zero means success. Transfers are streamed as MEM-AP block transfers of at most max_transfer bytes,
+	each one a transaction of its own so other sessions get a turn in between. Data of a failed read is zeroes.
+
+	@param client		Socket to talk to the client on
+	@param peer			Address of the client
+	@param max_transfer	Largest block of memory to transfer at once, in bytes
+	@param apsel		MEM-AP to use for memory access
+	@param dap_index	Chain index of the JTAG-DP the MEM-AP is behind
  */
-void ProcessXvcdConnection(TestInterface* iface, Socket& client)
+void ProcessXvcdConnection(Socket& client, const string& peer, uint32_t max_transfer, uint32_t apsel, size_t dap_index)
 {
+	double connected = GetTime();
+	max_transfer = max<uint32_t>(4, max_transfer & ~3);
+
+	//Open the adapter if nobody else has
+	unsigned int generation;
+	bool cold;
+	TestInterface* iface = g_monitor.AddSession(generation, cold);
+	if(!iface)
+	{
+		LogError("Adapter isn't available, dropping client\n");
+		g_monitor.RemoveSession();
+		return;
+	}
+
+	int session_id = g_arbiter.AddSession();
+	auto stats = g_stats.AddSession(session_id, peer);
+
+	//JTAG only, no SWD or GPIO supported
+	auto jface = dynamic_cast<JtagInterface*>(iface);
+
+	//Where the client left the TAP, and whether we're holding on to the adapter because of it
+	XvcTap tap;
+	bool holding = false;
+	uint64_t grants = 0;
+
+	//True if we changed instructions behind the client's back (memory access goes through the DP's IR)
+	bool dirty = false;
+
+	//Gets the adapter, switching to a reconnected one if need be.
+	//Returns true if anyone else had it since we last did.
+	auto acquire = [&]() -> bool
+	{
+		g_arbiter.Acquire(session_id);
+		bool others = (g_arbiter.GetGrantCount() != grants + 1);
+		grants = g_arbiter.GetGrantCount();
+		if(g_monitor.GetGeneration() != generation)
+		{
+			iface = g_monitor.GetInterface(generation);
+			jface = dynamic_cast<JtagInterface*>(iface);
+			others = true;
+			LogNotice("Session %d resumed on reconnected adapter\n", session_id);
+		}
+		stats->Attach(jface);
+		return others;
+	};
+
+	auto release = [&]()
+	{
+		stats->Detach(jface);
+		g_arbiter.Release(session_id);
+	};
+
 	try
 	{
 		//Set no-delay flag
@@ -52,65 +136,234 @@ void ProcessXvcdConnection(TestInterface* iface, Socket& client)
 				"");
 		}
 
-		//Pre-cache casted versions of the interface.
-		//JTAG only, no SWD or GPIO supported
-		auto jface = dynamic_cast<JtagInterface*>(iface);
+		if(!jface)
+		{
+			throw JtagExceptionWrapper(
+				"XVC needs a JTAG adapter",
+				"");
+		}
 
 		//"shift:", 32 bit little endian word, strings of bits
 		//open_hw_target -xvc_url localhost:2542
+		vector<uint8_t> tms;
+		vector<uint8_t> tdi;
+		vector<uint8_t> tdo;
+		vector<uint8_t> block;
+		vector<uint32_t> words;
+		bool first_op = true;
 		while(true)
 		{
-			//Read command (bytes until we get a colon)
-			//All commands are at least six bytes long
-			unsigned char cmdbuf[128] = {0};
-			client.RecvLooped(cmdbuf, 6);
-			LogDebug("start: %s\n", cmdbuf);
-
-			//Should be "getinfo:", read 2 more bytes to make sure
-			if(cmdbuf[0] == 'g')
+			//Read the command. The first two bytes are enough to tell which one it should be.
+			char cmdbuf[16] = {0};
+			if(!client.RecvLooped((unsigned char*)cmdbuf, 2))
+				break;
+			const char* cmd = NULL;
+			for(auto c : XVC_COMMANDS)
 			{
-				client.RecvLooped(cmdbuf+6, 2);
-				LogDebug("command: %s\n", cmdbuf);
-				if(0 != strcmp((char*)cmdbuf, "getinfo:"))
-				{
-					throw JtagExceptionWrapper(
-						"Got a garbage command (expected getinfo, got something else)",
-						"");
-				}
-
-				const char* info = "xvcServer_v1.0:2048\n";
-				LogDebug("sending %s\n", info);
-				client.SendLooped((const unsigned char*)info, strlen(info));
+				if(!strncmp(c, cmdbuf, 2))
+					cmd = c;
 			}
-
-			//Is it a shift command?
-			else if(!strcmp((char*)cmdbuf, "shift:"))
+			if(cmd)
+			{
+				if(!client.RecvLooped((unsigned char*)cmdbuf + 2, strlen(cmd) - 2))
+					break;
+			}
+			if(!cmd || strcmp(cmdbuf, cmd))
 			{
 				throw JtagExceptionWrapper(
-					"shift command not supported",
+					"Got a garbage command",
 					"");
 			}
+			LogDebug("command: %s\n", cmdbuf);
 
-			//Nope, must be settck
-			else
+			if(cmd == XVC_GETINFO)
+			{
+				string info = "xvcServer_v1.1:" + to_string(XVC_MAX_VECTOR_BYTES) + "\n";
+				LogDebug("sending %s", info.c_str());
+				if(!client.SendLooped((const unsigned char*)info.c_str(), info.length()))
+					break;
+			}
+
+			else if(cmd == XVC_SHIFT)
 			{
-				client.RecvLooped(cmdbuf+6, 1);
-				if(0 != strcmp((char*)cmdbuf, "settck:"))
+				uint32_t nbits;
+				if(!client.RecvLooped((unsigned char*)&nbits, 4))
+					break;
+				uint32_t nbytes = (static_cast<uint64_t>(nbits) + 7) / 8;
+				if(nbytes > XVC_MAX_VECTOR_BYTES)
 				{
 					throw JtagExceptionWrapper(
-						"Got a garbage command (expected settck, got something else)",
+						"Shift vector is longer than we said we'd accept",
 						"");
 				}
+				tms.resize(nbytes);
+				tdi.resize(nbytes);
+				tdo.resize(nbytes);
+				if(!client.RecvLooped(tms.data(), nbytes) || !client.RecvLooped(tdi.data(), nbytes))
+					break;
+				stats->AddBytesIn(10 + 2*nbytes);
+
+				//Get the adapter back, and put the chain back the way we left it if anyone else had it since
+				double start = GetTime();
+				if(!holding)
+				{
+					bool others = acquire();
+					holding = true;
+					if(tap.Resume(jface, others || dirty))
+						g_arbiter.InvalidateDeviceStates();
+					dirty = false;
+				}
 
-				//Read the clock speed
+				//Raw IR scans go around everyone's reservations, so native sessions have to load theirs again
+				if(tap.Shift(jface, nbits, tms.data(), tdi.data(), tdo.data()))
+					g_arbiter.InvalidateDeviceStates();
+
+				stats->Update(jface);
+				stats->AddRequest(GetTime() - start);
+				if(first_op)
+				{
+					g_monitor.RecordFirstOp(cold, GetTime() - connected);
+					first_op = false;
+				}
+
+				//Let someone else have the adapter once the chain is somewhere they can pick it up from
+				if(tap.IsStable())
+				{
+					tap.Park(jface);
+					release();
+					holding = false;
+				}
+
+				if(!client.SendLooped(tdo.data(), nbytes))
+					break;
+				stats->AddBytesOut(nbytes);
+			}
+
+			else if(cmd == XVC_SETTCK)
+			{
+				//Read the clock speed.
+				//The adapter is shared, so one client doesn't get to change it for everyone.
 				uint32_t clock_period_ns;
-				client.RecvLooped((unsigned char*)&clock_period_ns, 4);
+				if(!client.RecvLooped((unsigned char*)&clock_period_ns, 4))
+					break;
 				float clock_mhz = 1000.0f / clock_period_ns;
 				LogDebug("Client requested clock period %d ns (%.2f MHz)\n",
 					clock_period_ns, clock_mhz);
 				LogNotice("Ignoring requested clock speed (unimplemented)\n");
 
-				client.SendLooped((unsigned char*)&clock_period_ns, 4);
+				if(!client.SendLooped((unsigned char*)&clock_period_ns, 4))
+					break;
+			}
+
+			//Memory access through a MEM-AP
+			else
+			{
+				bool write = (cmd == XVC_MWR);
+				uint32_t flags;		//reserved
+				uint64_t addr;
+				uint32_t len;
+				if(!client.RecvLooped((unsigned char*)&flags, 4) ||
+					!client.RecvLooped((unsigned char*)&addr, 8) ||
+					!client.RecvLooped((unsigned char*)&len, 4) )
+				{
+					break;
+				}
+				stats->AddBytesIn(20 + (write ? len : 0));
+
+				//Still send (or drain) all the data if it's refused, so we stay in sync with the client
+				string error;
+				if(holding)
+					error = "Memory access in the middle of a scan";
+				else if( (addr & 3) || (len & 3) )
+					error = "Memory access must be whole, aligned words";
+				else if(addr + len > 0x100000000ULL)
+					error = "Memory access is past the end of the address space";
+
+				double start = GetTime();
+				vector<ChainCache::Device> chain;
+				for(uint32_t off = 0; off < len; )
+				{
+					uint32_t n = min(len - off, max_transfer);
+					block.resize(n);
+					if(write && !client.RecvLooped(block.data(), n))
+					{
+						throw JtagExceptionWrapper(
+							"Socket closed",
+							"");
+					}
+
+					if(error.empty())
+					{
+						acquire();
+						try
+						{
+							//Need IR lengths to put everything else in BYPASS.
+							//Discovery starts with a Test-Logic-Reset.
+							if(chain.empty() && !g_chainCache.Peek(chain))
+							{
+								vector<ChainCache::Phase> phases;
+								g_chainCache.GetChain(jface, false, chain, phases);
+								g_arbiter.GetDeviceStates(chain.size());
+								g_arbiter.ResetDeviceStates();
+							}
+
+							if(dap_index >= chain.size())
+								error = "No JTAG-DP at that chain index";
+							else
+							{
+								JtagDapAccessor dap(jface, dap_index, chain);
+								if(write)
+								{
+									words.resize(n / 4);
+									memcpy(words.data(), block.data(), n);
+									dap.WriteMemory(apsel, addr + off, words, error);
+								}
+								else if(dap.ReadMemory(apsel, addr + off, n / 4, words, error))
+									memcpy(block.data(), words.data(), n);
+							}
+						}
+						catch(const JtagException& ex)
+						{
+							error = ex.GetDescription();
+							g_monitor.ReportError();
+						}
+
+						//The DP's instructions went in around everyone's reservations, including our client's
+						g_arbiter.InvalidateDeviceStates();
+						dirty = true;
+						stats->Update(jface);
+						release();
+					}
+
+					if(!write)
+					{
+						if(!error.empty())
+							memset(block.data(), 0, n);
+						if(!client.SendLooped(block.data(), n))
+						{
+							throw JtagExceptionWrapper(
+								"Socket closed",
+								"");
+						}
+					}
+					off += n;
+				}
+
+				if(!error.empty())
+				{
+					LogWarning("Session %d: memory %s of %u bytes at %08llx failed: %s\n",
+						session_id, write ? "write" : "read", len, (unsigned long long)addr, error.c_str());
+				}
+				uint32_t status = error.empty() ? 0 : 1;
+				if(!client.SendLooped((unsigned char*)&status, 4))
+					break;
+				stats->AddBytesOut(4 + (write ? 0 : len));
+				stats->AddRequest(GetTime() - start);
+				if(first_op)
+				{
+					g_monitor.RecordFirstOp(cold, GetTime() - connected);
+					first_op = false;
+				}
 			}
 		}
 	}
@@ -118,7 +371,33 @@ void ProcessXvcdConnection(TestInterface* iface, Socket& client)
 	{
 		//Socket closed? Don't display the message, it just spams the console
 		if(ex.GetDescription().find("Socket closed") == string::npos)
+		{
 			LogError("%s\n", ex.GetDescription().c_str());
+
+			//Save what led up to the failure
+			string path = g_recorder.Dump("session " + to_string(session_id) + " failed: " + ex.GetDescription());
+			if(path != "")
+				LogNotice("Recent adapter operations saved to %s\n", path.c_str());
+
+			//The adapter may have gone away
+			g_monitor.ReportError();
+		}
 		fflush(stdout);
 	}
+
+	//Don't leave the chain mid-scan for the next session
+	try
+	{
+		if(holding && tap.Abandon(jface))
+			g_arbiter.ResetDeviceStates();
+	}
+	catch(const JtagException& ex)
+	{
+		LogError("%s\n", ex.GetDescription().c_str());
+	}
+	if(holding)
+		release();
+	g_stats.RemoveSession(stats);
+	g_arbiter.RemoveSession(session_id);
+	g_monitor.RemoveSession();
 }
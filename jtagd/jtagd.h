@@ -53,7 +53,49 @@
 #include "../../lib/jtaghal/jtaghal.h"
 #include "jtagd_opcodes_enum.h"
 
-void ProcessConnection(TestInterface* iface, Socket& client);
-void ProcessXvcdConnection(TestInterface* iface, Socket& client);
+#include "AdapterEnumeration.h"
+#include "AdapterExecutor.h"
+#include "AdapterMonitor.h"
+#include "ChainArbiter.h"
+#include "ChainCache.h"
+#include "DapAccessor.h"
+#include "FastFrame.h"
+#include "FlightRecorder.h"
+#include "GpioEngine.h"
+#include "ImageCache.h"
+#include "JtagDapAccessor.h"
+#include "LinkShaper.h"
+#include "MessageArena.h"
+#include "PayloadCodec.h"
+#include "RealtimeScheduler.h"
+#include "RelayJtagInterface.h"
+#include "ScanProgram.h"
+#include "SessionCache.h"
+#include "SessionJtagInterface.h"
+#include "SessionStats.h"
+#include "Sha256.h"
+#include "StatsServer.h"
+#include "SwdDapAccessor.h"
+#include "XvcTap.h"
+
+void ProcessConnection(Socket& client, const std::string& peer);
+void ProcessXvcdConnection(
+	Socket& client, const std::string& peer, uint32_t max_transfer, uint32_t apsel, size_t dap_index);
+
+///@brief Opens the adapter at a requested TCK frequency (in Hz) for calibration
+typedef std::function<JtagInterface*(int freq)> CalibrationOpener;
+
+int CalibrateFrequency(const CalibrationOpener& open, int minfreq, int maxfreq, float margin);
+bool LoadCalibration(const std::string& path, const std::string& serial, int& freq);
+bool SaveCalibration(const std::string& path, const std::string& serial, int freq);
+
+extern AdapterMonitor g_monitor;
+extern ImageCache g_imageCache;
+extern ChainCache g_chainCache;
+extern ChainArbiter g_arbiter;
+extern FlightRecorder g_recorder;
+extern RealtimeScheduler g_realtime;
+extern SessionCache g_sessionCache;
+extern StatsServer g_stats;
 
 #endif
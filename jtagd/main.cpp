@@ -34,6 +34,14 @@
  */
 
 #include "jtagd.h"
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <future>
+#include <list>
+#include <poll.h>
+#include <sstream>
+#include <thread>
 
 using namespace std;
 
@@ -41,10 +49,20 @@ void sig_handler(int sig);
 
 bool g_quit = false;
 Socket g_socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+Socket g_xvcSocket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+ImageCache g_imageCache;
+ChainCache g_chainCache;
+ChainArbiter g_arbiter;
+AdapterMonitor g_monitor;
+FlightRecorder g_recorder;
+RealtimeScheduler g_realtime;
+SessionCache g_sessionCache;
+StatsServer g_stats;
 
 void ShowUsage();
 void ShowVersion();
-void ListAdapters();
+void ListAdapters(const string& adapter_cache);
+vector<int> GetActivationSockets(vector<string>& names);
 
 int main(int argc, char* argv[])
 {
@@ -57,10 +75,13 @@ int main(int argc, char* argv[])
 			API_FTDI,
 			API_PIPE,
 			API_GLASGOW,
+			API_RELAY,
 			API_UNSPECIFIED
 		} api_type = API_UNSPECIFIED;
 		string adapter_serial = "";
 		string ftdi_layout = "";
+		string remote_server = "";
+		unsigned short remote_port = 0;
 		unsigned short port = 0;		//random default port
 
 		enum transports
@@ -75,8 +96,53 @@ int main(int argc, char* argv[])
 			PROTO_XVCD
 		} socket_protocol = PROTO_JTAGHAL;
 
+		//Second listener for XVC clients, alongside the one on --port
+		bool xvc_listen = false;
+		unsigned short xvc_port = 0;
+
+		//Largest block of memory an XVC client gets to transfer in one go, in bytes
+		uint32_t xvc_max_transfer = 65536;
+		uint32_t xvc_apsel = 0;
+		size_t xvc_dap_index = 0;
+
 		Severity console_verbosity = Severity::NOTICE;
 
+		//Cache of adapter serial numbers to indexes
+		string adapter_cache = "jtagd-adapters.txt";
+		if(getenv("HOME"))
+			adapter_cache = string(getenv("HOME")) + "/.jtagd-adapters";
+
+		//TCK calibration settings
+		bool calibrate = false;
+		float cal_min = 1;
+		float cal_max = 30;
+		float cal_margin = 20;
+		string cal_file = "jtagd-calibration.txt";
+		if(getenv("HOME"))
+			cal_file = string(getenv("HOME")) + "/.jtagd-calibration";
+
+		//Image cache settings (sizes in MB)
+		size_t cache_mem = 256;
+		size_t cache_disk = 4096;
+		string cache_dir = "";
+
+		//Walk the chain one device at a time instead of in bulk
+		bool chain_walk = false;
+
+		//Emulated WAN link for client sessions
+		LinkShape shape;
+
+		//Control socket for live statistics
+		string stats_socket = "";
+
+		//Open the adapter only when a client connects, and close it after this many idle seconds (0 = never)
+		bool lazy_open = false;
+		double idle_close = 0;
+
+		//Recent operation history for post-mortems
+		size_t flight_entries = FlightRecorder::DEFAULT_CAPACITY;
+		string flight_dir = ".";
+
 		//Operations to do
 		enum
 		{
@@ -113,6 +179,8 @@ int main(int argc, char* argv[])
 					api_type = API_PIPE;
 				else if(sapi == "glasgow")
 					api_type = API_GLASGOW;
+				else if(sapi == "relay")
+					api_type = API_RELAY;
 				else
 				{
 					printf("Unrecognized interface API \"%s\", use --help\n", sapi.c_str());
@@ -161,6 +229,19 @@ int main(int argc, char* argv[])
 			}
 			else if(s == "--help")
 				op = OP_HELP;
+			else if(s == "--idle-close")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				idle_close = atof(argv[++i]);
+			}
+			else if(s == "--lazy-open")
+				lazy_open = true;
 			else if(s == "--list")
 				op = OP_LIST;
 			else if(s == "--port")
@@ -185,6 +266,28 @@ int main(int argc, char* argv[])
 
 				adapter_serial = argv[++i];
 			}
+			else if(s == "--flight-recorder")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				flight_entries = strtoul(argv[++i], NULL, 10);
+			}
+			else if(s == "--flight-dir")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				flight_dir = argv[++i];
+			}
 			else if(s == "--ftdi_layout")
 			{
 				if(i+1 >= argc)
@@ -196,8 +299,281 @@ int main(int argc, char* argv[])
 
 				ftdi_layout = argv[++i];
 			}
+			else if(s == "--remote")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				string sremote = argv[++i];
+				size_t colon = sremote.rfind(':');
+				if(colon == string::npos)
+				{
+					printf("--remote must be HOST:PORT, use --help\n");
+					return 1;
+				}
+				remote_server = sremote.substr(0, colon);
+				remote_port = atoi(sremote.c_str() + colon + 1);
+			}
+			else if(s == "--adapter-cache")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				adapter_cache = argv[++i];
+			}
+			else if(s == "--calibrate")
+				calibrate = true;
+			else if(s == "--calibrate-min")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				cal_min = atof(argv[++i]);
+			}
+			else if(s == "--calibrate-max")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				cal_max = atof(argv[++i]);
+			}
+			else if(s == "--calibrate-margin")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				cal_margin = atof(argv[++i]);
+			}
+			else if(s == "--calibration-file")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				cal_file = argv[++i];
+			}
+			else if(s == "--cache-mem")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				cache_mem = atoi(argv[++i]);
+			}
+			else if(s == "--chain-discovery")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				string mode = argv[++i];
+				if(mode == "bulk")
+					chain_walk = false;
+				else if(mode == "walk")
+					chain_walk = true;
+				else
+				{
+					printf("Unrecognized chain discovery mode \"%s\", use --help\n", mode.c_str());
+					return 1;
+				}
+			}
+			else if(s == "--cache-dir")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				cache_dir = argv[++i];
+			}
+			else if(s == "--cache-disk")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				cache_disk = atoi(argv[++i]);
+			}
+			else if(s == "--shape-latency")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				shape.m_latency = atof(argv[++i]) / 1000;
+			}
+			else if(s == "--shape-jitter")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				shape.m_jitter = atof(argv[++i]) / 1000;
+			}
+			else if(s == "--shape-bandwidth")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				shape.m_bandwidth = atof(argv[++i]) * 1E6 / 8;
+			}
+			else if(s == "--shape-seed")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				shape.m_seed = strtoul(argv[++i], NULL, 10);
+			}
+			else if(s == "--session-lifetime")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				g_sessionCache.SetLifetime(atof(argv[++i]));
+			}
+			else if(s == "--stats-socket")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				stats_socket = argv[++i];
+			}
+			else if(s == "--realtime")
+				g_realtime.SetEnabled(true);
+			else if( (s == "--realtime-adapter-cpus") || (s == "--realtime-network-cpus") )
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				vector<int> cpus;
+				if(!RealtimeScheduler::ParseCpuList(argv[++i], cpus))
+				{
+					printf("%s must be a list of cores like 2,3 or 4-7, use --help\n", s.c_str());
+					return 1;
+				}
+				if(s == "--realtime-adapter-cpus")
+					g_realtime.SetCpus(RealtimeScheduler::ROLE_ADAPTER, cpus);
+				else
+					g_realtime.SetCpus(RealtimeScheduler::ROLE_NETWORK, cpus);
+			}
+			else if(s == "--realtime-priority")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				g_realtime.SetPriority(atoi(argv[++i]));
+			}
 			else if(s == "--version")
 				op = OP_VERSION;
+			else if(s == "--xvc-port")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				xvc_listen = true;
+				xvc_port = atoi(argv[++i]);
+			}
+			else if(s == "--xvc-max-transfer")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				xvc_max_transfer = strtoul(argv[++i], NULL, 10);
+			}
+			else if(s == "--xvc-apsel")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				xvc_apsel = strtoul(argv[++i], NULL, 0);
+			}
+			else if(s == "--xvc-dap-index")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				xvc_dap_index = strtoul(argv[++i], NULL, 10);
+			}
 			else
 			{
 				printf("Unrecognized command-line argument \"%s\", use --help\n", s.c_str());
@@ -216,7 +592,7 @@ int main(int argc, char* argv[])
 				return 0;
 
 			case OP_LIST:
-				ListAdapters();
+				ListAdapters(adapter_cache);
 				return 0;
 
 			case OP_VERSION:
@@ -231,126 +607,250 @@ int main(int argc, char* argv[])
 		ShowVersion();
 
 		//Sanity check
-		if( (api_type == API_UNSPECIFIED) || (adapter_serial == "") )
+		if(api_type == API_RELAY)
+		{
+			if(remote_server == "")
+			{
+				LogError("ERROR: --remote is required if using --api relay\n");
+				return 1;
+			}
+		}
+		else if( (api_type == API_UNSPECIFIED) || (adapter_serial == "") )
 		{
 			LogError("ERROR: --api and --serial are required\n");
 			return 1;
 		}
 
-		//Start up the requested API
-		TestInterface* iface = NULL;
-		switch(api_type)
+		g_recorder.SetCapacity(flight_entries);
+		g_recorder.SetDirectory(flight_dir);
+
+		//SIGUSR1/2 are handled by the statistics thread, so they have to be blocked before any other threads exist
+		StatsServer::BlockSignals();
+
+		//Switch to real-time scheduling before opening the adapter, so any threads the driver starts inherit it
+		if(g_realtime.IsEnabled())
 		{
-			case API_FTDI:
-				#ifdef HAVE_FTD2XX
-					if(ftdi_layout == "")
-					{
-						LogError("--ftdi_layout must be specified if using --api ftdi\n");
-						return 1;
-					}
-					if(transport_type == TRANSPORT_JTAG)
-						iface = new FTDIJtagInterface(adapter_serial, ftdi_layout);
-					//FTDISWDInterface isn't finished and still has pure virtuals
-					//else if(transport_type == TRANSPORT_SWD)
-					//	iface = new FTDISWDInterface(adapter_serial, ftdi_layout);
-					else
-					{
-						LogError("Unsupported transport for FTDI API (only JTAG/SWD supported\n");
-						return 1;
-					}
-				#else
-					LogError("This jtagd was compiled without libftd2xx support\n");
-					return 1;
-				#endif
-				break;
+			LogNotice("Using real-time scheduling\n");
+			g_realtime.ApplyProcess();
+			g_realtime.ApplyThread(RealtimeScheduler::ROLE_NETWORK);
+		}
 
-			case API_DIGILENT:
-				#ifdef HAVE_DJTG
-				{
-					//Search for the interface
-					int nif = -1;
-					int ndigilent = DigilentJtagInterface::GetInterfaceCount();
-					for(int i=0; i<ndigilent; i++)
-					{
-						try
+		//Start up the requested API. The same adapter is reopened this way if it's lost later on.
+		auto open = [=](bool quiet) -> TestInterface*
+		{
+			switch(api_type)
+			{
+				case API_FTDI:
+					#ifdef HAVE_FTD2XX
+						if(ftdi_layout == "")
 						{
-							DigilentJtagInterface iface_tmp(i);
-							if(iface_tmp.GetSerial() == adapter_serial)
-							{
-								nif = i;
-								break;
-							}
+							LogError("--ftdi_layout must be specified if using --api ftdi\n");
+							return NULL;
 						}
-						catch(const JtagException& e)
+						if(transport_type == TRANSPORT_JTAG)
+							return new FTDIJtagInterface(adapter_serial, ftdi_layout);
+						//FTDISWDInterface isn't finished and still has pure virtuals
+						//else if(transport_type == TRANSPORT_SWD)
+						//	return new FTDISWDInterface(adapter_serial, ftdi_layout);
+						else
 						{
-							//just write off this adapter - maybe someone else is using it!
+							LogError("Unsupported transport for FTDI API (only JTAG/SWD supported\n");
+							return NULL;
 						}
-					}
+					#else
+						LogError("This jtagd was compiled without libftd2xx support\n");
+						return NULL;
+					#endif
 
-					//Sanity check
-					if(nif < 0)
+				case API_DIGILENT:
+					#ifdef HAVE_DJTG
 					{
-						LogError(
-							"Requested Digilent adapter with serial number \"%s\" was not found!\n"
-							"Use --list to see currently connected adapters\n",
-							adapter_serial.c_str());
+						if(transport_type != TRANSPORT_JTAG)
+						{
+							LogError("Unsupported transport for Digilent API (only JTAG supported\n");
+							return NULL;
+						}
+
+						//Search for the interface, at the calibrated TCK frequency if we have one
+						int freq = 0;
+						if(LoadCalibration(cal_file, adapter_serial, freq) && !quiet)
+							LogNotice("Using calibrated TCK frequency %.2f MHz\n", freq / 1E6);
+						TestInterface* iface = OpenDigilentInterface(adapter_serial, adapter_cache, freq);
+						if( (iface == NULL) && !quiet)
+						{
+							LogError(
+								"Requested Digilent adapter with serial number \"%s\" was not found!\n"
+								"Use --list to see currently connected adapters\n",
+								adapter_serial.c_str());
+						}
+						return iface;
 					}
+					#else	//#ifdef HAVE_DJTG
+						LogError("This jtagd was compiled without Digilent API support\n");
+						return NULL;
+					#endif
 
-					//Create the interface
+				case API_PIPE:
 					if(transport_type == TRANSPORT_JTAG)
-						iface = new DigilentJtagInterface(nif);
+						return new PipeJtagInterface;
 					else
 					{
-						LogError("Unsupported transport for FTDI API (only JTAG supported\n");
-						return 1;
+						LogError("Unsupported transport for pipe API (only JTAG supported\n");
+						return NULL;
 					}
-				}
-				#else	//#ifdef HAVE_DJTG
-					LogError("This jtagd was compiled without Digilent API support\n");
-				#endif
-				break;
 
-			case API_PIPE:
-				if(transport_type == TRANSPORT_JTAG)
-					iface = new PipeJtagInterface;
-				else
-				{
-					LogError("Unsupported transport for pipe API (only JTAG supported\n");
-					return 1;
-				}
-				break;
+				case API_GLASGOW:
+					#ifdef HAVE_LIBUSB
+						if(transport_type == TRANSPORT_SWD)
+							return new GlasgowSWDInterface(adapter_serial);
+						else
+						{
+							LogError("Unsupported transport for Glasgow API (only SWD supported\n");
+							return NULL;
+						}
+					#else	//ifdef HAVE_LIBUSB
+						LogError("This jtagd was compiled without libusb support\n");
+						return NULL;
+					#endif
 
-			case API_GLASGOW:
-				#ifdef HAVE_LIBUSB
-					if(transport_type == TRANSPORT_SWD)
-						iface = new GlasgowSWDInterface(adapter_serial);
+				case API_RELAY:
+					if(transport_type == TRANSPORT_JTAG)
+					{
+						LogNotice("Relaying to %s:%d\n", remote_server.c_str(), remote_port);
+						return new RelayJtagInterface(remote_server, remote_port);
+					}
 					else
 					{
-						LogError("Unsupported transport for Glasgow API (only SWD supported\n");
-						return 1;
+						LogError("Unsupported transport for relay API (only JTAG supported\n");
+						return NULL;
 					}
-				#else	//ifdef HAVE_LIBUSB
-					LogError("This jtagd was compiled without libusb support\n");
+
+				default:
+					LogError("Unrecognized API\n");
+					return NULL;
+			}
+		};
+
+		//Opens the adapter and reports which one we got
+		auto prepare = [=](bool quiet) -> TestInterface*
+		{
+			TestInterface* iface = open(quiet);
+			if(!iface)
+				return NULL;
+
+			LogNotice("Connected to interface \"%s\" (serial number \"%s\")\n",
+				iface->GetName().c_str(), iface->GetSerial().c_str());
+			return iface;
+		};
+
+		//Find the highest reliable TCK frequency and exit.
+		//The clock can only be chosen at open time, so the adapter is reopened for every frequency tried.
+		if(calibrate)
+		{
+			if( (api_type != API_DIGILENT) || (transport_type != TRANSPORT_JTAG) )
+			{
+				LogError("--calibrate is only supported with --api digilent\n");
+				return 1;
+			}
+
+			auto opener = [&](int freq) -> JtagInterface*
+			{
+				#ifdef HAVE_DJTG
+					return OpenDigilentInterface(adapter_serial, adapter_cache, freq);
+				#else
+					LogError("This jtagd was compiled without Digilent API support\n");
+					return NULL;
 				#endif
-				break;
+			};
+			int freq = CalibrateFrequency(opener, cal_min * 1E6, cal_max * 1E6, cal_margin / 100);
+			if(freq == 0)
+				return 1;
 
-			default:
-				LogError("Unrecognized API\n");
+			if(!SaveCalibration(cal_file, adapter_serial, freq))
+			{
+				LogError("Failed to save calibration to %s\n", cal_file.c_str());
 				return 1;
+			}
+			LogNotice("Saved calibration for \"%s\" to %s\n", adapter_serial.c_str(), cal_file.c_str());
+			return 0;
 		}
 
-		LogNotice("Connected to interface \"%s\" (serial number \"%s\")\n",
-			iface->GetName().c_str(), iface->GetSerial().c_str());
+		//In lazy mode the first client to connect opens the adapter
+		TestInterface* iface = NULL;
+		if(lazy_open)
+			LogNotice("Adapter will be opened when the first client connects\n");
+		else
+		{
+			iface = prepare(false);
+			if(!iface)
+				return 1;
+		}
+
+		//Set up the image cache
+		g_imageCache.SetMemoryLimit(cache_mem * 1024 * 1024);
+		if(cache_dir != "")
+			g_imageCache.SetDiskCache(cache_dir, cache_disk * 1024 * 1024);
+		g_chainCache.SetBulkDiscovery(!chain_walk);
+
+		//Start reporting live statistics
+		g_stats.Start(stats_socket);
 
 		//Install signal handler
 		signal(SIGINT, sig_handler);
 		signal(SIGPIPE, sig_handler);
 
-		//Create the socket server
-		g_socket.Bind(port);
+		//Create the socket servers, unless our service manager already did.
+		//Of those, the one named "xvc" (or the second one, if none is) takes XVC clients.
+		vector<string> names;
+		vector<int> activated = GetActivationSockets(names);
+		if(!activated.empty())
+		{
+			LogNotice("    Using listening sockets passed in by the service manager\n");
+			size_t ixvc = find(names.begin(), names.end(), "xvc") - names.begin();
+			if( (ixvc >= activated.size()) && (activated.size() > 1) )
+				ixvc = 1;
+			int fd = -1;
+			xvc_listen = false;
+			for(size_t i=0; i<activated.size(); i++)
+			{
+				if(i == ixvc)
+				{
+					g_xvcSocket = Socket(activated[i], AF_INET6);
+					xvc_listen = true;
+				}
+				else if(fd < 0)
+					fd = activated[i];
+				else
+				{
+					LogWarning("Ignoring extra listening socket %d\n", activated[i]);
+					close(activated[i]);
+				}
+			}
+			if(fd < 0)
+			{
+				LogError("Service manager only passed in an XVC socket\n");
+				delete iface;
+				return 1;
+			}
+			g_socket = Socket(fd, AF_INET6);
+		}
+		else
+		{
+			g_socket.Bind(port);
+			if(xvc_listen)
+			{
+				if(!g_xvcSocket.Bind(xvc_port))
+				{
+					LogError("Failed to bind XVC port %u\n", xvc_port);
+					delete iface;
+					return 1;
+				}
+				LogNotice("    Listening for XVC clients on port %u\n", xvc_port);
+			}
+		}
 
 		//Figure out the port number
-		if(port == 0)
+		if( (port == 0) && activated.empty() )
 		{
 			sockaddr_in buf;
 			socklen_t len = sizeof(buf);
@@ -374,35 +874,109 @@ int main(int argc, char* argv[])
 			fclose(fp);
 		}
 
-		//Wait for connections
+		if(shape.IsEnabled())
+		{
+			LogNotice("Shaping client links: %.1f ms latency, %.1f ms jitter\n",
+				shape.m_latency * 1000, shape.m_jitter * 1000);
+			if(shape.m_bandwidth > 0)
+				LogNotice("    Bandwidth limited to %.2f Mbps\n", shape.m_bandwidth * 8 / 1E6);
+		}
+
+		//Watch for the adapter going away, and reopen it when it comes back (USB adapters only)
+		bool hotplug = (api_type == API_DIGILENT) || (api_type == API_FTDI) || (api_type == API_GLASGOW);
+		g_monitor.SetIdleTimeout(idle_close);
+		g_monitor.Start(iface, prepare, hotplug);
+
+		//Wait for connections on both ports.
+		//Every session runs on its own thread, native protocol and XVC alike, and they share the adapter through
+		//g_arbiter.
 		g_socket.Listen();
-		while(true)
+		if(xvc_listen)
+			g_xvcSocket.Listen();
+		list< pair< thread, shared_ptr< atomic<bool> > > > sessions;
+		while(!g_quit)
 		{
-			try
+			//Time out once in a while, in case SIGINT closes the sockets just before we start waiting on them
+			pollfd fds[2];
+			fds[0].fd = g_socket;
+			fds[0].events = POLLIN;
+			fds[0].revents = 0;
+			fds[1].fd = xvc_listen ? static_cast<int>(g_xvcSocket) : -1;
+			fds[1].events = POLLIN;
+			fds[1].revents = 0;
+			if(poll(fds, 2, 1000) < 0)
 			{
-				Socket client = g_socket.Accept();
-				if(!client.IsValid())
-					break;
-				LogNotice("Client connected\n");
-				switch(socket_protocol)
-				{
-					case PROTO_JTAGHAL:
-						ProcessConnection(iface, client);
-						break;
-					case PROTO_XVCD:
-						ProcessXvcdConnection(iface, client);
-						break;
-				}
-				LogNotice("Client disconnected\n");
+				if(errno == EINTR)
+					continue;
+				break;
 			}
-			catch(const JtagException& ex)
+
+			for(int i=0; i<2; i++)
 			{
-				break;
+				if(!(fds[i].revents & POLLIN))
+					continue;
+				bool xvc = (i == 1) || (socket_protocol == PROTO_XVCD);
+
+				try
+				{
+					Socket client = (i == 1) ? g_xvcSocket.Accept() : g_socket.Accept();
+					if(!client.IsValid())
+						continue;
+					string peer = StatsServer::GetPeerName(client);
+					LogNotice("%s client connected from %s\n", xvc ? "XVC" : "Client", peer.c_str());
+
+					//Clean up after sessions that have ended
+					for(auto it = sessions.begin(); it != sessions.end(); )
+					{
+						if(*it->second)
+						{
+							it->first.join();
+							it = sessions.erase(it);
+						}
+						else
+							++it;
+					}
+
+					//Route the session through the emulated link if requested
+					unique_ptr<LinkShaper> shaper;
+					if(shape.IsEnabled())
+					{
+						shaper.reset(new LinkShaper(shape));
+						client = shaper->Start(move(client));
+					}
+
+					//The thread owns the shaper (if any) so it lives exactly as long as the session
+					auto done = make_shared< atomic<bool> >(false);
+					thread t([done, peer, xvc, xvc_max_transfer, xvc_apsel, xvc_dap_index]
+						(Socket client, unique_ptr<LinkShaper>)
+						{
+							if(xvc)
+								ProcessXvcdConnection(client, peer, xvc_max_transfer, xvc_apsel, xvc_dap_index);
+							else
+								ProcessConnection(client, peer);
+							LogNotice("Client disconnected\n");
+							*done = true;
+						},
+						move(client), move(shaper));
+					sessions.push_back(make_pair(move(t), done));
+				}
+				catch(const JtagException& ex)
+				{
+					//Drop this client (its socket is closed on the way out) but keep serving everyone else.
+					//SIGINT closing the listening sockets ends up here too, and has already set g_quit.
+					if(!g_quit)
+						LogError("Failed to set up client session: %s\n", ex.GetDescription().c_str());
+				}
 			}
 		}
+		g_monitor.Stop();
+		for(auto& s : sessions)
+			s.first.join();
+		g_stats.Stop();
+		iface = g_monitor.GetInterface();
 
-		//Print interface statistics
-		if(transport_type == TRANSPORT_JTAG)
+		//Print interface statistics (for the adapter as it is now, if it's open)
+		if( (transport_type == TRANSPORT_JTAG) && iface)
 		{
 			auto jf = dynamic_cast<JtagInterface*>(iface);
 			LogNotice("Total number of shift operations:       %zu\n", jf->GetShiftOpCount());
@@ -419,8 +993,65 @@ int main(int argc, char* argv[])
 			LogNotice("Calculated average latency:             %.2f ms\n", (latency * 1000) / jf->GetShiftOpCount());
 		}
 
+		//Print startup statistics
+		size_t opens = g_monitor.GetOpenCount();
+		auto cold = g_monitor.GetStartupStats(true);
+		auto warm = g_monitor.GetStartupStats(false);
+		if(cold.m_count || warm.m_count)
+		{
+			LogNotice("Adapter opened:                         %zu times\n", opens);
+			LogNotice("Connect to first op, cold (mean / max): %.2f / %.2f ms (%zu sessions)\n",
+				cold.GetMean() * 1000, cold.m_max * 1000, cold.m_count);
+			LogNotice("Connect to first op, warm (mean / max): %.2f / %.2f ms (%zu sessions)\n",
+				warm.GetMean() * 1000, warm.m_max * 1000, warm.m_count);
+		}
+
+		//Print scheduling statistics
+		if(g_realtime.GetWakeupCount())
+		{
+			LogNotice("Adapter thread wakeups:                 %zu\n", g_realtime.GetWakeupCount());
+			LogNotice("Wakeup latency (mean / p99 / max):      %.1f / %.1f / %.1f us\n",
+				g_realtime.GetMeanWakeupLatency() * 1E6,
+				g_realtime.GetWakeupLatencyPercentile(0.99) * 1E6,
+				g_realtime.GetMaxWakeupLatency() * 1E6);
+		}
+
+		//Print image cache statistics
+		size_t hits = g_imageCache.GetHitCount();
+		size_t offers = hits + g_imageCache.GetMissCount();
+		if(offers)
+		{
+			LogNotice("Image cache hits:                       %zu / %zu (%.1f %%)\n",
+				hits, offers, hits * 100.0 / offers);
+			LogNotice("Image upload traffic saved:             %.2f MB\n", g_imageCache.GetBytesSaved() / 1048576.0);
+		}
+
+		//Print chain cache statistics
+		size_t walks = g_chainCache.GetScanCount();
+		if(walks)
+		{
+			LogNotice("Chain walks (cached lookups):           %zu (%zu)\n", walks, g_chainCache.GetHitCount());
+		}
+
+		//Print session resumption statistics
+		size_t resumes = g_sessionCache.GetResumeCount();
+		if(resumes)
+			LogNotice("Sessions resumed:                       %zu\n", resumes);
+
+		//Print relay statistics
+		auto relay = dynamic_cast<RelayJtagInterface*>(iface);
+		if(relay)
+		{
+			size_t syncs = relay->GetSyncCount();
+			size_t trips = relay->GetRoundTripCount();
+			LogNotice("Client sync points:                     %zu\n", syncs);
+			LogNotice("Remote round trips:                     %zu\n", trips);
+			LogNotice("Round trips saved:                      %zu\n", (syncs > trips) ? (syncs - trips) : 0);
+			LogNotice("Write-only shifts coalesced:            %zu\n", relay->GetCoalescedCount());
+		}
+
 		//Clean up
-		delete iface;
+		g_monitor.Close();
 	}
 	catch(const JtagException& ex)
 	{
@@ -437,7 +1068,8 @@ void sig_handler(int sig)
 	{
 		case SIGINT:
 			g_quit = true;
-			close(g_socket.Detach());	//forcibly close the socket to terminate all in-progress IO
+			close(g_socket.Detach());	//forcibly close the sockets to terminate all in-progress IO
+			close(g_xvcSocket.Detach());
 			LogNotice("Quitting...\n");
 			break;
 
@@ -456,23 +1088,119 @@ void ShowUsage()
 		"Usage: jtagd [OPTION]\n"
 		"\n"
 		"Arguments:\n"
-		"    --api digilent|ftdi|glasgow|pipe                 Specifies the driver to use for connecting to the debug adapter.\n"
-		"                                                       This argument is mandatory.\n"
+		"    --adapter-cache PATH                             Where to cache adapter serial number lookups (default ~/.jtagd-adapters).\n"
+		"                                                       The cache is discarded whenever USB devices are added or removed.\n"
+		"    --api digilent|ftdi|glasgow|pipe|relay           Specifies the driver to use for connecting to the debug adapter.\n"
+		"                                                       This argument is mandatory. relay forwards everything to another\n"
+		"                                                       jtagd (see --remote), hiding as much WAN latency as it can.\n"
+		"    --calibrate                                      Finds the highest reliable TCK frequency for this adapter and target,\n"
+		"                                                       saves it to the calibration file, and exits. Later runs with the same\n"
+		"                                                       adapter use the saved frequency. Digilent adapters only.\n"
+		"    --calibrate-min MHz                              Lowest frequency to test when calibrating (default 1 MHz).\n"
+		"    --calibrate-max MHz                              Highest frequency to test when calibrating (default 30 MHz).\n"
+		"    --calibrate-margin PERCENT                       Safety margin below the highest passing frequency (default 20%%).\n"
+		"    --calibration-file PATH                          Where to store calibration results (default ~/.jtagd-calibration).\n"
+		"    --cache-dir DIR                                  Stores uploaded images in DIR so they persist across restarts.\n"
+		"    --cache-disk MB                                  Maximum size of the on-disk image cache (default 4096 MB).\n"
+		"    --cache-mem MB                                   Maximum size of the in-memory image cache (default 256 MB).\n"
+		"    --chain-discovery bulk|walk                      How to discover the scan chain for clients (default bulk).\n"
+		"                                                       bulk reads the whole chain in three scans, walk asks the library\n"
+		"                                                       to probe one device at a time.\n"
+		"    --flight-dir DIR                                 Where flight recorder dumps are written (default current directory).\n"
+		"    --flight-recorder N                              Keeps the last N adapter operations in memory (default 16384, 0 = off).\n"
+		"                                                       They're saved to a file when a session fails, on SIGUSR2, or when\n"
+		"                                                       \"flight\" is sent to the statistics socket.\n"
 		"    --ftdi_layout LAYOUT                             Specifies the FTDI adapter configuration to use. This argument is mandatory\n"
 		"                                                       if --api ftdi is specified.\n"
 		"                                                     Legal values: jtagkey, hs1\n"
-		"    --protocol jtaghal|xvcd                          Specifies the socket protocol to use.\n"
+		"    --proto jtaghal|xvcd                             Specifies the socket protocol to use on --port.\n"
 		"                                                       jtaghal: high level protobuf based, supports metadata\n"
 		"                                                       xvcd: low level protocol compatible with Xilinx XVC protocol\n"
+		"    --stats-socket PATH                              Serves live per-session statistics as JSON on a local socket at PATH.\n"
+		"                                                       Send \"reset\" to also zero the counters. A summary is logged on\n"
+		"                                                       SIGUSR1 whether or not this is given.\n"
 		"    --transport jtag|swd                             Specifies the protocol the target speaks (JTAG or SWD). Defaults to JTAG.\n"
 		"                                                       Some adapters or targets may only support one mode; some support both.\n"
 		"    --help                                           Displays this message and exits.\n"
+		"    --idle-close SECONDS                             Closes the adapter once no client has used it for SECONDS, and opens\n"
+		"                                                       it again when the next one connects.\n"
+		"    --lazy-open                                      Doesn't open the adapter until the first client connects.\n"
+		"                                                       Listening sockets passed in by systemd socket activation\n"
+		"                                                       (LISTEN_FDS) are always used instead of --port.\n"
 		"    --list                                           Prints a listing of connected adapters and exits.\n"
 		"    --port PORT                                      Specifies the port number the daemon should listen on.\n"
-		"    --serial SERIAL_NUM                              Specifies the serial number of the debug adapter. This argument is mandatory.\n"
+		"    --realtime                                       Locks all memory and runs adapter and network threads under SCHED_FIFO\n"
+		"                                                       for predictable per-op latency. Needs CAP_SYS_NICE and CAP_IPC_LOCK\n"
+		"                                                       (or matching rlimits); without them jtagd warns and runs normally.\n"
+		"    --realtime-adapter-cpus LIST                     Pins adapter threads to the given cores (e.g. 2 or 2,3 or 2-3).\n"
+		"    --realtime-network-cpus LIST                     Pins network threads to the given cores.\n"
+		"    --realtime-priority N                            SCHED_FIFO priority of adapter threads (default 40, max 49).\n"
+		"                                                       Network threads run one below.\n"
+		"    --remote HOST:PORT                               Address of the jtagd to forward to. This argument is mandatory\n"
+		"                                                       if --api relay is specified.\n"
+		"    --serial SERIAL_NUM                              Specifies the serial number of the debug adapter. This argument is mandatory\n"
+		"                                                       unless --api relay is specified.\n"
+		"    --session-lifetime SECONDS                       How long a disconnected client can resume its session (default 60, 0 = off).\n"
+		"                                                       A resumed session keeps its reservation, loaded instructions,\n"
+		"                                                       scan programs and images, and gets the chain without a rescan.\n"
+		"    --shape-bandwidth MBPS                           Limits client sessions to MBPS megabits per second in each direction.\n"
+		"    --shape-jitter MS                                Adds random delay (standard deviation MS milliseconds) to client traffic.\n"
+		"    --shape-latency MS                               Delays all client traffic by MS milliseconds in each direction.\n"
+		"                                                       The --shape options emulate a WAN link for benchmarking clients.\n"
+		"    --shape-seed N                                   Seed for the jitter generator (default 1), for reproducible runs.\n"
+		"    --xvc-port PORT                                  Also listens for XVC clients on PORT (usually 2542), so Vivado and\n"
+		"                                                       jtaghal clients can use the adapter at the same time. Each XVC\n"
+		"                                                       shift vector runs without interruption. With socket activation,\n"
+		"                                                       the socket named \"xvc\" (or the second one) is used instead.\n"
+		"    --xvc-apsel N                                    MEM-AP that XVC 1.1 clients' mrd/mwr commands access (default 0).\n"
+		"    --xvc-dap-index N                                Chain index of the JTAG-DP that --xvc-apsel is behind (default 0).\n"
+		"    --xvc-max-transfer BYTES                         Largest block of memory an XVC 1.1 client's mrd/mwr commands move\n"
+		"                                                       in one go (default 65536). Bigger requests are streamed in\n"
+		"                                                       blocks this size, letting other sessions in between.\n"
 		);
 }
 
+/**
+	@brief Gets listening sockets passed in by a service manager (systemd socket activation protocol)
+
+	@param names	Set to the names of the sockets (FileDescriptorName=), if the service manager gave any
+
+	@return The file descriptors, or nothing if we weren't started that way
+ */
+vector<int> GetActivationSockets(vector<string>& names)
+{
+	//SD_LISTEN_FDS_START
+	const int first = 3;
+
+	vector<int> fds;
+	const char* spid = getenv("LISTEN_PID");
+	const char* sfds = getenv("LISTEN_FDS");
+	if(!spid || !sfds || (atoi(spid) != getpid()) )
+		return fds;
+
+	int n = atoi(sfds);
+	for(int i=0; i<n; i++)
+	{
+		fcntl(first + i, F_SETFD, FD_CLOEXEC);
+		fds.push_back(first + i);
+	}
+
+	const char* snames = getenv("LISTEN_FDNAMES");
+	if(snames)
+	{
+		stringstream ss(snames);
+		string name;
+		while(getline(ss, name, ':'))
+			names.push_back(name);
+	}
+
+	//Don't pass them on to anything we start
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	return fds;
+}
+
 /**
 	@brief Prints program version number
  */
@@ -490,44 +1218,50 @@ void ShowVersion()
 
 /**
 	@brief Lists the connected JTAG adapters
+
+	@param adapter_cache	Path to the adapter index cache, which is refreshed as a side effect
  */
-void ListAdapters()
+void ListAdapters(const string& adapter_cache)
 {
 	try
 	{
 		ShowVersion();
 
+		//Query all of the APIs at once, some of them are slow
+		auto digilent = async(launch::async, EnumerateDigilentAdapters);
+		auto ftdi = async(launch::async, EnumerateFTDIAdapters);
+		auto glasgow = async(launch::async, EnumerateGlasgowAdapters);
+
 		//disable compiler warning if no APIs are found
 		#if( defined(HAVE_DJTG) || defined(HAVE_FTD2XX) || defined(HAVE_LIBUSB) )
 			string ver;
-			int ndev = 0;
 		#endif
 
 		#ifdef HAVE_DJTG
+			//Wait for the enumeration first, so only one thread is in the Adept runtime at a time
+			auto dlist = digilent.get();
 			ver = DigilentJtagInterface::GetAPIVersion();
 			LogNotice("Digilent API version: %s\n", ver.c_str());
-			ndev = DigilentJtagInterface::GetInterfaceCount();
-			LogNotice("    Enumerating interfaces... %d found\n", ndev);
-			if(ndev == 0)
+			SaveAdapterIndexCache(adapter_cache, "digilent", dlist.m_adapters);
+			LogNotice("    Enumerating interfaces... %d found\n", dlist.m_count);
+			if(dlist.m_count == 0)
 				LogNotice("No interfaces found\n");
 			else
 			{
 				LogIndenter li;
-				for(int i=0; i<ndev; i++)
+				for(auto& a : dlist.m_adapters)
 				{
-					try
-					{
-						DigilentJtagInterface iface(i);
-						LogNotice("Interface %d: %s\n", i, iface.GetName().c_str());
-						LogIndenter li;
-						LogNotice("Serial number:  %s\n", iface.GetSerial().c_str());
-						LogNotice("User ID:        %s\n", iface.GetUserID().c_str());
-						LogNotice("Default clock:  %.2f MHz\n", iface.GetFrequency()/1000000.0f);
-					}
-					catch(const JtagException& e)
+					if(!a.m_ok)
 					{
-						LogNotice("Interface %d: Could not be opened, maybe another jtagd instance is using it?\n", i);
+						LogNotice("Interface %d: Could not be opened, maybe another jtagd instance is using it?\n", a.m_index);
+						continue;
 					}
+
+					LogNotice("Interface %d: %s\n", a.m_index, a.m_name.c_str());
+					LogIndenter li;
+					LogNotice("Serial number:  %s\n", a.m_serial.c_str());
+					LogNotice("User ID:        %s\n", a.m_userid.c_str());
+					LogNotice("Default clock:  %.2f MHz\n", a.m_freq/1000000.0f);
 				}
 			}
 		#else	//#ifdef HAVE_DJTG
@@ -538,32 +1272,28 @@ void ListAdapters()
 		#ifdef HAVE_FTD2XX
 			ver = FTDIJtagInterface::GetAPIVersion();
 			LogNotice("FTDI API version: %s\n", ver.c_str());
-			ndev = FTDIJtagInterface::GetInterfaceCount();
-			LogNotice("    Enumerating interfaces... %d found\n", ndev);
-			if(ndev == 0)
+			auto flist = ftdi.get();
+			LogNotice("    Enumerating interfaces... %d found\n", flist.m_count);
+			if(flist.m_count == 0)
 				LogNotice("No interfaces found\n");
 			else
 			{
 				int idev = 0;
 				LogIndenter li;
-				for(int i=0; i<ndev; i++)
+				for(auto& a : flist.m_adapters)
 				{
-					try
-					{
-						if(FTDIJtagInterface::IsMPSSECapable(i))
-						{
-							LogNotice("Interface %d: %s\n", idev, FTDIJtagInterface::GetDescription(i).c_str());
-							LogIndenter li;
-							LogNotice("Serial number:  %s\n", FTDIJtagInterface::GetSerialNumber(i).c_str());
-							LogNotice("User ID:        %s\n", FTDIJtagInterface::GetSerialNumber(i).c_str());
-							LogNotice("Default clock:  %.2f MHz\n", FTDIJtagInterface::GetDefaultFrequency(i)/1000000.0f);
-							idev++;
-						}
-					}
-					catch(const JtagException& e)
+					if(!a.m_ok)
 					{
-						LogNotice("Interface %d: Error getting device information\n", i);
+						LogNotice("Interface %d: Error getting device information\n", a.m_index);
+						continue;
 					}
+
+					LogNotice("Interface %d: %s\n", idev, a.m_name.c_str());
+					LogIndenter li;
+					LogNotice("Serial number:  %s\n", a.m_serial.c_str());
+					LogNotice("User ID:        %s\n", a.m_userid.c_str());
+					LogNotice("Default clock:  %.2f MHz\n", a.m_freq/1000000.0f);
+					idev++;
 				}
 			}
 		#else	//#ifdef HAVE_FTD2XX
@@ -574,29 +1304,27 @@ void ListAdapters()
 		#ifdef HAVE_LIBUSB
 			ver = GlasgowSWDInterface::GetAPIVersion();
 			LogNotice("Glasgow API version: %s\n", ver.c_str());
-			ndev = GlasgowSWDInterface::GetInterfaceCount();
-			LogNotice("    Enumerating interfaces... %d found\n", ndev);
-			if(ndev == 0)
+			auto glist = glasgow.get();
+			LogNotice("    Enumerating interfaces... %d found\n", glist.m_count);
+			if(glist.m_count == 0)
 				LogNotice("No interfaces found\n");
 			else
 			{
 				int idev = 0;
 				LogIndenter li;
-				for(int i=0; i<ndev; i++)
+				for(auto& a : glist.m_adapters)
 				{
-					try
+					if(!a.m_ok)
 					{
-						LogNotice("Interface %d: %s\n", idev, GlasgowSWDInterface::GetDescription(i).c_str());
-						LogIndenter li;
-						LogNotice("Serial number:  %s\n", GlasgowSWDInterface::GetSerialNumber(i).c_str());
-						LogNotice("User ID:        %s\n", GlasgowSWDInterface::GetSerialNumber(i).c_str());
-						//LogNotice("Default clock:  %.2f MHz\n", GlasgowSWDInterface::GetDefaultFrequency(i)/1000000.0f);
-						idev++;
-					}
-					catch(const JtagException& e)
-					{
-						LogNotice("Interface %d: Error getting device information\n", i);
+						LogNotice("Interface %d: Error getting device information\n", a.m_index);
+						continue;
 					}
+
+					LogNotice("Interface %d: %s\n", idev, a.m_name.c_str());
+					LogIndenter li;
+					LogNotice("Serial number:  %s\n", a.m_serial.c_str());
+					LogNotice("User ID:        %s\n", a.m_userid.c_str());
+					idev++;
 				}
 			}
 		#else	//#ifdef HAVE_LIBUSB